@@ -0,0 +1,437 @@
+#include <iostream>
+#include <algorithm>
+#include <IL/il.h>
+
+#include "AssetLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+
+// DevIL keeps the bound image in global state, decoding has to be serialized
+static std::mutex devilMutex;
+
+//============================================================================================================================
+static void importMaterial ( const std::string &fileName, const aiMaterial * mat, MeshMaterial &material )
+{
+	aiColor4D color;
+	aiString name;
+	aiReturn retValue = AI_SUCCESS;
+
+	// Get returns: aiReturn_SUCCESS 0 | aiReturn_FAILURE -1 | aiReturn_OUTOFMEMORY -3
+	mat->Get(AI_MATKEY_NAME, name); // may be "" after the input mesh processing. Must be aiString type!
+
+	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &color)) != AI_SUCCESS)
+		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+
+	material.diffuse = glm::vec3(color.r, color.g, color.b);
+
+	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &color)) != AI_SUCCESS)
+		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+	material.ambient = glm::vec3(color.r, color.g, color.b);
+
+	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &color)) != AI_SUCCESS)
+		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+	material.specular = glm::vec3(color.r, color.g, color.b);
+
+	ai_real shininess, strength;
+	unsigned int max;	// changed: to unsigned
+
+	max = 1;
+	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS, &shininess, &max)) != AI_SUCCESS)
+		shininess = 1.0f;
+	max = 1;
+	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS_STRENGTH, &strength, &max)) != AI_SUCCESS)
+		strength = 1.0f;
+	material.shininess = shininess * strength;
+
+	material.textureName.clear();
+
+	// texture image
+	if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
+		// get texture name 
+		aiString path; // filename
+
+		aiReturn texFound = mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
+		std::string textureName = path.data;
+
+		size_t found = fileName.find_last_of("/\\");
+		// insert correct texture file path 
+		if (found != std::string::npos) { // not found
+										  //subMesh_p->textureName.insert(0, "/");
+			textureName.insert(0, fileName.substr(0, found + 1));
+		}
+
+		material.textureName = textureName;
+	}
+}
+
+// append vertices and triangles of one assimp mesh, indices are rebased to the shared vertex array
+static void appendMesh ( const aiMesh * mesh, MeshData &meshData )
+{
+	const unsigned int baseVertex = (unsigned int)(meshData.vertices.size() / meshFloatsPerVertex);
+
+	// interleave positions, normals and texture coordinates (just texture 0 for now)
+	meshData.vertices.resize(meshData.vertices.size() + meshFloatsPerVertex * mesh->mNumVertices);
+	float *currentVertex = &meshData.vertices[baseVertex * meshFloatsPerVertex];
+
+	for (unsigned int idx = 0; idx < mesh->mNumVertices; idx++) {
+		*currentVertex++ = mesh->mVertices[idx].x;
+		*currentVertex++ = mesh->mVertices[idx].y;
+		*currentVertex++ = mesh->mVertices[idx].z;
+
+		*currentVertex++ = mesh->mNormals[idx].x;
+		*currentVertex++ = mesh->mNormals[idx].y;
+		*currentVertex++ = mesh->mNormals[idx].z;
+
+		// we use 2D textures with 2 coordinates and ignore the third coordinate
+		if (mesh->HasTextureCoords(0)) {
+			*currentVertex++ = mesh->mTextureCoords[0][idx].x;
+			*currentVertex++ = mesh->mTextureCoords[0][idx].y;
+		}
+		else {
+			*currentVertex++ = 0.0f;
+			*currentVertex++ = 0.0f;
+		}
+	}
+
+	// copy all mesh faces into one big array (assimp supports faces with ordinary number of vertices, we use only 3 -> triangles)
+	for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+		// points and lines left by the triangulation are skipped
+		if (mesh->mFaces[f].mNumIndices != 3)
+			continue;
+
+		meshData.indices.push_back(baseVertex + mesh->mFaces[f].mIndices[0]);
+		meshData.indices.push_back(baseVertex + mesh->mFaces[f].mIndices[1]);
+		meshData.indices.push_back(baseVertex + mesh->mFaces[f].mIndices[2]);
+	}
+}
+
+bool importMesh(const std::string &fileName, MeshData &meshData) {
+	Assimp::Importer importer;
+
+	// Unitize object in size (scale the model to fit into (-1..1)^3)
+	importer.SetPropertyInteger(AI_CONFIG_PP_PTV_NORMALIZE, 1);
+
+	// Load asset from the file - you can play with various processing steps
+	const aiScene * scn = importer.ReadFile(fileName.c_str(), 0
+		| aiProcess_Triangulate             // Triangulate polygons (if any).
+		| aiProcess_PreTransformVertices    // Transforms scene hierarchy into one root with geometry-leafs only. For more see Doc.
+		| aiProcess_GenSmoothNormals        // Calculate normals per vertex.
+		| aiProcess_JoinIdenticalVertices);
+
+	// abort if the loader fails
+	if (scn == NULL) {
+		std::cerr << "assimp error: " << importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	if (scn->mNumMeshes == 0) {
+		std::cerr << "no meshes in file: " << fileName << std::endl;
+		return false;
+	}
+
+	meshData.vertices.clear();
+	meshData.indices.clear();
+	meshData.subMeshes.clear();
+	meshData.materials.clear();
+
+	// materials actually used by some mesh, sorted by their texture
+	std::vector<MeshMaterial> sceneMaterials(scn->mNumMaterials);
+	std::vector<bool> materialUsed(scn->mNumMaterials, false);
+	std::vector<std::pair<std::string, unsigned int> > drawOrder;
+
+	for (unsigned int m = 0; m < scn->mNumMeshes; m++) {
+		unsigned int materialIndex = scn->mMeshes[m]->mMaterialIndex;
+
+		if (!materialUsed[materialIndex]) {
+			materialUsed[materialIndex] = true;
+			importMaterial(fileName, scn->mMaterials[materialIndex], sceneMaterials[materialIndex]);
+			drawOrder.push_back(std::make_pair(sceneMaterials[materialIndex].textureName, materialIndex));
+		}
+	}
+
+	// materials sharing a texture end up next to each other, untextured ones first
+	std::sort(drawOrder.begin(), drawOrder.end());
+
+	// all meshes with the same material are merged into one submesh, i.e. one draw call
+	for (size_t i = 0; i < drawOrder.size(); i++) {
+		const unsigned int materialIndex = drawOrder[i].second;
+		const unsigned int firstIndex = (unsigned int)meshData.indices.size();
+
+		for (unsigned int m = 0; m < scn->mNumMeshes; m++) {
+			if (scn->mMeshes[m]->mMaterialIndex == materialIndex)
+				appendMesh(scn->mMeshes[m], meshData);
+		}
+
+		if (meshData.indices.size() == firstIndex)
+			continue;
+
+		SubMeshData subMesh;
+		subMesh.firstIndex = firstIndex;
+		subMesh.numIndices = (unsigned int)meshData.indices.size() - firstIndex;
+		subMesh.material = (unsigned int)meshData.materials.size();
+		subMesh.lod = 0;
+
+		meshData.subMeshes.push_back(subMesh);
+		meshData.materials.push_back(sceneMaterials[materialIndex]);
+	}
+
+	if (meshData.indices.empty()) {
+		std::cerr << "no triangles in file: " << fileName << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool loadMesh ( const std::string &fileName, LoadedMesh &mesh )
+{
+	// cooked file is mapped straight into the buffer upload, no parsing at all
+	if (openMeshCache(fileName, mesh.cookedFile, mesh.cooked))
+	{
+		mesh.vertices = mesh.cooked.vertices;
+		mesh.numVertices = mesh.cooked.numVertices;
+		mesh.vertexFormat = mesh.cooked.vertexFormat;
+		mesh.indices = mesh.cooked.indices;
+		mesh.numIndices = mesh.cooked.numIndices;
+		mesh.indexSize = mesh.cooked.indexSize;
+		mesh.subMeshes = &mesh.cooked.subMeshes;
+		mesh.materials = &mesh.cooked.materials;
+		return true;
+	}
+
+	if (!importMesh(fileName, mesh.imported))
+		return false;
+
+	generateLods(fileName, mesh.imported);
+	optimizeMesh(fileName, mesh.imported);
+
+	const unsigned int numVertices = (unsigned int)(mesh.imported.vertices.size() / meshFloatsPerVertex);
+	mesh.imported.vertexFormat = packVertices(mesh.imported.vertices, mesh.imported.packedVertices);
+	mesh.imported.indexSize = packIndices(mesh.imported.indices, numVertices, mesh.imported.packedIndices);
+
+	if (!writeMeshCache(fileName, mesh.imported))
+		std::cerr << "couldn't cook mesh file: " << fileName << std::endl;
+
+	mesh.vertices = &mesh.imported.packedVertices[0];
+	mesh.numVertices = numVertices;
+	mesh.vertexFormat = mesh.imported.vertexFormat;
+	mesh.indices = &mesh.imported.packedIndices[0];
+	mesh.numIndices = (unsigned int)mesh.imported.indices.size();
+	mesh.indexSize = mesh.imported.indexSize;
+	mesh.subMeshes = &mesh.imported.subMeshes;
+	mesh.materials = &mesh.imported.materials;
+	return true;
+}
+
+bool decodeImage ( const std::string &fileName, DecodedImage &image )
+{
+	std::lock_guard<std::mutex> lock(devilMutex);
+
+	// first row at the bottom like pgr::createTexture() did, which the texture coordinates of the models expect
+	ilEnable(IL_ORIGIN_SET);
+	ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+
+	ILuint imageName = ilGenImage();
+	ilBindImage(imageName);
+
+	if (!ilLoadImage(fileName.c_str()) || !ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE))
+	{
+		std::cerr << "couldn't decode image: " << fileName << std::endl;
+		ilDeleteImage(imageName);
+		return false;
+	}
+
+	image = DecodedImage();
+	image.width = ilGetInteger(IL_IMAGE_WIDTH);
+	image.height = ilGetInteger(IL_IMAGE_HEIGHT);
+
+	const ILubyte * data = ilGetData();
+	image.pixels.assign(data, data + 4 * image.width * image.height);
+
+	ilDeleteImage(imageName);
+	return true;
+}
+
+bool loadImage ( const std::string &fileName, bool compress, DecodedImage &image )
+{
+	if (compress && openTextureCache(fileName, image))
+		return true;
+
+	if (!decodeImage(fileName, image))
+		return false;
+
+	if (compress)
+	{
+		compressImage(image);
+
+		if (!writeTextureCache(fileName, image))
+			std::cerr << "couldn't cook texture file: " << fileName << std::endl;
+	}
+
+	return true;
+}
+
+//============================================================================================================================
+
+AssetLoader::AssetLoader ( unsigned int numThreads, bool compressTextures )
+	: stopping(false), compressTextures(compressTextures)
+{
+	if (numThreads == 0)
+	{
+		// leave one core to the GL thread which uploads the results meanwhile
+		unsigned int cores = std::thread::hardware_concurrency();
+		numThreads = (cores > 1) ? cores - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		workers.push_back(std::thread(&AssetLoader::workerLoop, this));
+}
+
+AssetLoader::~AssetLoader ( )
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	// assets which were prefetched but never taken
+	for (std::map<std::string, Asset *>::iterator it = assets.begin(); it != assets.end(); ++it)
+	{
+		delete it->second->mesh;
+		delete it->second;
+	}
+}
+
+void AssetLoader::prefetchMesh ( const std::string &fileName )
+{
+	prefetch(ASSET_MESH, fileName);
+}
+
+void AssetLoader::prefetchImage ( const std::string &fileName )
+{
+	prefetch(ASSET_IMAGE, fileName);
+}
+
+void AssetLoader::prefetch ( AssetType type, const std::string &fileName )
+{
+	const std::string key = (type == ASSET_MESH ? "mesh:" : "image:") + fileName;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (assets.find(key) != assets.end())
+		return;
+
+	Asset * asset = new Asset;
+	asset->type = type;
+	asset->fileName = fileName;
+	asset->done = false;
+	asset->ok = false;
+	asset->mesh = NULL;
+
+	assets[key] = asset;
+	queue.push_back(asset);
+	jobAvailable.notify_one();
+}
+
+AssetLoader::Asset * AssetLoader::waitFor ( AssetType type, const std::string &fileName )
+{
+	const std::string key = (type == ASSET_MESH ? "mesh:" : "image:") + fileName;
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	std::map<std::string, Asset *>::iterator it = assets.find(key);
+	if (it == assets.end())
+		return NULL;
+
+	Asset * asset = it->second;
+	while (!asset->done)
+		jobDone.wait(lock);
+
+	assets.erase(it);
+	return asset;
+}
+
+LoadedMesh * AssetLoader::takeMesh ( const std::string &fileName )
+{
+	Asset * asset = waitFor(ASSET_MESH, fileName);
+
+	if (asset == NULL)
+	{
+		LoadedMesh * mesh = new LoadedMesh;
+		if (!loadMesh(fileName, *mesh))
+		{
+			delete mesh;
+			return NULL;
+		}
+		return mesh;
+	}
+
+	LoadedMesh * mesh = asset->ok ? asset->mesh : NULL;
+	if (!asset->ok)
+		delete asset->mesh;
+	delete asset;
+
+	return mesh;
+}
+
+bool AssetLoader::takeImage ( const std::string &fileName, DecodedImage &image )
+{
+	Asset * asset = waitFor(ASSET_IMAGE, fileName);
+
+	if (asset == NULL)
+		return loadImage(fileName, compressTextures, image);
+
+	bool ok = asset->ok;
+	if (ok)
+		std::swap(image, asset->image);
+	delete asset;
+
+	return ok;
+}
+
+void AssetLoader::workerLoop ( void )
+{
+	for (;;)
+	{
+		Asset * asset;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (queue.empty() && !stopping)
+				jobAvailable.wait(lock);
+
+			if (stopping)
+				return;
+
+			asset = queue.front();
+			queue.pop_front();
+		}
+
+		bool ok;
+		if (asset->type == ASSET_MESH)
+		{
+			asset->mesh = new LoadedMesh;
+			ok = loadMesh(asset->fileName, *asset->mesh);
+
+			// textures of the mesh are known only now, decode them on the pool as well
+			for (size_t i = 0; ok && i < asset->mesh->materials->size(); i++)
+			{
+				const std::string &textureName = (*asset->mesh->materials)[i].textureName;
+				if (!textureName.empty())
+					prefetchImage(textureName);
+			}
+		}
+		else
+			ok = loadImage(asset->fileName, compressTextures, asset->image);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			asset->ok = ok;
+			asset->done = true;
+		}
+		jobDone.notify_all();
+	}
+}
@@ -0,0 +1,111 @@
+/**
+* \file       AssetLoader.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Asset import running on a pool of worker threads.
+*
+* Only the CPU half of loading (file reading, mesh import and cooking, image decoding and compression) runs on the
+* workers, the GL thread takes the finished data and uploads it. Assets are requested up front with
+* prefetch*() and taken with take*() which blocks until that particular asset is ready.
+*/
+
+#pragma once
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MeshData.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+
+// mesh ready for upload, either mapped from its cooked file or freshly imported
+typedef struct LoadedMesh
+{
+	MappedFile      cookedFile;
+	CookedMeshView  cooked;       // valid if the cooked file is mapped
+	MeshData        imported;     // valid otherwise
+
+	const void *         vertices;
+	unsigned int         numVertices;
+	VertexFormat         vertexFormat;
+	const void *         indices;
+	unsigned int         numIndices;
+	unsigned int         indexSize;
+
+	const std::vector<SubMeshData> *  subMeshes;
+	const std::vector<MeshMaterial> * materials;
+
+} LoadedMesh;
+
+/** Import all meshes of a model file using assimp library, meshes sharing a material are merged into one submesh.
+* \param fileName [in] file to open/load
+* \param meshData [out] interleaved vertices |x,y,z,nx,ny,nz,u,v|..., triangle indices, submeshes and their materials
+*/
+bool importMesh ( const std::string &fileName, MeshData &meshData );
+
+/// Map the cooked mesh file, or import the source file, generate its LODs, optimize it, pack it and cook it for the next run. Thread-safe.
+bool loadMesh ( const std::string &fileName, LoadedMesh &mesh );
+
+/// Decode image file to RGBA. Thread-safe, although DevIL calls are serialized internally.
+bool decodeImage ( const std::string &fileName, DecodedImage &image );
+
+/** Load image for upload. Thread-safe.
+* \param compress [in] load the cooked compressed image, or decode, compress and cook the source image if it is not up to date
+* \param image [out] RGBA pixels, or the compressed mip chain if compress is set
+*/
+bool loadImage ( const std::string &fileName, bool compress, DecodedImage &image );
+
+class AssetLoader
+{
+public:
+	/** \param numThreads number of worker threads, 0 = one less than the number of cores
+	* \param compressTextures images are loaded block compressed, see loadImage()
+	*/
+	AssetLoader ( unsigned int numThreads = 0, bool compressTextures = false );
+	~AssetLoader ( );
+
+	void prefetchMesh ( const std::string &fileName );
+	void prefetchImage ( const std::string &fileName );
+
+	/** Take the loaded mesh, waits for it if it is still being loaded.
+	* Assets which were not prefetched are loaded synchronously on the calling thread.
+	* \return NULL if loading failed, otherwise the mesh which the caller deletes after upload
+	*/
+	LoadedMesh * takeMesh ( const std::string &fileName );
+	bool takeImage ( const std::string &fileName, DecodedImage &image );
+
+private:
+	enum AssetType { ASSET_MESH, ASSET_IMAGE };
+
+	typedef struct Asset
+	{
+		AssetType     type;
+		std::string   fileName;
+		bool          done;
+		bool          ok;
+
+		LoadedMesh *  mesh;
+		DecodedImage  image;
+
+	} Asset;
+
+	AssetLoader ( const AssetLoader & );
+	AssetLoader & operator= ( const AssetLoader & );
+
+	void prefetch ( AssetType type, const std::string &fileName );
+	Asset * waitFor ( AssetType type, const std::string &fileName );
+	void workerLoop ( void );
+
+	std::vector<std::thread>        workers;
+	std::mutex                      mutex;
+	std::condition_variable         jobAvailable;
+	std::condition_variable         jobDone;
+	std::deque<Asset *>             queue;
+	std::map<std::string, Asset *>  assets;   // key is type + file name
+	bool                            stopping;
+	const bool                      compressTextures;
+};
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "Culling.h"
+
+// leaves hold up to this many boxes, testing them one by one is cheaper than going deeper
+static const int MAX_LEAF_ITEMS = 2;
+
+// orders the items of a node along one axis of their centers
+typedef struct CenterLess
+{
+	const std::vector<glm::vec3> *  centers;
+	int                             axis;
+
+	bool operator() ( int a, int b ) const { return (*centers)[a][axis] < (*centers)[b][axis]; }
+
+} CenterLess;
+
+//============================================================================================================================
+
+BoundingBox transformBoundingBox ( const BoundingBox &box, const glm::mat4 &matrix )
+{
+	// Arvo: each output axis is the translation plus the extremes of the matrix entries times the box
+	BoundingBox result;
+	result.min = glm::vec3(matrix[3]);
+	result.max = result.min;
+
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			const float a = matrix[column][row] * box.min[column];
+			const float b = matrix[column][row] * box.max[column];
+
+			result.min[row] += std::min(a, b);
+			result.max[row] += std::max(a, b);
+		}
+	}
+
+	return result;
+}
+
+BoundingBox mergeBoundingBoxes ( const BoundingBox &a, const BoundingBox &b )
+{
+	BoundingBox result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+
+	return result;
+}
+
+Frustum extractFrustum ( const glm::mat4 &PVmatrix )
+{
+	// Gribb & Hartmann: the planes are sums and differences of the last row and the other rows
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+		rows[row] = glm::vec4(PVmatrix[0][row], PVmatrix[1][row], PVmatrix[2][row], PVmatrix[3][row]);
+
+	const glm::vec4 planes[6] = {
+		rows[3] + rows[0], rows[3] - rows[0],     // left, right
+		rows[3] + rows[1], rows[3] - rows[1],     // bottom, top
+		rows[3] + rows[2], rows[3] - rows[2]      // near, far
+	};
+
+	Frustum frustum;
+	for (int i = 0; i < 8; i++)
+	{
+		// the padding planes have everything in front of them
+		const glm::vec4 plane = (i < 6) ? planes[i] / glm::length(glm::vec3(planes[i])) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		frustum.normalX[i] = plane.x;
+		frustum.normalY[i] = plane.y;
+		frustum.normalZ[i] = plane.z;
+		frustum.distance[i] = plane.w;
+	}
+
+	return frustum;
+}
+
+FrustumTest testFrustum ( const Frustum &frustum, const BoundingBox &box )
+{
+	const glm::vec3 center = 0.5f * (box.max + box.min);
+	const glm::vec3 extent = 0.5f * (box.max - box.min);
+
+	// distance of the center from each plane and the projected half size of the box onto its normal
+#ifdef CULLING_SSE
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 centerX = _mm_set1_ps(center.x), centerY = _mm_set1_ps(center.y), centerZ = _mm_set1_ps(center.z);
+	const __m128 extentX = _mm_set1_ps(extent.x), extentY = _mm_set1_ps(extent.y), extentZ = _mm_set1_ps(extent.z);
+
+	__m128 outside = _mm_setzero_ps();
+	__m128 intersects = _mm_setzero_ps();
+
+	for (int i = 0; i < 8; i += 4)
+	{
+		const __m128 normalX = _mm_loadu_ps(&frustum.normalX[i]);
+		const __m128 normalY = _mm_loadu_ps(&frustum.normalY[i]);
+		const __m128 normalZ = _mm_loadu_ps(&frustum.normalZ[i]);
+
+		__m128 distance = _mm_add_ps(_mm_mul_ps(normalX, centerX), _mm_loadu_ps(&frustum.distance[i]));
+		distance = _mm_add_ps(distance, _mm_mul_ps(normalY, centerY));
+		distance = _mm_add_ps(distance, _mm_mul_ps(normalZ, centerZ));
+
+		__m128 radius = _mm_mul_ps(_mm_andnot_ps(signMask, normalX), extentX);
+		radius = _mm_add_ps(radius, _mm_mul_ps(_mm_andnot_ps(signMask, normalY), extentY));
+		radius = _mm_add_ps(radius, _mm_mul_ps(_mm_andnot_ps(signMask, normalZ), extentZ));
+
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		intersects = _mm_or_ps(intersects, _mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+	}
+
+	if (_mm_movemask_ps(outside) != 0)
+		return FRUSTUM_OUTSIDE;
+
+	return (_mm_movemask_ps(intersects) != 0) ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+#else
+	FrustumTest result = FRUSTUM_INSIDE;
+
+	for (int i = 0; i < 6; i++)
+	{
+		const float distance = frustum.normalX[i] * center.x + frustum.normalY[i] * center.y + frustum.normalZ[i] * center.z + frustum.distance[i];
+		const float radius = fabsf(frustum.normalX[i]) * extent.x + fabsf(frustum.normalY[i]) * extent.y + fabsf(frustum.normalZ[i]) * extent.z;
+
+		if (distance + radius < 0.0f)
+			return FRUSTUM_OUTSIDE;
+		if (distance - radius < 0.0f)
+			result = FRUSTUM_INTERSECTS;
+	}
+
+	return result;
+#endif
+}
+
+void printCullingStatistics ( const CullingStatistics &statistics )
+{
+	std::cout << "Culling: " << statistics.visible << " objects drawn, " << statistics.culled << " culled, " << statistics.occluded
+		<< " occluded of " << statistics.objects << " (" << statistics.boxTests << " box tests)" << std::endl;
+}
+
+void BoundingVolumeHierarchy::build ( const std::vector<BoundingBox> &objectBoxes )
+{
+	nodes.clear();
+	boxes = objectBoxes;
+	items.resize(boxes.size());
+	centers.resize(boxes.size());
+
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		items[i] = (int)i;
+		centers[i] = 0.5f * (boxes[i].min + boxes[i].max);
+	}
+
+	if (!boxes.empty())
+		buildNode(0, (int)boxes.size());
+}
+
+// top down, the items are split in the middle along the longest axis of their centers
+int BoundingVolumeHierarchy::buildNode ( int firstItem, int numItems )
+{
+	const int index = (int)nodes.size();
+	nodes.push_back(Node());
+
+	BoundingBox bounds = boxes[items[firstItem]];
+	glm::vec3 centerMin = centers[items[firstItem]];
+	glm::vec3 centerMax = centerMin;
+
+	for (int i = firstItem + 1; i < firstItem + numItems; i++)
+	{
+		bounds = mergeBoundingBoxes(bounds, boxes[items[i]]);
+		centerMin = glm::min(centerMin, centers[items[i]]);
+		centerMax = glm::max(centerMax, centers[items[i]]);
+	}
+
+	int left = -1;
+	int right = -1;
+
+	if (numItems > MAX_LEAF_ITEMS)
+	{
+		const glm::vec3 size = centerMax - centerMin;
+
+		CenterLess less;
+		less.centers = &centers;
+		less.axis = (size.x >= size.y && size.x >= size.z) ? 0 : ((size.y >= size.z) ? 1 : 2);
+
+		const int half = numItems / 2;
+		std::nth_element(items.begin() + firstItem, items.begin() + firstItem + half, items.begin() + firstItem + numItems, less);
+
+		// the vector may reallocate, the node is written after the children
+		left = buildNode(firstItem, half);
+		right = buildNode(firstItem + half, numItems - half);
+	}
+
+	Node &node = nodes[index];
+	node.bounds = bounds;
+	node.left = left;
+	node.right = right;
+	node.firstItem = firstItem;
+	node.numItems = numItems;
+
+	return index;
+}
+
+void BoundingVolumeHierarchy::cull ( const Frustum &frustum, std::vector<unsigned char> &visible, CullingStatistics &statistics ) const
+{
+	visible.assign(items.size(), 0);
+
+	if (nodes.empty())
+		return;
+
+	// a node inside the frustum makes its whole subtree visible without testing it
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node &node = nodes[stack[--stackSize]];
+
+		statistics.boxTests++;
+		const FrustumTest test = testFrustum(frustum, node.bounds);
+
+		if (test == FRUSTUM_OUTSIDE)
+			continue;
+
+		if (test == FRUSTUM_INSIDE || node.left < 0)
+		{
+			for (int i = node.firstItem; i < node.firstItem + node.numItems; i++)
+			{
+				// boxes of a partially visible leaf are tested one by one
+				bool inside = (test == FRUSTUM_INSIDE || node.numItems == 1);
+				if (!inside)
+				{
+					statistics.boxTests++;
+					inside = (testFrustum(frustum, boxes[items[i]]) != FRUSTUM_OUTSIDE);
+				}
+
+				if (inside)
+					visible[items[i]] = 1;
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.left;
+		stack[stackSize++] = node.right;
+	}
+}
@@ -0,0 +1,92 @@
+/**
+* \file       Culling.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Bounding boxes, view frustum tests and the bounding volume hierarchy used to cull the scene objects.
+*
+* The frustum planes are stored four by four so that one box is tested against four planes at once with SSE,
+* the hierarchy skips the tests of whole subtrees which are completely inside or outside of the frustum.
+*/
+
+#pragma once
+#include <vector>
+
+#include "pgr.h"
+
+typedef struct BoundingBox
+{
+	glm::vec3  min;
+	glm::vec3  max;
+
+} BoundingBox;
+
+/// Smallest axis aligned box around the transformed box.
+BoundingBox transformBoundingBox ( const BoundingBox &box, const glm::mat4 &matrix );
+
+/// Box around both boxes.
+BoundingBox mergeBoundingBoxes ( const BoundingBox &a, const BoundingBox &b );
+
+enum FrustumTest
+{
+	FRUSTUM_OUTSIDE = 0,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+// six planes pointing inside, in structure of arrays layout padded to eight with planes containing everything
+typedef struct Frustum
+{
+	float  normalX[8];
+	float  normalY[8];
+	float  normalZ[8];
+	float  distance[8];
+
+} Frustum;
+
+/// Planes of the frustum of the projection * view matrix, in world space.
+Frustum extractFrustum ( const glm::mat4 &PVmatrix );
+
+/// Where the box lies with respect to the frustum. Boxes near its corners may be reported as intersecting although they are outside.
+FrustumTest testFrustum ( const Frustum &frustum, const BoundingBox &box );
+
+typedef struct CullingStatistics
+{
+	unsigned int  objects;      // tested objects (items without bounds are not counted)
+	unsigned int  visible;
+	unsigned int  culled;       // outside of the frustum
+	unsigned int  occluded;     // in the frustum, hidden behind the occluders
+	unsigned int  boxTests;     // frustum tests of the hierarchy nodes
+
+} CullingStatistics;
+
+void printCullingStatistics ( const CullingStatistics &statistics );
+
+class BoundingVolumeHierarchy
+{
+public:
+	/// Build the hierarchy over the boxes, the memory is kept for the next build.
+	void build ( const std::vector<BoundingBox> &objectBoxes );
+
+	/** Mark the boxes which are at least partially in the frustum.
+	* \param visible [out] one entry per box of the last build, 1 = visible
+	*/
+	void cull ( const Frustum &frustum, std::vector<unsigned char> &visible, CullingStatistics &statistics ) const;
+
+private:
+	typedef struct Node
+	{
+		BoundingBox  bounds;
+		int          left;        // children of inner nodes, -1 in leaves
+		int          right;
+		int          firstItem;   // range of the items below the node
+		int          numItems;
+
+	} Node;
+
+	int buildNode ( int firstItem, int numItems );
+
+	std::vector<Node>         nodes;
+	std::vector<BoundingBox>  boxes;
+	std::vector<glm::vec3>    centers;
+	std::vector<int>          items;     // box indices ordered so that every node has a continuous range of them
+};
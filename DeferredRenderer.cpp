@@ -0,0 +1,198 @@
+#include <iostream>
+
+#include "DeferredRenderer.h"
+#include "GLState.h"
+
+// names of the outputs of gbuffer.fs, in the order of GBufferTarget
+static const char * GBUFFER_OUTPUTS[NUM_GBUFFER_TARGETS] = { "gAlbedo", "gDiffuse", "gAmbient", "gSpecular" };
+
+static const GLint GBUFFER_UNITS[NUM_GBUFFER_TARGETS] = { GBUFFER_ALBEDO_UNIT, GBUFFER_DIFFUSE_UNIT, GBUFFER_AMBIENT_UNIT, GBUFFER_SPECULAR_UNIT };
+
+// the texture color fits 8 bits, the materials are not clamped and the shininess is in tens
+static const GLenum GBUFFER_FORMATS[NUM_GBUFFER_TARGETS] = { GL_RGBA8, GL_RGBA16F, GL_RGBA16F, GL_RGBA16F };
+
+//============================================================================================================================
+
+static GLuint createTarget ( GLenum internalFormat, GLenum format, GLenum type, int width, int height )
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+
+	cachedBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	return texture;
+}
+
+static bool framebufferComplete ( const char * name )
+{
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status == GL_FRAMEBUFFER_COMPLETE)
+		return true;
+
+	std::cerr << "Deferred renderer: " << name << " framebuffer incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+	return false;
+}
+
+DeferredRenderer::DeferredRenderer ( ) :
+	width(0), height(0), gbufferFramebuffer(0), depthStencil(0), accumulationFramebuffer(0), accumulation(0), mappedProgram(0)
+{
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+	{
+		targets[i] = 0;
+		drawBuffers[i] = GL_NONE;
+	}
+
+	glGenVertexArrays(1, &emptyVertexArray);
+}
+
+DeferredRenderer::~DeferredRenderer ( )
+{
+	releaseTargets();
+	glDeleteVertexArrays(1, &emptyVertexArray);
+}
+
+void DeferredRenderer::releaseTargets ( void )
+{
+	glDeleteFramebuffers(1, &gbufferFramebuffer);
+	glDeleteFramebuffers(1, &accumulationFramebuffer);
+	glDeleteTextures(NUM_GBUFFER_TARGETS, targets);
+	glDeleteTextures(1, &depthStencil);
+	glDeleteTextures(1, &accumulation);
+
+	gbufferFramebuffer = 0;
+	accumulationFramebuffer = 0;
+	depthStencil = 0;
+	accumulation = 0;
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+		targets[i] = 0;
+
+	// the new framebuffer has the default draw buffers
+	mappedProgram = 0;
+}
+
+void DeferredRenderer::createTargets ( int newWidth, int newHeight )
+{
+	releaseTargets();
+
+	width = newWidth;
+	height = newHeight;
+
+	cachedActiveTexture(GL_TEXTURE0);
+
+	glGenFramebuffers(1, &gbufferFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbufferFramebuffer);
+
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+	{
+		const GLenum type = (GBUFFER_FORMATS[i] == GL_RGBA8) ? GL_UNSIGNED_BYTE : GL_FLOAT;
+		targets[i] = createTarget(GBUFFER_FORMATS[i], GL_RGBA, type, width, height);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, targets[i], 0);
+	}
+
+	// the stencil holds the object IDs for picking, like the window's
+	depthStencil = createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencil, 0);
+	framebufferComplete("G-buffer");
+
+	glGenFramebuffers(1, &accumulationFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, accumulationFramebuffer);
+
+	accumulation = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT, width, height);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulation, 0);
+	framebufferComplete("light accumulation");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+void DeferredRenderer::beginGeometry ( GLuint program )
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	if (viewport[2] != width || viewport[3] != height)
+		createTargets(viewport[2], viewport[3]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gbufferFramebuffer);
+
+	// fragment outputs are assigned locations at link time, so after a reload too
+	if (program != mappedProgram)
+	{
+		for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+			drawBuffers[i] = GL_NONE;
+
+		for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+		{
+			const GLint location = glGetFragDataLocation(program, GBUFFER_OUTPUTS[i]);
+			if (location >= 0 && location < NUM_GBUFFER_TARGETS)
+				drawBuffers[location] = GL_COLOR_ATTACHMENT0 + i;
+		}
+
+		glDrawBuffers(NUM_GBUFFER_TARGETS, drawBuffers);
+		mappedProgram = program;
+	}
+
+	// without touching the window's clear color
+	const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+		glClearBufferfv(GL_COLOR, i, zero);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+void DeferredRenderer::bindSamplers ( const DeferredShaderProgram &shader, const glm::mat4 &inverseProjection )
+{
+	cachedUseProgram(shader.program);
+
+	glUniformMatrix4fv(shader.inverseProjectionLocation, 1, GL_FALSE, glm::value_ptr(inverseProjection));
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+		glUniform1i(shader.samplerLocations[i], GBUFFER_UNITS[i]);
+	glUniform1i(shader.depthSamplerLocation, GBUFFER_DEPTH_UNIT);
+	glUniform1i(shader.accumulationSamplerLocation, ACCUMULATION_UNIT);
+	setLightSamplers(shader.lightSamplers);
+}
+
+void DeferredRenderer::resolve ( const DeferredShaderProgram &light, const DeferredShaderProgram &composite, const glm::mat4 &projectionMatrix )
+{
+	const glm::mat4 inverseProjection = glm::inverse(projectionMatrix);
+
+	// every pixel is drawn once, the tests are back on for the rest of the opaque pass when done
+	cachedDisable(GL_DEPTH_TEST);
+	cachedDisable(GL_STENCIL_TEST);
+
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+	{
+		cachedActiveTexture(GL_TEXTURE0 + GBUFFER_UNITS[i]);
+		cachedBindTexture(GL_TEXTURE_2D, targets[i]);
+	}
+	cachedActiveTexture(GL_TEXTURE0 + GBUFFER_DEPTH_UNIT);
+	cachedBindTexture(GL_TEXTURE_2D, depthStencil);
+	cachedActiveTexture(GL_TEXTURE0 + ACCUMULATION_UNIT);
+	cachedBindTexture(GL_TEXTURE_2D, accumulation);
+	cachedActiveTexture(GL_TEXTURE0);
+
+	cachedBindVertexArray(emptyVertexArray);
+
+	// the background is discarded by both passes, the skybox is drawn there afterwards
+	glBindFramebuffer(GL_FRAMEBUFFER, accumulationFramebuffer);
+	bindSamplers(light, inverseProjection);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	bindSamplers(composite, inverseProjection);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// the depth for the skybox and the flames, the stencil for picking, both formats are 24/8
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gbufferFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	cachedEnable(GL_DEPTH_TEST);
+	cachedEnable(GL_STENCIL_TEST);
+
+	CHECK_GL_ERROR();
+}
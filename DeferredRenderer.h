@@ -0,0 +1,83 @@
+/**
+* \file       DeferredRenderer.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Deferred shading of the lit opaque meshes, selected with --deferred instead of the forward perFrag.fs.
+*
+* The lit meshes write their texture color, materials and normal into a G-buffer (gbuffer.fs). One full screen pass
+* then lights every pixel once with the clustered lights (deferredLight.fs) and another one adds the fog and writes
+* the window (deferredComposite.fs). The depth and stencil of the G-buffer are copied to the window afterwards, so the
+* skybox, the flames, the overlays and the stencil picking work as with forward shading.
+*/
+
+#pragma once
+#include "pgr.h"
+#include "LightClusters.h"
+
+// texture units of the G-buffer in the full screen passes, after the ones of the lights
+const GLint GBUFFER_ALBEDO_UNIT = 5;
+const GLint GBUFFER_DIFFUSE_UNIT = 6;
+const GLint GBUFFER_AMBIENT_UNIT = 7;
+const GLint GBUFFER_SPECULAR_UNIT = 8;
+const GLint GBUFFER_DEPTH_UNIT = 9;
+const GLint ACCUMULATION_UNIT = 10;
+
+// color targets of the G-buffer, in the order of the outputs of gbuffer.fs
+enum GBufferTarget
+{
+	GBUFFER_ALBEDO = 0,
+	GBUFFER_DIFFUSE,
+	GBUFFER_AMBIENT,
+	GBUFFER_SPECULAR,
+	NUM_GBUFFER_TARGETS
+};
+
+// full screen programs, deferred.vs with deferredLight.fs or deferredComposite.fs, -1 for the samplers one does not use
+typedef struct DeferredShaderProgram
+{
+	GLuint program;
+	GLint inverseProjectionLocation;
+	GLint samplerLocations[NUM_GBUFFER_TARGETS];
+	GLint depthSamplerLocation;
+	GLint accumulationSamplerLocation;
+	LightSamplerLocations lightSamplers;
+
+} DeferredShaderProgram;
+
+class DeferredRenderer
+{
+public:
+	DeferredRenderer ( );
+	~DeferredRenderer ( );
+
+	/** Draw into the G-buffer from now on, cleared, resized to the viewport when it changed.
+	* \param program the G-buffer program, its outputs are mapped to the targets by name
+	*/
+	void beginGeometry ( GLuint program );
+
+	/// Light and composite the G-buffer into the window and copy its depth and stencil there. The window is bound afterwards.
+	void resolve ( const DeferredShaderProgram &light, const DeferredShaderProgram &composite, const glm::mat4 &projectionMatrix );
+
+private:
+	DeferredRenderer ( const DeferredRenderer & );
+	DeferredRenderer & operator= ( const DeferredRenderer & );
+
+	void createTargets ( int width, int height );
+	void releaseTargets ( void );
+	void bindSamplers ( const DeferredShaderProgram &shader, const glm::mat4 &inverseProjection );
+
+	int     width;
+	int     height;
+
+	GLuint  gbufferFramebuffer;
+	GLuint  targets[NUM_GBUFFER_TARGETS];
+	GLuint  depthStencil;
+
+	GLuint  accumulationFramebuffer;
+	GLuint  accumulation;
+
+	GLuint  emptyVertexArray;       // the full screen triangle has no attributes
+
+	GLuint  mappedProgram;          // G-buffer program the draw buffers were mapped for
+	GLenum  drawBuffers[NUM_GBUFFER_TARGETS];
+};
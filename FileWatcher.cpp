@@ -0,0 +1,139 @@
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "FileWatcher.h"
+
+// seconds between two checks of the modification times
+static const double POLL_INTERVAL = 0.5;
+
+//============================================================================================================================
+
+static time_t modificationTime ( const std::string &fileName )
+{
+	struct stat info;
+	return (stat(fileName.c_str(), &info) == 0) ? info.st_mtime : 0;
+}
+
+static double secondsNow ( void )
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "dir/name" -> "dir" and "name", a bare name lies in "."
+static void splitPath ( const std::string &fileName, std::string &directory, std::string &name )
+{
+	size_t slash = fileName.find_last_of("/\\");
+
+	if (slash == std::string::npos)
+	{
+		directory = ".";
+		name = fileName;
+	}
+	else
+	{
+		directory = fileName.substr(0, slash);
+		name = fileName.substr(slash + 1);
+	}
+}
+
+FileWatcher::FileWatcher ( )
+	: inotifyFd(-1), lastPollTime(0.0)
+{
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher ( )
+{
+#ifdef __linux__
+	if (inotifyFd >= 0)
+		close(inotifyFd);
+#endif
+}
+
+void FileWatcher::watch ( const std::string &fileName )
+{
+	std::string directory, name;
+	splitPath(fileName, directory, name);
+
+	const std::string path = directory + "/" + name;
+	if (filesByPath.find(path) != filesByPath.end())
+		return;
+
+	WatchedFile file;
+	file.fileName = fileName;
+	file.mtime = modificationTime(fileName);
+
+	files.push_back(file);
+	filesByPath[path] = fileName;
+
+#ifdef __linux__
+	if (inotifyFd >= 0)
+	{
+		// saved in place or written elsewhere and renamed over the old one, a file being created is not complete yet
+		int descriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (descriptor >= 0)
+			directories[descriptor] = directory;
+	}
+#endif
+}
+
+void FileWatcher::pollModificationTimes ( std::set<std::string> &changed )
+{
+	const double now = secondsNow();
+	if (now - lastPollTime < POLL_INTERVAL)
+		return;
+	lastPollTime = now;
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		time_t mtime = modificationTime(files[i].fileName);
+
+		if (mtime != files[i].mtime)
+		{
+			files[i].mtime = mtime;
+			changed.insert(files[i].fileName);
+		}
+	}
+}
+
+void FileWatcher::changedFiles ( std::vector<std::string> &changed )
+{
+	std::set<std::string> changedSet;
+
+#ifdef __linux__
+	if (inotifyFd >= 0)
+	{
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+
+		while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char * next = buffer; next < buffer + length; )
+			{
+				const struct inotify_event * event = (const struct inotify_event *)next;
+				next += sizeof(struct inotify_event) + event->len;
+
+				std::map<int, std::string>::const_iterator directory = directories.find(event->wd);
+				if (directory == directories.end() || event->len == 0)
+					continue;
+
+				std::map<std::string, std::string>::const_iterator file = filesByPath.find(directory->second + "/" + event->name);
+				if (file != filesByPath.end())
+					changedSet.insert(file->second);
+			}
+		}
+	}
+	else
+#endif
+		pollModificationTimes(changedSet);
+
+	changed.assign(changedSet.begin(), changedSet.end());
+}
@@ -0,0 +1,51 @@
+/**
+* \file       FileWatcher.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Detection of changed asset files for hot reload.
+*
+* Uses inotify on Linux (directories of the watched files are watched, so files replaced by
+* editors are caught as well), elsewhere the modification times are polled twice a second.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ctime>
+
+class FileWatcher
+{
+public:
+	FileWatcher ( );
+	~FileWatcher ( );
+
+	/// Start watching the file, it does not have to exist yet.
+	void watch ( const std::string &fileName );
+
+	/** Files changed since the last call, each reported once. Never blocks.
+	* \param changed [out] names exactly as passed to watch()
+	*/
+	void changedFiles ( std::vector<std::string> &changed );
+
+private:
+	FileWatcher ( const FileWatcher & );
+	FileWatcher & operator= ( const FileWatcher & );
+
+	typedef struct WatchedFile
+	{
+		std::string  fileName;
+		time_t       mtime;       // for polling
+
+	} WatchedFile;
+
+	void pollModificationTimes ( std::set<std::string> &changed );
+
+	std::vector<WatchedFile>                  files;
+	std::map<std::string, std::string>        filesByPath;     // directory + "/" + name -> name passed to watch()
+
+	int                                       inotifyFd;       // -1 = polling
+	std::map<int, std::string>                directories;     // inotify watch descriptor -> directory
+	double                                    lastPollTime;
+};
@@ -0,0 +1,28 @@
+#include <cstring>
+
+#include "GLCaps.h"
+
+bool glVersionAtLeast ( int major, int minor )
+{
+	GLint contextMajor = 0;
+	GLint contextMinor = 0;
+
+	glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+	glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+
+	return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+bool glHasExtension ( const char * name )
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+	for (GLint i = 0; i < count; i++)
+	{
+		const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension != NULL && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,15 @@
+/**
+* \file       GLCaps.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Queries of the OpenGL version and extensions available in the current context.
+*/
+
+#pragma once
+#include "pgr.h"
+
+/// True if the context version is at least major.minor.
+bool glVersionAtLeast ( int major, int minor );
+
+/// True if the context exposes extension of given name (e.g. "GL_ARB_buffer_storage").
+bool glHasExtension ( const char * name );
@@ -0,0 +1,240 @@
+#include <iostream>
+
+#include "GLState.h"
+
+// value of state which is not known, it is never a valid name or enum
+static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+static const unsigned int TRACKED_TEXTURE_UNITS = 16;
+
+static const GLenum TRACKED_CAPABILITIES[] = { GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_CULL_FACE };
+static const int NUM_TRACKED_CAPABILITIES = sizeof(TRACKED_CAPABILITIES) / sizeof(TRACKED_CAPABILITIES[0]);
+
+typedef struct GLStateCache
+{
+	GLuint     program;
+	GLuint     vertexArrayObject;
+	GLenum     activeTexture;
+	GLuint     textures2D[TRACKED_TEXTURE_UNITS];
+	GLuint     texturesCube[TRACKED_TEXTURE_UNITS];
+	GLuint     texturesBuffer[TRACKED_TEXTURE_UNITS];
+
+	GLuint     capabilities[NUM_TRACKED_CAPABILITIES];   // GL_TRUE, GL_FALSE or UNKNOWN
+
+	GLenum     blendSource;
+	GLenum     blendDestination;
+
+	GLenum     stencilFunction;
+	GLint      stencilReference;
+	GLuint     stencilMask;
+	GLenum     stencilFail;
+	GLenum     stencilDepthFail;
+	GLenum     stencilDepthPass;
+
+	GLuint     depthMask;
+
+} GLStateCache;
+
+static GLStateCache state;
+static bool stateValid = false;
+static GLStateStatistics statistics;
+
+//============================================================================================================================
+
+static void ensureValid ( void )
+{
+	if (!stateValid)
+		invalidateGLState();
+}
+
+// true if the value differs from the cached one (which is then updated), counts the skipped ones
+static bool changed ( GLStateKind kind, GLuint &cached, GLuint value )
+{
+	ensureValid();
+
+	if (cached == value)
+	{
+		statistics.skipped[kind]++;
+		return false;
+	}
+
+	cached = value;
+	statistics.issued[kind]++;
+	return true;
+}
+
+void invalidateGLState ( void )
+{
+	state.program = UNKNOWN;
+	state.vertexArrayObject = UNKNOWN;
+	state.activeTexture = UNKNOWN;
+	for (unsigned int i = 0; i < TRACKED_TEXTURE_UNITS; i++)
+	{
+		state.textures2D[i] = UNKNOWN;
+		state.texturesCube[i] = UNKNOWN;
+		state.texturesBuffer[i] = UNKNOWN;
+	}
+	for (int i = 0; i < NUM_TRACKED_CAPABILITIES; i++)
+		state.capabilities[i] = UNKNOWN;
+
+	state.blendSource = UNKNOWN;
+	state.blendDestination = UNKNOWN;
+	state.stencilFunction = UNKNOWN;
+	state.stencilReference = -1;
+	state.stencilMask = UNKNOWN;
+	state.stencilFail = UNKNOWN;
+	state.stencilDepthFail = UNKNOWN;
+	state.stencilDepthPass = UNKNOWN;
+	state.depthMask = UNKNOWN;
+
+	stateValid = true;
+}
+
+void cachedUseProgram ( GLuint program )
+{
+	if (changed(GL_STATE_PROGRAM, state.program, program))
+		glUseProgram(program);
+}
+
+void cachedBindVertexArray ( GLuint vertexArrayObject )
+{
+	if (changed(GL_STATE_VERTEX_ARRAY, state.vertexArrayObject, vertexArrayObject))
+		glBindVertexArray(vertexArrayObject);
+}
+
+void cachedActiveTexture ( GLenum unit )
+{
+	if (changed(GL_STATE_TEXTURE, state.activeTexture, unit))
+		glActiveTexture(unit);
+}
+
+void cachedBindTexture ( GLenum target, GLuint texture )
+{
+	ensureValid();
+
+	const GLuint unit = (state.activeTexture != UNKNOWN) ? state.activeTexture - GL_TEXTURE0 : UNKNOWN;
+
+	GLuint * cached = NULL;
+	if (unit < TRACKED_TEXTURE_UNITS && target == GL_TEXTURE_2D)
+		cached = &state.textures2D[unit];
+	else if (unit < TRACKED_TEXTURE_UNITS && target == GL_TEXTURE_CUBE_MAP)
+		cached = &state.texturesCube[unit];
+	else if (unit < TRACKED_TEXTURE_UNITS && target == GL_TEXTURE_BUFFER)
+		cached = &state.texturesBuffer[unit];
+
+	if (cached == NULL)
+	{
+		statistics.issued[GL_STATE_TEXTURE]++;
+		glBindTexture(target, texture);
+	}
+	else if (changed(GL_STATE_TEXTURE, *cached, texture))
+		glBindTexture(target, texture);
+}
+
+static GLuint * capabilityState ( GLenum capability )
+{
+	for (int i = 0; i < NUM_TRACKED_CAPABILITIES; i++)
+	{
+		if (TRACKED_CAPABILITIES[i] == capability)
+			return &state.capabilities[i];
+	}
+	return NULL;
+}
+
+void cachedEnable ( GLenum capability )
+{
+	ensureValid();
+
+	GLuint * cached = capabilityState(capability);
+	if (cached == NULL || changed(GL_STATE_FIXED_FUNCTION, *cached, GL_TRUE))
+		glEnable(capability);
+}
+
+void cachedDisable ( GLenum capability )
+{
+	ensureValid();
+
+	GLuint * cached = capabilityState(capability);
+	if (cached == NULL || changed(GL_STATE_FIXED_FUNCTION, *cached, GL_FALSE))
+		glDisable(capability);
+}
+
+void cachedBlendFunc ( GLenum source, GLenum destination )
+{
+	ensureValid();
+
+	if (state.blendSource == source && state.blendDestination == destination)
+	{
+		statistics.skipped[GL_STATE_FIXED_FUNCTION]++;
+		return;
+	}
+
+	state.blendSource = source;
+	state.blendDestination = destination;
+	statistics.issued[GL_STATE_FIXED_FUNCTION]++;
+	glBlendFunc(source, destination);
+}
+
+void cachedStencilFunc ( GLenum function, GLint reference, GLuint mask )
+{
+	ensureValid();
+
+	if (state.stencilFunction == function && state.stencilReference == reference && state.stencilMask == mask)
+	{
+		statistics.skipped[GL_STATE_FIXED_FUNCTION]++;
+		return;
+	}
+
+	state.stencilFunction = function;
+	state.stencilReference = reference;
+	state.stencilMask = mask;
+	statistics.issued[GL_STATE_FIXED_FUNCTION]++;
+	glStencilFunc(function, reference, mask);
+}
+
+void cachedStencilOp ( GLenum stencilFail, GLenum depthFail, GLenum depthPass )
+{
+	ensureValid();
+
+	if (state.stencilFail == stencilFail && state.stencilDepthFail == depthFail && state.stencilDepthPass == depthPass)
+	{
+		statistics.skipped[GL_STATE_FIXED_FUNCTION]++;
+		return;
+	}
+
+	state.stencilFail = stencilFail;
+	state.stencilDepthFail = depthFail;
+	state.stencilDepthPass = depthPass;
+	statistics.issued[GL_STATE_FIXED_FUNCTION]++;
+	glStencilOp(stencilFail, depthFail, depthPass);
+}
+
+void cachedDepthMask ( GLboolean write )
+{
+	if (changed(GL_STATE_FIXED_FUNCTION, state.depthMask, write))
+		glDepthMask(write);
+}
+
+void resetGLStateStatistics ( void )
+{
+	for (int i = 0; i < NUM_GL_STATE_KINDS; i++)
+	{
+		statistics.issued[i] = 0;
+		statistics.skipped[i] = 0;
+	}
+}
+
+const GLStateStatistics & glStateStatistics ( void )
+{
+	return statistics;
+}
+
+void printGLStateStatistics ( void )
+{
+	static const char * names[NUM_GL_STATE_KINDS] = { "program", "vao", "texture", "fixed function" };
+
+	std::cout << "GL state changes issued/skipped:";
+	for (int i = 0; i < NUM_GL_STATE_KINDS; i++)
+		std::cout << " " << names[i] << " " << statistics.issued[i] << "/" << statistics.skipped[i];
+	std::cout << std::endl;
+}
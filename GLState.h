@@ -0,0 +1,52 @@
+/**
+* \file       GLState.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Tracking of the bound GL state, redundant binds and enables are not passed to the driver.
+*
+* All per frame state changes of the renderer go through the cached*() calls. Code which binds
+* directly (resource creation, uploads) has to call invalidateGLState() afterwards.
+*/
+
+#pragma once
+#include "pgr.h"
+
+// kinds of state the statistics are kept for
+enum GLStateKind
+{
+	GL_STATE_PROGRAM = 0,
+	GL_STATE_VERTEX_ARRAY,
+	GL_STATE_TEXTURE,
+	GL_STATE_FIXED_FUNCTION,    // enables, blend function, stencil and depth setup
+	NUM_GL_STATE_KINDS
+};
+
+typedef struct GLStateStatistics
+{
+	unsigned int  issued[NUM_GL_STATE_KINDS];     // changes passed to GL
+	unsigned int  skipped[NUM_GL_STATE_KINDS];    // redundant ones
+
+} GLStateStatistics;
+
+void cachedUseProgram ( GLuint program );
+void cachedBindVertexArray ( GLuint vertexArrayObject );
+/// \param unit GL_TEXTURE0 + i
+void cachedActiveTexture ( GLenum unit );
+/// Bind to the active unit, 2D, cube map and buffer targets of the first 16 units are tracked, other targets are always bound.
+void cachedBindTexture ( GLenum target, GLuint texture );
+
+/// GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST and GL_CULL_FACE are tracked, other capabilities are always set.
+void cachedEnable ( GLenum capability );
+void cachedDisable ( GLenum capability );
+void cachedBlendFunc ( GLenum source, GLenum destination );
+void cachedStencilFunc ( GLenum function, GLint reference, GLuint mask );
+void cachedStencilOp ( GLenum stencilFail, GLenum depthFail, GLenum depthPass );
+void cachedDepthMask ( GLboolean write );
+
+/// Forget everything, the next change of each state is issued. Call after binding outside of this layer.
+void invalidateGLState ( void );
+
+/// Zero the counters, called at the start of each frame.
+void resetGLStateStatistics ( void );
+const GLStateStatistics & glStateStatistics ( void );
+void printGLStateStatistics ( void );
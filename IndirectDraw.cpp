@@ -0,0 +1,383 @@
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "IndirectDraw.h"
+#include "MeshData.h"
+#include "StaticBatch.h"
+#include "GLCaps.h"
+#include "GLState.h"
+
+// part of a pooled mesh while its command is created
+typedef struct PoolPart
+{
+	const SubMesh *  subMesh;
+	unsigned int     object;
+	unsigned int     part;          // index in partCommands
+	unsigned int     firstIndex;    // in the pool
+	int              baseVertex;
+
+} PoolPart;
+
+//============================================================================================================================
+
+// texture, then object, so that one multi draw covers all parts with the texture
+static bool poolPartLess ( const PoolPart &a, const PoolPart &b )
+{
+	if (a.subMesh->texture != b.subMesh->texture)
+		return a.subMesh->texture < b.subMesh->texture;
+	return a.part < b.part;
+}
+
+bool indirectDrawSupported ( void )
+{
+	static int supported = -1;
+
+	if (supported < 0)
+	{
+		supported = glVersionAtLeast(4, 3) || (glHasExtension("GL_ARB_multi_draw_indirect") &&
+			glHasExtension("GL_ARB_shader_storage_buffer_object") && glHasExtension("GL_ARB_base_instance"));
+	}
+
+	return supported == 1;
+}
+
+IndirectRenderer::IndirectRenderer ( )
+	: shader(NULL), vertexBuffer(0), elementBuffer(0), drawIndexBuffer(0), vertexArrayObject(0), commandBuffer(0), objectBuffer(0), drawBuffer(0),
+	indexType(GL_UNSIGNED_INT), view(UINT_MAX), numPatchedCommands(0), numMultiDraws(0)
+{
+}
+
+IndirectRenderer::~IndirectRenderer ( )
+{
+	release();
+}
+
+void IndirectRenderer::release ( void )
+{
+	glDeleteVertexArrays(1, &vertexArrayObject);
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &elementBuffer);
+	glDeleteBuffers(1, &drawIndexBuffer);
+	glDeleteBuffers(1, &commandBuffer);
+	glDeleteBuffers(1, &objectBuffer);
+	glDeleteBuffers(1, &drawBuffer);
+
+	vertexArrayObject = 0;
+	vertexBuffer = elementBuffer = drawIndexBuffer = commandBuffer = objectBuffer = drawBuffer = 0;
+
+	objectIndices.clear();
+	objects.clear();
+	partCommands.clear();
+	ranges.clear();
+	commands.clear();
+	visible.clear();
+	stencilIds.clear();
+}
+
+bool IndirectRenderer::build ( const std::vector<const MeshGeometry *> &geometries, const IndirectShaderProgram &program )
+{
+	release();
+	shader = &program;
+
+	std::vector<float> poolVertices;
+	std::vector<unsigned int> poolIndices;
+	std::vector<PoolPart> parts;
+	unsigned int maxVertices = 0;
+
+	std::vector<float> meshVertices;
+	std::vector<unsigned int> meshIndices;
+
+	for (size_t i = 0; i < geometries.size(); i++)
+	{
+		const MeshGeometry * geometry = geometries[i];
+
+		// model which failed to load, or listed twice
+		if (geometry == NULL || geometry->subMeshes.empty() || pooled(geometry))
+			continue;
+
+		readBackGeometry(geometry, meshVertices, meshIndices);
+
+		const unsigned int firstVertex = (unsigned int)(poolVertices.size() / meshFloatsPerVertex);
+		const unsigned int firstIndex = (unsigned int)poolIndices.size();
+		maxVertices = std::max(maxVertices, (unsigned int)(meshVertices.size() / meshFloatsPerVertex));
+
+		poolVertices.insert(poolVertices.end(), meshVertices.begin(), meshVertices.end());
+		poolIndices.insert(poolIndices.end(), meshIndices.begin(), meshIndices.end());
+
+		PoolObject object;
+		object.geometry = geometry;
+		object.firstPart = (unsigned int)partCommands.size();
+		object.used = false;
+		object.uploaded = false;
+		object.transform.modelMatrix = glm::mat4(1.0f);
+		object.transform.normalMatrix = glm::mat4(1.0f);
+
+		objectIndices[geometry] = (unsigned int)objects.size();
+
+		for (size_t p = 0; p < geometry->subMeshes.size(); p++)
+		{
+			PoolPart part;
+			part.subMesh = &geometry->subMeshes[p];
+			part.object = (unsigned int)objects.size();
+			part.part = (unsigned int)partCommands.size();
+			part.firstIndex = firstIndex + part.subMesh->firstIndex;
+			part.baseVertex = (int)firstVertex;
+			parts.push_back(part);
+
+			partCommands.push_back(0);
+		}
+
+		objects.push_back(object);
+	}
+
+	if (parts.empty())
+		return false;
+
+	std::sort(parts.begin(), parts.end(), poolPartLess);
+
+	commands.resize(parts.size());
+	std::vector<IndirectDrawData> draws(parts.size());
+	std::vector<GLuint> drawIndices(parts.size());
+
+	for (size_t c = 0; c < parts.size(); c++)
+	{
+		const PoolPart &part = parts[c];
+		const SubMesh &subMesh = *part.subMesh;
+
+		partCommands[part.part] = (unsigned int)c;
+
+		// hidden until the part is drawn
+		commands[c].count = subMesh.numIndices;
+		commands[c].instanceCount = 0;
+		commands[c].firstIndex = part.firstIndex;
+		commands[c].baseVertex = part.baseVertex;
+		commands[c].baseInstance = (GLuint)c;
+
+		draws[c].ambient = subMesh.ambient;
+		draws[c].shininess = subMesh.shininess;
+		draws[c].diffuse = subMesh.diffuse;
+		draws[c].useTexture = (subMesh.texture != 0);
+		draws[c].specular = subMesh.specular;
+		draws[c].object = part.object;
+
+		drawIndices[c] = (GLuint)c;
+
+		if (ranges.empty() || ranges.back().texture != subMesh.texture)
+		{
+			CommandRange range;
+			range.texture = subMesh.texture;
+			range.first = (unsigned int)c;
+			range.count = 0;
+			ranges.push_back(range);
+		}
+		ranges.back().count++;
+	}
+
+	visible.assign(commands.size(), 0);
+	stencilIds.assign(commands.size(), 0);
+
+	// one vertex format for the whole pool
+	std::vector<unsigned char> packedVertices;
+	VertexFormat format = packVertices(poolVertices, packedVertices);
+	if (!packedNormalsSupported())
+	{
+		packedVertices.resize(poolVertices.size() * sizeof(float));
+		memcpy(&packedVertices[0], &poolVertices[0], packedVertices.size());
+		format = VERTEX_FORMAT_FLOAT;
+	}
+
+	// indices are relative to the base vertex of their mesh, so the largest mesh decides their size
+	std::vector<unsigned char> packedIndices;
+	indexType = indexSizeType(packIndices(poolIndices, maxVertices, packedIndices));
+
+	glGenVertexArrays(1, &vertexArrayObject);
+	glBindVertexArray(vertexArrayObject);
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, packedVertices.size(), &packedVertices[0], GL_STATIC_DRAW);
+	setupVertexAttributes(vertexFormatLayout(format), shader->posLocation, shader->normalLocation, shader->texCoordLocation);
+
+	// one value per instance, the base instance of a command selects its own
+	glGenBuffers(1, &drawIndexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, drawIndices.size() * sizeof(GLuint), &drawIndices[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(shader->drawIndexLocation);
+	glVertexAttribIPointer(shader->drawIndexLocation, 1, GL_UNSIGNED_INT, 0, 0);
+	glVertexAttribDivisor(shader->drawIndexLocation, 1);
+
+	glGenBuffers(1, &elementBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.size(), &packedIndices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &commandBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(IndirectCommand), &commands[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glGenBuffers(1, &objectBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(IndirectObjectData), NULL, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &drawBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(IndirectDrawData), &draws[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	CHECK_GL_ERROR();
+
+	// the vao was bound directly
+	invalidateGLState();
+
+	std::cout << "Indirect drawing: " << objects.size() << " meshes, " << poolVertices.size() / meshFloatsPerVertex << " vertices, "
+		<< commands.size() << " commands with " << ranges.size() << " textures" << std::endl;
+
+	return true;
+}
+
+void IndirectRenderer::beginFrame ( void )
+{
+	std::fill(visible.begin(), visible.end(), 0);
+
+	for (size_t i = 0; i < objects.size(); i++)
+		objects[i].used = false;
+
+	view = UINT_MAX;
+}
+
+bool IndirectRenderer::addItem ( const DrawItem &item, const RenderTransform &transform )
+{
+	if (item.instances != NULL || item.subMesh == NULL)
+		return false;
+
+	std::map<const MeshGeometry *, unsigned int>::const_iterator found = objectIndices.find(item.geometry);
+	if (found == objectIndices.end())
+		return false;
+
+	// one projection for all commands
+	if (view != UINT_MAX && item.view != view)
+		return false;
+
+	PoolObject &object = objects[found->second];
+
+	// the parts of one object share the transform
+	const bool moved = memcmp(&object.transform.modelMatrix, &transform.modelMatrix, sizeof(glm::mat4)) != 0;
+	if (object.used && moved)
+		return false;
+
+	if (moved)
+	{
+		object.transform.modelMatrix = transform.modelMatrix;
+		object.transform.normalMatrix = transform.normalMatrix;
+		object.uploaded = false;
+	}
+	object.used = true;
+	view = item.view;
+
+	const unsigned int command = partCommands[object.firstPart + (unsigned int)(item.subMesh - &item.geometry->subMeshes[0])];
+	visible[command] = 1;
+	stencilIds[command] = item.stencilId;
+
+	return true;
+}
+
+void IndirectRenderer::draw ( const RenderQueue &queue, const IndirectShaderProgram &untextured, const IndirectShaderProgram &textured )
+{
+	numPatchedCommands = 0;
+	numMultiDraws = 0;
+
+	if (view == UINT_MAX || shader == NULL || shader->program == 0)
+		return;
+
+	// instance counts of the parts which appeared or disappeared, uploaded as one range
+	unsigned int firstChanged = UINT_MAX;
+	unsigned int lastChanged = 0;
+
+	for (unsigned int c = 0; c < commands.size(); c++)
+	{
+		const GLuint instanceCount = visible[c];
+		if (commands[c].instanceCount != instanceCount)
+		{
+			commands[c].instanceCount = instanceCount;
+			firstChanged = std::min(firstChanged, c);
+			lastChanged = c;
+			numPatchedCommands++;
+		}
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if (firstChanged != UINT_MAX)
+	{
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, firstChanged * sizeof(IndirectCommand), (lastChanged - firstChanged + 1) * sizeof(IndirectCommand),
+			&commands[firstChanged]);
+	}
+
+	// transforms of the objects which moved
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].used && !objects[i].uploaded)
+		{
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, i * sizeof(IndirectObjectData), sizeof(IndirectObjectData), &objects[i].transform);
+			objects[i].uploaded = true;
+		}
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_OBJECT_BINDING, objectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_DRAW_BINDING, drawBuffer);
+
+	cachedBindVertexArray(vertexArrayObject);
+	cachedActiveTexture(GL_TEXTURE0);
+
+	// the ranges are sorted by texture, so the untextured ones come first and the program changes once at most
+	const IndirectShaderProgram * program = NULL;
+
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		const IndirectShaderProgram * rangeProgram = (ranges[r].texture != 0) ? &textured : &untextured;
+		if (rangeProgram != program)
+		{
+			program = rangeProgram;
+
+			cachedUseProgram(program->program);
+			glUniformMatrix4fv(program->PVmatrixLocation, 1, GL_FALSE, glm::value_ptr(queue.view(view).PVmatrix));
+			glUniform1i(program->texSamplerLocation, 0);
+			setLightSamplers(program->lightSamplers);
+		}
+
+		const unsigned int end = ranges[r].first + ranges[r].count;
+		unsigned int command = ranges[r].first;
+
+		// runs of commands with one stencil ID, the hidden ones can join any run
+		while (command < end)
+		{
+			while (command < end && !visible[command])
+				command++;
+			if (command == end)
+				break;
+
+			const unsigned char stencilId = stencilIds[command];
+			unsigned int runEnd = command + 1;
+			while (runEnd < end && (!visible[runEnd] || stencilIds[runEnd] == stencilId))
+				runEnd++;
+
+			if (ranges[r].texture != 0)
+				cachedBindTexture(GL_TEXTURE_2D, ranges[r].texture);
+			cachedStencilFunc(GL_ALWAYS, stencilId, 255);
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(command * sizeof(IndirectCommand)), runEnd - command, 0);
+			numMultiDraws++;
+
+			command = runEnd;
+		}
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	CHECK_GL_ERROR();
+}
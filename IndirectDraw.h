@@ -0,0 +1,138 @@
+/**
+* \file       IndirectDraw.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Static meshes drawn from one shared vertex and index pool with glMultiDrawElementsIndirect().
+*
+* Every part of every level of detail of the pooled meshes gets one command in the indirect buffer when the pool is
+* built. Parts which are not drawn in a frame keep their command with zero instances, so a frame only patches the
+* commands whose visibility changed and the transforms of the objects which moved. The transforms and the materials
+* are read by indirect.vs from shader storage buffers, the draws are then one multi draw per texture and stencil ID.
+*/
+
+#pragma once
+#include <vector>
+#include <map>
+
+#include "render_stuff.h"
+
+// shader storage binding points of the buffers in indirect.vs
+enum IndirectStorageBinding
+{
+	INDIRECT_OBJECT_BINDING = 0,
+	INDIRECT_DRAW_BINDING = 1
+};
+
+// mirrors of the std430 structs in indirect.vs
+
+typedef struct IndirectObjectData
+{
+	glm::mat4  modelMatrix;             // 0
+	glm::mat4  normalMatrix;            // 64
+
+} IndirectObjectData;
+
+typedef struct IndirectDrawData
+{
+	glm::vec3  ambient;                 // 0
+	float      shininess;               // 12
+	glm::vec3  diffuse;                 // 16
+	GLint      useTexture;              // 28
+	glm::vec3  specular;                // 32
+	GLuint     object;                  // 44
+
+} IndirectDrawData;
+
+// layout read by glMultiDrawElementsIndirect()
+typedef struct IndirectCommand
+{
+	GLuint  count;
+	GLuint  instanceCount;
+	GLuint  firstIndex;
+	GLint   baseVertex;
+	GLuint  baseInstance;               // index of the command, advances the drawIndex attribute
+
+} IndirectCommand;
+
+/// GL 4.3, or multi draw indirect, shader storage buffers and base instance as extensions with GLSL 4.30.
+bool indirectDrawSupported ( void );
+
+class IndirectRenderer
+{
+public:
+	IndirectRenderer ( );
+	~IndirectRenderer ( );
+
+	/** Copy the meshes into the pool and create a command for each of their parts, replaces the previous pool.
+	* Each geometry is one object with one transform per frame.
+	* \return false if there is nothing to draw
+	*/
+	bool build ( const std::vector<const MeshGeometry *> &geometries, const IndirectShaderProgram &shader );
+
+	bool pooled ( const MeshGeometry * geometry ) const { return objectIndices.count(geometry) != 0; }
+
+	/// Forget the parts of the last frame.
+	void beginFrame ( void );
+
+	/** Draw the part of the item in the next draw().
+	* \return false if its geometry is not pooled, instanced or drawn with another transform in this frame, the caller draws the item then
+	*/
+	bool addItem ( const DrawItem &item, const RenderTransform &transform );
+
+	/** Patch the changed commands and objects and draw the parts added since beginFrame(), in the opaque pass.
+	* \param untextured, textured programs of the parts without and with a texture, sharing the attributes of the one of build()
+	*/
+	void draw ( const RenderQueue &queue, const IndirectShaderProgram &untextured, const IndirectShaderProgram &textured );
+
+	unsigned int  patchedCommands ( void ) const { return numPatchedCommands; }
+	unsigned int  multiDraws ( void ) const { return numMultiDraws; }
+
+private:
+	IndirectRenderer ( const IndirectRenderer & );
+	IndirectRenderer & operator= ( const IndirectRenderer & );
+
+	void release ( void );
+
+	typedef struct PoolObject
+	{
+		const MeshGeometry *  geometry;
+		unsigned int          firstPart;        // commands of its parts are in partCommands from here, in the order of the submeshes
+		bool                  used;             // drawn in this frame
+		bool                  uploaded;         // the buffer holds the transform below
+		IndirectObjectData    transform;
+
+	} PoolObject;
+
+	// part of the indirect buffer drawn with one texture
+	typedef struct CommandRange
+	{
+		GLuint        texture;
+		unsigned int  first;
+		unsigned int  count;
+
+	} CommandRange;
+
+	const IndirectShaderProgram *  shader;
+
+	GLuint  vertexBuffer;
+	GLuint  elementBuffer;
+	GLuint  drawIndexBuffer;
+	GLuint  vertexArrayObject;
+	GLuint  commandBuffer;
+	GLuint  objectBuffer;
+	GLuint  drawBuffer;
+	GLenum  indexType;
+
+	std::map<const MeshGeometry *, unsigned int>  objectIndices;
+	std::vector<PoolObject>      objects;
+	std::vector<unsigned int>    partCommands;      // command of each part of each object, the commands are sorted by texture
+	std::vector<CommandRange>    ranges;
+
+	std::vector<IndirectCommand> commands;          // as uploaded
+	std::vector<unsigned char>   visible;           // drawn in this frame
+	std::vector<unsigned char>   stencilIds;        // of the items drawn in this frame
+
+	unsigned int  view;                             // of the items of this frame
+	unsigned int  numPatchedCommands;
+	unsigned int  numMultiDraws;
+};
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <algorithm>
+
+#include "InstanceBuffer.h"
+#include "GLState.h"
+
+//============================================================================================================================
+
+unsigned int maxInstanceCount ( void )
+{
+	static GLint maxTexels = 0;
+
+	if (maxTexels == 0)
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+
+	return (unsigned int)maxTexels / INSTANCE_TEXELS;
+}
+
+// box around the origins of the instances, every mesh vertex is at most maxScale times its distance from the origin away from them
+static void instanceBounds ( InstanceBuffer * instanceBuffer, const std::vector<InstanceData> &instances, unsigned int count )
+{
+	instanceBuffer->translationBounds.min = glm::vec3(0.0f);
+	instanceBuffer->translationBounds.max = glm::vec3(0.0f);
+	instanceBuffer->maxScale = 0.0f;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const glm::mat4 &matrix = instances[i].modelMatrix;
+		const glm::vec3 position = glm::vec3(matrix[3]);
+
+		if (i == 0)
+		{
+			instanceBuffer->translationBounds.min = position;
+			instanceBuffer->translationBounds.max = position;
+		}
+		instanceBuffer->translationBounds.min = glm::min(instanceBuffer->translationBounds.min, position);
+		instanceBuffer->translationBounds.max = glm::max(instanceBuffer->translationBounds.max, position);
+
+		const float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+		instanceBuffer->maxScale = std::max(instanceBuffer->maxScale, scale);
+	}
+}
+
+InstanceBuffer * createInstanceBuffer ( const std::vector<InstanceData> &instances, GLenum usage )
+{
+	InstanceBuffer * instanceBuffer = new InstanceBuffer();
+	instanceBuffer->usage = usage;
+
+	// streamed instances need the view of a range, otherwise they are orphaned like the dynamic ones
+	if (usage == GL_STREAM_DRAW && streamedTextureBuffersSupported())
+	{
+		GLint alignment = 0;
+		glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		instanceBuffer->stream = new StreamBuffer(GL_TEXTURE_BUFFER, std::max<size_t>(instances.size(), 1) * sizeof(InstanceData), alignment);
+	}
+	else
+		glGenBuffers(1, &instanceBuffer->buffer);
+
+	glGenTextures(1, &instanceBuffer->texture);
+
+	updateInstanceBuffer(instanceBuffer, instances);
+
+	return instanceBuffer;
+}
+
+void updateInstanceBuffer ( InstanceBuffer * instanceBuffer, const std::vector<InstanceData> &instances )
+{
+	unsigned int count = (unsigned int)instances.size();
+
+	if (count > maxInstanceCount())
+	{
+		std::cerr << "Instance buffer: " << count << " instances requested, only " << maxInstanceCount() << " fit the texture buffer" << std::endl;
+		count = maxInstanceCount();
+	}
+
+	if (instanceBuffer->stream != NULL)
+	{
+		// an empty range is not allowed, empty buffers are not drawn anyway
+		if (count > 0)
+		{
+			const GLsizeiptr size = count * sizeof(InstanceData);
+			const GLintptr offset = instanceBuffer->stream->write(&instances[0], size);
+
+			// every frame, so through the state cache
+			cachedBindTexture(GL_TEXTURE_BUFFER, instanceBuffer->texture);
+			glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBuffer->stream->buffer(), offset, size);
+		}
+
+		instanceBuffer->capacity = std::max(instanceBuffer->capacity, count);
+		instanceBuffer->numInstances = count;
+		instanceBounds(instanceBuffer, instances, count);
+
+		CHECK_GL_ERROR();
+		return;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, instanceBuffer->buffer);
+
+	if (count > instanceBuffer->capacity || instanceBuffer->capacity == 0)
+	{
+		instanceBuffer->capacity = std::max(count, 1u);
+		glBufferData(GL_TEXTURE_BUFFER, instanceBuffer->capacity * sizeof(InstanceData), NULL, instanceBuffer->usage);
+
+		// the view has to be attached again to the new storage
+		glBindTexture(GL_TEXTURE_BUFFER, instanceBuffer->texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBuffer->buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	else
+	{
+		// orphan the old contents, the draws still reading them keep them
+		glBufferData(GL_TEXTURE_BUFFER, instanceBuffer->capacity * sizeof(InstanceData), NULL, instanceBuffer->usage);
+	}
+
+	if (count > 0)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, count * sizeof(InstanceData), &instances[0]);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	instanceBuffer->numInstances = count;
+	instanceBounds(instanceBuffer, instances, count);
+
+	CHECK_GL_ERROR();
+}
+
+void deleteInstanceBuffer ( InstanceBuffer * instanceBuffer )
+{
+	if (instanceBuffer == NULL)
+		return;
+
+	glDeleteTextures(1, &instanceBuffer->texture);
+	glDeleteBuffers(1, &instanceBuffer->buffer);
+	delete instanceBuffer->stream;
+
+	delete instanceBuffer;
+}
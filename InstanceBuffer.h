@@ -0,0 +1,57 @@
+/**
+* \file       InstanceBuffer.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Per-instance transforms and tints of meshes drawn with glDrawElementsInstanced().
+*
+* The instances are stored in a texture buffer which the lit vertex shader reads by gl_InstanceID, vertex attribute
+* divisors would need GL 3.3. Any MeshGeometry can be drawn with one by submitting it with submitInstances().
+*/
+
+#pragma once
+#include <vector>
+
+#include "pgr.h"
+#include "Culling.h"
+#include "StreamBuffer.h"
+
+// texture unit of the instance buffer texture, unit 0 holds the material texture
+const GLint INSTANCE_TEXTURE_UNIT = 1;
+
+// RGBA32F texels per instance in the texture buffer, the shader reads them in this order
+const int INSTANCE_TEXELS = 5;
+
+typedef struct InstanceData
+{
+	glm::mat4  modelMatrix;   // rotation, uniform scale and translation, the normals are transformed by it too
+	glm::vec4  tint;          // multiplies the ambient and diffuse material colors, alpha is not used
+
+} InstanceData;
+
+typedef struct InstanceBuffer
+{
+	GLuint          buffer;         // texture buffer object with the InstanceData, 0 if streamed
+	GLuint          texture;        // GL_TEXTURE_BUFFER view of the buffer
+	StreamBuffer *  stream;         // instances written every frame, the view shows the range of the last update
+	unsigned int    numInstances;
+	unsigned int    capacity;       // instances the buffer has room for
+	GLenum          usage;
+
+	BoundingBox     translationBounds;  // of the origins of the instances, model space of the group
+	float           maxScale;           // largest scale of an instance, with the mesh size it extends the bounds
+
+} InstanceBuffer;
+
+/// Largest number of instances one buffer can hold, given by GL_MAX_TEXTURE_BUFFER_SIZE.
+unsigned int maxInstanceCount ( void );
+
+/** Create buffer with the instances, the ones over maxInstanceCount() are dropped.
+* \param usage GL_STATIC_DRAW for instances placed once, GL_DYNAMIC_DRAW if updateInstanceBuffer() is called often,
+* GL_STREAM_DRAW if it is called every frame
+*/
+InstanceBuffer * createInstanceBuffer ( const std::vector<InstanceData> &instances, GLenum usage = GL_STATIC_DRAW );
+
+/// Replace the instances, the buffer grows if needed.
+void updateInstanceBuffer ( InstanceBuffer * instanceBuffer, const std::vector<InstanceData> &instances );
+
+void deleteInstanceBuffer ( InstanceBuffer * instanceBuffer );
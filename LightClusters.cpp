@@ -0,0 +1,241 @@
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "LightClusters.h"
+#include "GLState.h"
+
+// fraction of the light's strongest color at which it is cut off
+static const float LIGHT_CUTOFF = 1.0f / 32.0f;
+
+// lights reaching in front of the near plane cover this much of the screen
+static const int FULL_SCREEN_BOUNDS[4] = { 0, CLUSTER_X - 1, 0, CLUSTER_Y - 1 };
+
+//============================================================================================================================
+
+void getLightSamplerLocations ( GLuint program, LightSamplerLocations &locations )
+{
+	locations.lightSamplerLocation = glGetUniformLocation(program, "lightSampler");
+	locations.clusterSamplerLocation = glGetUniformLocation(program, "clusterSampler");
+	locations.lightIndexSamplerLocation = glGetUniformLocation(program, "lightIndexSampler");
+}
+
+void setLightSamplers ( const LightSamplerLocations &locations )
+{
+	glUniform1i(locations.lightSamplerLocation, LIGHT_TEXTURE_UNIT);
+	glUniform1i(locations.clusterSamplerLocation, CLUSTER_TEXTURE_UNIT);
+	glUniform1i(locations.lightIndexSamplerLocation, LIGHT_INDEX_TEXTURE_UNIT);
+}
+
+float pointLightRange ( const PointLight &light )
+{
+	const float intensity = std::max(std::max(light.diffuse.r, std::max(light.diffuse.g, light.diffuse.b)), std::max(light.ambient, light.specular));
+	const glm::vec3 &a = light.attenuation;
+
+	// a.x + a.y * d + a.z * d^2 = intensity / cutoff
+	const float target = intensity / LIGHT_CUTOFF - a.x;
+
+	if (target <= 0.0f)
+		return 0.0f;
+	if (a.z > 0.0f)
+		return (-a.y + std::sqrt(a.y * a.y + 4.0f * a.z * target)) / (2.0f * a.z);
+	if (a.y > 0.0f)
+		return target / a.y;
+
+	// not attenuated, reaches everywhere
+	return FLT_MAX;
+}
+
+// slice of the view space depth, the slices grow exponentially from the near plane
+static int depthSlice ( float depth, const glm::vec4 &params )
+{
+	const int slice = (int)std::floor(std::log(depth) * params.z + params.w);
+	return std::min(std::max(slice, 0), CLUSTER_Z - 1);
+}
+
+static int tileOf ( float ndc, int tiles )
+{
+	const int tile = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+	return std::min(std::max(tile, 0), tiles - 1);
+}
+
+LightClusters::LightClusters ( ) :
+	params(0.0f), numLights(0), maxClusterLights(0)
+{
+	createBuffer(lightBuffer, GL_RGBA32F, LIGHT_TEXTURE_UNIT, 64 * LIGHT_TEXELS * sizeof(glm::vec4));
+	createBuffer(clusterBuffer, GL_RG32UI, CLUSTER_TEXTURE_UNIT, CLUSTER_X * CLUSTER_Y * CLUSTER_Z * 2 * sizeof(GLuint));
+	createBuffer(indexBuffer, GL_R32UI, LIGHT_INDEX_TEXTURE_UNIT, 16 * 1024 * sizeof(GLuint));
+}
+
+LightClusters::~LightClusters ( )
+{
+	deleteBuffer(lightBuffer);
+	deleteBuffer(clusterBuffer);
+	deleteBuffer(indexBuffer);
+}
+
+void LightClusters::createBuffer ( LightBuffer &target, GLenum format, GLint unit, GLsizeiptr frameSize )
+{
+	target.format = format;
+	target.unit = unit;
+	target.stream = NULL;
+	target.buffer = 0;
+
+	if (streamedTextureBuffersSupported())
+	{
+		GLint alignment = 0;
+		glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		target.stream = new StreamBuffer(GL_TEXTURE_BUFFER, frameSize, alignment);
+	}
+	else
+		glGenBuffers(1, &target.buffer);
+
+	glGenTextures(1, &target.texture);
+}
+
+void LightClusters::deleteBuffer ( LightBuffer &target )
+{
+	delete target.stream;
+	glDeleteBuffers(1, &target.buffer);
+	glDeleteTextures(1, &target.texture);
+
+	target.stream = NULL;
+	target.buffer = 0;
+	target.texture = 0;
+}
+
+void LightClusters::upload ( LightBuffer &target, const void * data, GLsizeiptr size )
+{
+	cachedActiveTexture(GL_TEXTURE0 + target.unit);
+	cachedBindTexture(GL_TEXTURE_BUFFER, target.texture);
+
+	if (target.stream != NULL)
+	{
+		const GLintptr offset = target.stream->write(data, size);
+		glTexBufferRange(GL_TEXTURE_BUFFER, target.format, target.stream->buffer(), offset, size);
+	}
+	else
+	{
+		// orphaned, the draws of the last frame keep the old contents
+		glBindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glTexBuffer(GL_TEXTURE_BUFFER, target.format, target.buffer);
+	}
+
+	cachedActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::update ( const std::vector<PointLight> &lights, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix,
+	float nearPlane, float farPlane, int width, int height )
+{
+	params.x = (float)CLUSTER_X / std::max(width, 1);
+	params.y = (float)CLUSTER_Y / std::max(height, 1);
+	params.z = CLUSTER_Z / std::log(farPlane / nearPlane);
+	params.w = -std::log(nearPlane) * params.z;
+
+	lightTexels.clear();
+	lightBounds.clear();
+
+	// lights in view space with their cluster bounds, the ones out of view are dropped
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		const PointLight &light = lights[i];
+		const glm::vec3 position = glm::vec3(viewMatrix * glm::vec4(light.position, 1.0f));
+		const float range = pointLightRange(light);
+		const float depth = -position.z;
+
+		if (range <= 0.0f || depth + range < nearPlane || depth - range > farPlane)
+			continue;
+
+		int bounds[6];
+		bounds[4] = depthSlice(std::max(depth - range, nearPlane), params);
+		bounds[5] = depthSlice(std::min(depth + range, farPlane), params);
+
+		if (depth - range <= nearPlane)
+			std::copy(FULL_SCREEN_BOUNDS, FULL_SCREEN_BOUNDS + 4, bounds);
+		else
+		{
+			// projected corners of the box around the sphere, all of them in front of the near plane
+			glm::vec2 ndcMin(FLT_MAX);
+			glm::vec2 ndcMax(-FLT_MAX);
+
+			for (int corner = 0; corner < 8; corner++)
+			{
+				const glm::vec3 offset((corner & 1) ? range : -range, (corner & 2) ? range : -range, (corner & 4) ? range : -range);
+				const glm::vec4 clip = projectionMatrix * glm::vec4(position + offset, 1.0f);
+				const glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+
+			if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+				continue;
+
+			bounds[0] = tileOf(ndcMin.x, CLUSTER_X);
+			bounds[1] = tileOf(ndcMax.x, CLUSTER_X);
+			bounds[2] = tileOf(ndcMin.y, CLUSTER_Y);
+			bounds[3] = tileOf(ndcMax.y, CLUSTER_Y);
+		}
+
+		lightBounds.insert(lightBounds.end(), bounds, bounds + 6);
+
+		lightTexels.push_back(glm::vec4(position, std::min(range, farPlane)));
+		lightTexels.push_back(glm::vec4(light.diffuse, light.specular));
+		lightTexels.push_back(glm::vec4(light.attenuation, light.ambient));
+	}
+
+	numLights = (unsigned int)lightBounds.size() / 6;
+
+	// count the lights of every cluster, then fill the lists at the prefix sums of the counts
+	const size_t numClusters = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+	counts.assign(numClusters, 0);
+
+	for (unsigned int light = 0; light < numLights; light++)
+	{
+		const int * bounds = &lightBounds[light * 6];
+		for (int z = bounds[4]; z <= bounds[5]; z++)
+			for (int y = bounds[2]; y <= bounds[3]; y++)
+				for (int x = bounds[0]; x <= bounds[1]; x++)
+					counts[(z * CLUSTER_Y + y) * CLUSTER_X + x]++;
+	}
+
+	clusters.resize(numClusters * 2);
+	GLuint offset = 0;
+	maxClusterLights = 0;
+
+	for (size_t cluster = 0; cluster < numClusters; cluster++)
+	{
+		clusters[cluster * 2] = offset;
+		clusters[cluster * 2 + 1] = 0;
+		offset += counts[cluster];
+		maxClusterLights = std::max(maxClusterLights, (unsigned int)counts[cluster]);
+	}
+
+	indices.resize(offset);
+
+	for (unsigned int light = 0; light < numLights; light++)
+	{
+		const int * bounds = &lightBounds[light * 6];
+		for (int z = bounds[4]; z <= bounds[5]; z++)
+			for (int y = bounds[2]; y <= bounds[3]; y++)
+				for (int x = bounds[0]; x <= bounds[1]; x++)
+				{
+					const size_t cluster = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+					indices[clusters[cluster * 2] + clusters[cluster * 2 + 1]++] = light;
+				}
+	}
+
+	// empty texture buffers are not allowed
+	if (lightTexels.empty())
+		lightTexels.resize(LIGHT_TEXELS, glm::vec4(0.0f));
+
+	const GLuint noIndex = 0;
+
+	upload(lightBuffer, &lightTexels[0], lightTexels.size() * sizeof(glm::vec4));
+	upload(clusterBuffer, &clusters[0], clusters.size() * sizeof(GLuint));
+	upload(indexBuffer, indices.empty() ? &noIndex : &indices[0], std::max<size_t>(indices.size(), 1) * sizeof(GLuint));
+
+	CHECK_GL_ERROR();
+}
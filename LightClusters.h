@@ -0,0 +1,112 @@
+/**
+* \file       LightClusters.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Point lights of the scene binned into a grid of view space clusters for perFrag.fs.
+*
+* The view is split into CLUSTER_X x CLUSTER_Y screen tiles and CLUSTER_Z depth slices growing exponentially with the
+* distance. Every frame the CPU puts each light into the clusters its range touches and uploads three texture buffers:
+* the lights in view space, the offset and count of each cluster's lights and the light indices of all clusters.
+* A fragment then shades only the lights listed for its cluster.
+*/
+
+#pragma once
+#include <vector>
+
+#include "pgr.h"
+#include "StreamBuffer.h"
+
+// size of the cluster grid, the same constants are in lighting.glsl
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 8;
+const int CLUSTER_Z = 24;
+
+// RGBA32F texels per light in the light buffer, the shader reads them in this order
+const int LIGHT_TEXELS = 3;
+
+// texture units of the light buffers, 0 holds the material texture and 1 the instances
+const GLint LIGHT_TEXTURE_UNIT = 2;
+const GLint CLUSTER_TEXTURE_UNIT = 3;
+const GLint LIGHT_INDEX_TEXTURE_UNIT = 4;
+
+typedef struct PointLight
+{
+	glm::vec3  position;          // world space
+	glm::vec3  diffuse;
+	float      ambient;           // gray ambient and specular intensity
+	float      specular;
+	glm::vec3  attenuation;       // constant, linear and quadratic
+
+} PointLight;
+
+typedef struct LightSamplerLocations
+{
+	GLint lightSamplerLocation;
+	GLint clusterSamplerLocation;
+	GLint lightIndexSamplerLocation;
+
+} LightSamplerLocations;
+
+void getLightSamplerLocations ( GLuint program, LightSamplerLocations &locations );
+
+/// Point the samplers of the current program at the light buffer units, whenever the program is switched to.
+void setLightSamplers ( const LightSamplerLocations &locations );
+
+/// Distance at which the light falls below the visible threshold, it is cut off there by the shader.
+float pointLightRange ( const PointLight &light );
+
+class LightClusters
+{
+public:
+	LightClusters ( );
+	~LightClusters ( );
+
+	/** Bin the lights for the view and upload the cluster buffers, once per frame before the lit items are drawn.
+	* \param width, height of the viewport in pixels
+	* \param nearPlane, farPlane of the perspective projection
+	*/
+	void update ( const std::vector<PointLight> &lights, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix,
+		float nearPlane, float farPlane, int width, int height );
+
+	/// Tile size and depth slicing for FrameBlock::clusterParams, fragment coordinates times xy give the tile, log(-z) * z + w the slice.
+	const glm::vec4 & clusterParams ( void ) const { return params; }
+
+	unsigned int  lightCount ( void ) const { return numLights; }
+	unsigned int  clusterEntries ( void ) const { return (unsigned int)indices.size(); }
+	unsigned int  busiestCluster ( void ) const { return maxClusterLights; }
+
+private:
+	LightClusters ( const LightClusters & );
+	LightClusters & operator= ( const LightClusters & );
+
+	// texture buffer of one of the arrays uploaded every frame
+	typedef struct LightBuffer
+	{
+		StreamBuffer *  stream;     // NULL if the buffer below is orphaned instead
+		GLuint          buffer;
+		GLuint          texture;
+		GLenum          format;
+		GLint           unit;
+
+	} LightBuffer;
+
+	void createBuffer ( LightBuffer &target, GLenum format, GLint unit, GLsizeiptr frameSize );
+	void deleteBuffer ( LightBuffer &target );
+
+	void upload ( LightBuffer &target, const void * data, GLsizeiptr size );
+
+	LightBuffer  lightBuffer;
+	LightBuffer  clusterBuffer;
+	LightBuffer  indexBuffer;
+
+	glm::vec4    params;
+
+	std::vector<glm::vec4>     lightTexels;
+	std::vector<GLuint>        clusters;       // offset and count of each cluster
+	std::vector<GLuint>        indices;
+	std::vector<int>           lightBounds;    // min and max cluster coordinate of each light, 6 per light
+	std::vector<GLuint>        counts;
+
+	unsigned int  numLights;
+	unsigned int  maxClusterLights;
+};
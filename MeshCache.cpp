@@ -0,0 +1,406 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "MeshCache.h"
+
+static const char MESH_CACHE_MAGIC[4] = { 'M', 'E', 'S', 'H' };
+static const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+//============================================================================================================================
+
+MappedFile::MappedFile()
+	: fileData(NULL), fileSize(0)
+#ifdef _WIN32
+	, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open ( const std::string &fileName )
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	fileData = (const unsigned char *)view;
+	fileSize = (size_t)size.QuadPart;
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void * view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file referenced, descriptor is not needed any more
+	::close(fd);
+
+	if (view == MAP_FAILED)
+		return false;
+
+	fileData = (const unsigned char *)view;
+	fileSize = (size_t)info.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close ( void )
+{
+	if (fileData == NULL)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(fileData);
+	CloseHandle((HANDLE)mappingHandle);
+	CloseHandle((HANDLE)fileHandle);
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	munmap((void *)fileData, fileSize);
+#endif
+
+	fileData = NULL;
+	fileSize = 0;
+}
+
+//============================================================================================================================
+
+uint64_t hashBytes ( const unsigned char * data, size_t size )
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool getSourceStats ( const std::string &sourceFileName, uint64_t &size, uint64_t &mtime )
+{
+	struct stat info;
+
+	if (stat(sourceFileName.c_str(), &info) != 0)
+		return false;
+
+	size = (uint64_t)info.st_size;
+	mtime = (uint64_t)info.st_mtime;
+	return true;
+}
+
+static bool hashSourceFile ( const std::string &sourceFileName, uint64_t &hash )
+{
+	MappedFile source;
+
+	if (!source.open(sourceFileName))
+		return false;
+
+	hash = hashBytes(source.data(), source.size());
+	return true;
+}
+
+bool getSourceFileKey ( const std::string &sourceFileName, uint64_t &size, uint64_t &mtime, uint64_t &hash )
+{
+	return getSourceStats(sourceFileName, size, mtime) && hashSourceFile(sourceFileName, hash);
+}
+
+bool sourceFileUnchanged ( const std::string &sourceFileName, uint64_t size, uint64_t mtime, uint64_t hash )
+{
+	uint64_t sourceSize, sourceMtime;
+
+	if (!getSourceStats(sourceFileName, sourceSize, sourceMtime))
+		return false;
+
+	// different size means different content, same size and time means the file was not touched,
+	// same size and different time (copied, checked out again, ...) is decided by the content hash
+	if (sourceSize != size)
+		return false;
+
+	if (sourceMtime != mtime)
+	{
+		uint64_t sourceHash;
+
+		if (!hashSourceFile(sourceFileName, sourceHash) || sourceHash != hash)
+			return false;
+	}
+
+	return true;
+}
+
+// store the new modification time of a source whose content did not change, so the next run does not hash it again
+static bool updateSourceMtime ( const std::string &cacheFileName, uint64_t mtime )
+{
+	std::fstream file(cacheFileName.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+	if (!file)
+		return false;
+
+	file.seekp(offsetof(CookedMeshHeader, sourceMtime));
+	file.write((const char *)&mtime, sizeof(mtime));
+	return (bool)file;
+}
+
+static uint64_t alignOffset ( uint64_t offset )
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+}
+
+std::string meshCacheFileName ( const std::string &sourceFileName )
+{
+	return sourceFileName + ".mesh";
+}
+
+bool openMeshCache ( const std::string &sourceFileName, MappedFile &file, CookedMeshView &view )
+{
+	if (!file.open(meshCacheFileName(sourceFileName)))
+		return false;
+
+	if (file.size() < sizeof(CookedMeshHeader))
+	{
+		file.close();
+		return false;
+	}
+
+	CookedMeshHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_CACHE_VERSION
+		|| header.vertexFormat > VERTEX_FORMAT_PACKED_FLOAT_UV
+		|| header.vertexStride != (uint32_t)vertexFormatLayout((VertexFormat)header.vertexFormat).stride
+		|| (header.indexSize != sizeof(unsigned short) && header.indexSize != sizeof(unsigned int)))
+	{
+		file.close();
+		return false;
+	}
+
+	if (!sourceFileUnchanged(sourceFileName, header.sourceSize, header.sourceMtime, header.sourceHash))
+	{
+		file.close();
+		return false;
+	}
+
+	// touched or checked out again with the same content, the file is patched unmapped and mapped again
+	uint64_t sourceSize, sourceMtime;
+	if (getSourceStats(sourceFileName, sourceSize, sourceMtime) && sourceMtime != header.sourceMtime)
+	{
+		file.close();
+		updateSourceMtime(meshCacheFileName(sourceFileName), sourceMtime);
+
+		if (!file.open(meshCacheFileName(sourceFileName)) || file.size() < sizeof(CookedMeshHeader))
+		{
+			file.close();
+			return false;
+		}
+	}
+
+	const uint64_t vertexBytes = (uint64_t)header.numVertices * header.vertexStride;
+	const uint64_t indexBytes = (uint64_t)header.numIndices * header.indexSize;
+	const uint64_t subMeshBytes = (uint64_t)header.numSubMeshes * sizeof(CookedSubMesh);
+
+	if (header.vertexOffset + vertexBytes > file.size() || header.indexOffset + indexBytes > file.size()
+		|| header.subMeshOffset + subMeshBytes > file.size() || header.materialOffset > file.size())
+	{
+		file.close();
+		return false;
+	}
+
+	view.subMeshes.resize(header.numSubMeshes);
+	for (uint32_t i = 0; i < header.numSubMeshes; i++)
+	{
+		CookedSubMesh subMesh;
+		memcpy(&subMesh, file.data() + header.subMeshOffset + i * sizeof(CookedSubMesh), sizeof(subMesh));
+
+		if ((uint64_t)subMesh.firstIndex + subMesh.numIndices > header.numIndices || subMesh.material >= header.numMaterials)
+		{
+			file.close();
+			return false;
+		}
+
+		view.subMeshes[i].firstIndex = subMesh.firstIndex;
+		view.subMeshes[i].numIndices = subMesh.numIndices;
+		view.subMeshes[i].material = subMesh.material;
+		view.subMeshes[i].lod = subMesh.lod;
+	}
+
+	// material records have variable length because of the texture names
+	uint64_t offset = header.materialOffset;
+
+	view.materials.resize(header.numMaterials);
+	for (uint32_t i = 0; i < header.numMaterials; i++)
+	{
+		CookedMaterial material;
+
+		if (offset + sizeof(CookedMaterial) > file.size())
+		{
+			file.close();
+			return false;
+		}
+		memcpy(&material, file.data() + offset, sizeof(material));
+		offset += sizeof(CookedMaterial);
+
+		if (offset + material.textureNameLength > file.size())
+		{
+			file.close();
+			return false;
+		}
+
+		MeshMaterial &target = view.materials[i];
+		target.ambient = glm::vec3(material.ambient[0], material.ambient[1], material.ambient[2]);
+		target.diffuse = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+		target.specular = glm::vec3(material.specular[0], material.specular[1], material.specular[2]);
+		target.shininess = material.shininess;
+		target.textureName.assign((const char *)(file.data() + offset), material.textureNameLength);
+		offset += material.textureNameLength;
+	}
+
+	view.vertices = file.data() + header.vertexOffset;
+	view.numVertices = header.numVertices;
+	view.vertexFormat = (VertexFormat)header.vertexFormat;
+	view.indices = file.data() + header.indexOffset;
+	view.numIndices = header.numIndices;
+	view.indexSize = header.indexSize;
+
+	return true;
+}
+
+bool writeMeshCache ( const std::string &sourceFileName, const MeshData &mesh )
+{
+	CookedMeshHeader header;
+	memset(&header, 0, sizeof(header));
+
+	if (!getSourceFileKey(sourceFileName, header.sourceSize, header.sourceMtime, header.sourceHash))
+		return false;
+
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.numVertices = (uint32_t)(mesh.vertices.size() / meshFloatsPerVertex);
+	header.vertexFormat = mesh.vertexFormat;
+	header.vertexStride = vertexFormatLayout(mesh.vertexFormat).stride;
+	header.numIndices = (uint32_t)mesh.indices.size();
+	header.indexSize = mesh.indexSize;
+	header.numSubMeshes = (uint32_t)mesh.subMeshes.size();
+	header.numMaterials = (uint32_t)mesh.materials.size();
+
+	header.vertexOffset = alignOffset(sizeof(CookedMeshHeader));
+	header.indexOffset = alignOffset(header.vertexOffset + (uint64_t)header.numVertices * header.vertexStride);
+	header.subMeshOffset = alignOffset(header.indexOffset + mesh.packedIndices.size());
+	header.materialOffset = alignOffset(header.subMeshOffset + header.numSubMeshes * sizeof(CookedSubMesh));
+
+	// write into a temporary file first so that an interrupted run never leaves a broken cooked file behind
+	const std::string cacheFileName = meshCacheFileName(sourceFileName);
+	const std::string tmpFileName = cacheFileName + ".tmp";
+
+	std::ofstream out(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "cannot write mesh cache file: " << tmpFileName << std::endl;
+		return false;
+	}
+
+	const char padding[MESH_CACHE_ALIGNMENT] = { 0 };
+
+	out.write((const char *)&header, sizeof(header));
+	out.write(padding, header.vertexOffset - sizeof(header));
+	out.write((const char *)&mesh.packedVertices[0], mesh.packedVertices.size());
+	out.write(padding, header.indexOffset - (header.vertexOffset + mesh.packedVertices.size()));
+	out.write((const char *)&mesh.packedIndices[0], mesh.packedIndices.size());
+	out.write(padding, header.subMeshOffset - (header.indexOffset + mesh.packedIndices.size()));
+
+	for (size_t i = 0; i < mesh.subMeshes.size(); i++)
+	{
+		CookedSubMesh subMesh;
+		subMesh.firstIndex = mesh.subMeshes[i].firstIndex;
+		subMesh.numIndices = mesh.subMeshes[i].numIndices;
+		subMesh.material = mesh.subMeshes[i].material;
+		subMesh.lod = mesh.subMeshes[i].lod;
+		out.write((const char *)&subMesh, sizeof(subMesh));
+	}
+	out.write(padding, header.materialOffset - (header.subMeshOffset + header.numSubMeshes * sizeof(CookedSubMesh)));
+
+	for (size_t i = 0; i < mesh.materials.size(); i++)
+	{
+		const MeshMaterial &source = mesh.materials[i];
+
+		CookedMaterial material;
+		for (int c = 0; c < 3; c++)
+		{
+			material.ambient[c] = source.ambient[c];
+			material.diffuse[c] = source.diffuse[c];
+			material.specular[c] = source.specular[c];
+		}
+		material.shininess = source.shininess;
+		material.textureNameLength = (uint32_t)source.textureName.size();
+
+		out.write((const char *)&material, sizeof(material));
+		out.write(source.textureName.data(), source.textureName.size());
+	}
+	out.close();
+
+	if (!out)
+	{
+		std::cerr << "cannot write mesh cache file: " << tmpFileName << std::endl;
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	std::remove(cacheFileName.c_str());
+	if (std::rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0)
+	{
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
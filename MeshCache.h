@@ -0,0 +1,131 @@
+/**
+* \file       MeshCache.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Binary pre-cooked mesh files, written on the first import and memory-mapped on later runs.
+*
+* Cooked file layout (native endianness, every block aligned to 16 bytes):
+* | CookedMeshHeader | vertex block | index block | CookedSubMesh table | material records (CookedMaterial + texture name)... |
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+// bump whenever the layout of the cooked file changes, old files are then re-cooked
+const uint32_t MESH_CACHE_VERSION = 5;
+
+typedef struct CookedMeshHeader
+{
+	char      magic[4];         // "MESH"
+	uint32_t  version;          // MESH_CACHE_VERSION
+
+	// invalidation key of the source file
+	uint64_t  sourceSize;
+	uint64_t  sourceMtime;
+	uint64_t  sourceHash;       // FNV-1a of the whole source file
+
+	uint32_t  numVertices;
+	uint32_t  vertexFormat;     // VertexFormat of the vertex block
+	uint32_t  vertexStride;     // bytes per vertex
+	uint32_t  numIndices;
+	uint32_t  indexSize;        // bytes per index, 2 or 4
+	uint32_t  numSubMeshes;
+	uint32_t  numMaterials;
+	uint32_t  reserved;
+
+	uint64_t  vertexOffset;     // offsets of the blocks from the beginning of the file
+	uint64_t  indexOffset;
+	uint64_t  subMeshOffset;
+	uint64_t  materialOffset;
+
+} CookedMeshHeader;
+
+typedef struct CookedSubMesh
+{
+	uint32_t  firstIndex;
+	uint32_t  numIndices;
+	uint32_t  material;         // index of the material record
+	uint32_t  lod;              // level of detail, 0 = full resolution
+
+} CookedSubMesh;
+
+typedef struct CookedMaterial
+{
+	float     ambient[3];
+	float     diffuse[3];
+	float     specular[3];
+	float     shininess;
+	uint32_t  textureNameLength; // followed by textureNameLength chars (no terminating zero)
+
+} CookedMaterial;
+
+/// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open ( const std::string &fileName );
+	void close ( void );
+
+	const unsigned char * data ( void ) const { return fileData; }
+	size_t size ( void ) const { return fileSize; }
+
+private:
+	MappedFile ( const MappedFile & );
+	MappedFile & operator= ( const MappedFile & );
+
+	const unsigned char * fileData;
+	size_t                fileSize;
+
+#ifdef _WIN32
+	void * fileHandle;
+	void * mappingHandle;
+#endif
+};
+
+// pointers into a mapped cooked file, valid as long as the MappedFile stays open
+typedef struct CookedMeshView
+{
+	const void *         vertices;
+	unsigned int         numVertices;
+	VertexFormat         vertexFormat;
+	const void *         indices;
+	unsigned int         numIndices;
+	unsigned int         indexSize;
+
+	std::vector<SubMeshData>  subMeshes;
+	std::vector<MeshMaterial> materials;
+
+} CookedMeshView;
+
+/// 64-bit FNV-1a hash of a memory block.
+uint64_t hashBytes ( const unsigned char * data, size_t size );
+
+/// Size, modification time and content hash of a source file, the invalidation key of the cooked files.
+bool getSourceFileKey ( const std::string &sourceFileName, uint64_t &size, uint64_t &mtime, uint64_t &hash );
+
+/// True if the source file still matches the key stored in its cooked file, the content is hashed only if the time differs.
+bool sourceFileUnchanged ( const std::string &sourceFileName, uint64_t size, uint64_t mtime, uint64_t hash );
+
+/// Name of the cooked file belonging to the source model file.
+std::string meshCacheFileName ( const std::string &sourceFileName );
+
+/** Map the cooked version of a model file if it is up to date.
+* \param sourceFileName [in] source model file (e.g. .obj)
+* \param file [out] mapping of the cooked file, keep it open while the view is used
+* \param view [out] pointers to the vertex and index blocks of the mapping, submeshes and materials are copied
+* \return false if there is no cooked file or it does not match the source file any more
+*/
+bool openMeshCache ( const std::string &sourceFileName, MappedFile &file, CookedMeshView &view );
+
+/** Cook an imported mesh so that the next run can skip the import.
+* \param sourceFileName [in] source model file the mesh was imported from
+* \param mesh [in] imported mesh, its packedVertices and packedIndices are stored
+*/
+bool writeMeshCache ( const std::string &sourceFileName, const MeshData &mesh );
@@ -0,0 +1,57 @@
+/**
+* \file       MeshData.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      CPU-side representation of an imported mesh, shared by the importer and the mesh cache.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "pgr.h"
+#include "VertexFormat.h"
+
+// number of floats per vertex in the interleaved vertex block |x,y,z,nx,ny,nz,u,v|...
+const int meshFloatsPerVertex = 8;
+
+// material of the mesh as read from the source file
+typedef struct MeshMaterial
+{
+	glm::vec3     ambient;
+	glm::vec3     diffuse;
+	glm::vec3     specular;
+	float         shininess;
+
+	std::string   textureName;          // path of the diffuse texture, empty if the part is not textured
+
+} MeshMaterial;
+
+// range of the shared index buffer drawn with one material
+typedef struct SubMeshData
+{
+	unsigned int  firstIndex;
+	unsigned int  numIndices;
+	unsigned int  material;             // index into MeshData::materials
+	unsigned int  lod;                  // level of detail, 0 = full resolution
+
+} SubMeshData;
+
+// imported model waiting to be uploaded to OpenGL, all its parts share one vertex and one index buffer
+typedef struct MeshData
+{
+	std::vector<float>        vertices; // interleaved position, normal and texture coordinates
+	std::vector<unsigned int> indices;  // three indices per triangle
+
+	// vertices and indices packed for the GPU by packVertices() and packIndices()
+	std::vector<unsigned char> packedVertices;
+	VertexFormat              vertexFormat;
+	std::vector<unsigned char> packedIndices;
+	unsigned int              indexSize;      // bytes per packed index
+
+	// one submesh per material and level of detail, ordered by level and then by texture
+	// so that consecutive submeshes rebind as little as possible
+	std::vector<SubMeshData>  subMeshes;
+	std::vector<MeshMaterial> materials;
+
+} MeshData;
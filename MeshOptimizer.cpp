@@ -0,0 +1,347 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "MeshOptimizer.h"
+
+// size of the cache modelled by the optimizer, larger than the statistics one so it works well on any hardware
+static const int OPTIMIZER_CACHE_SIZE = 32;
+
+//============================================================================================================================
+
+VertexCacheStatistics analyzeVertexCache ( const std::vector<unsigned int> &indices, unsigned int numVertices )
+{
+	VertexCacheStatistics statistics;
+
+	// FIFO cache: vertex is cached if it was transformed within the last VERTEX_CACHE_SIZE misses
+	std::vector<unsigned int> transformedAt(numVertices, 0);
+	unsigned int misses = 0;
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		unsigned int vertex = indices[i];
+
+		if (transformedAt[vertex] == 0 || misses + 1 - transformedAt[vertex] > VERTEX_CACHE_SIZE)
+		{
+			misses++;
+			transformedAt[vertex] = misses;
+		}
+	}
+
+	const size_t numTriangles = indices.size() / 3;
+	statistics.acmr = numTriangles ? (float)misses / numTriangles : 0.0f;
+	statistics.atvr = numVertices ? (float)misses / numVertices : 0.0f;
+
+	return statistics;
+}
+
+//============================================================================================================================
+
+static float vertexScore ( int cachePosition, unsigned int remainingTriangles )
+{
+	// vertex without any triangles left never draws a triangle in
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+
+	if (cachePosition >= 0)
+	{
+		// the last triangle's vertices get a fixed score so that strips are not preferred over fans
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePosition - 3) / (OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// prefer vertices with few triangles left, so they can be dropped from the cache soon
+	score += 2.0f * powf((float)remainingTriangles, -0.5f);
+
+	return score;
+}
+
+void optimizeVertexCache ( std::vector<unsigned int> &indices, unsigned int numVertices )
+{
+	const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+	if (numTriangles == 0)
+		return;
+
+	// triangles adjacent to each vertex, the first remaining[v] entries of each list are not emitted yet
+	std::vector<unsigned int> remaining(numVertices, 0);
+	std::vector<unsigned int> adjacencyOffset(numVertices + 1, 0);
+	std::vector<unsigned int> adjacency(indices.size());
+
+	for (size_t i = 0; i < indices.size(); i++)
+		remaining[indices[i]]++;
+
+	for (unsigned int v = 0; v < numVertices; v++)
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+
+	std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> score(numVertices);
+	for (unsigned int v = 0; v < numVertices; v++)
+		score[v] = vertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(numTriangles);
+	for (unsigned int t = 0; t < numTriangles; t++)
+		triangleScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	std::vector<unsigned int> cache, newCache;
+	unsigned int scanCursor = 0;
+
+	int best = (int)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+
+	while (output.size() < indices.size())
+	{
+		// nothing useful in the cache, continue with any triangle not emitted yet
+		if (best < 0)
+		{
+			while (scanCursor < numTriangles && emitted[scanCursor])
+				scanCursor++;
+			if (scanCursor == numTriangles)
+				break;
+			best = (int)scanCursor;
+		}
+
+		const unsigned int * triangle = &indices[3 * best];
+		emitted[best] = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			output.push_back(v);
+
+			// drop the triangle from the remaining triangles of its vertices
+			unsigned int * list = &adjacency[adjacencyOffset[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				if (list[j] == (unsigned int)best)
+				{
+					std::swap(list[j], list[remaining[v] - 1]);
+					remaining[v]--;
+					break;
+				}
+			}
+		}
+
+		// triangle's vertices go to the front of the cache, the rest shifts back
+		newCache.assign(triangle, triangle + 3);
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				newCache.push_back(cache[i]);
+		}
+
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			unsigned int v = newCache[i];
+			cachePosition[v] = (i < (size_t)OPTIMIZER_CACHE_SIZE) ? (int)i : -1;
+			score[v] = vertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// rescore triangles touching the (possibly evicted) cache vertices, the best cached one goes next
+		best = -1;
+		float bestScore = -1.0f;
+
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			unsigned int v = newCache[i];
+			const unsigned int * list = &adjacency[adjacencyOffset[v]];
+
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				unsigned int t = list[j];
+				triangleScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+
+				if (cachePosition[v] >= 0 && triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = (int)t;
+				}
+			}
+		}
+
+		if (newCache.size() > (size_t)OPTIMIZER_CACHE_SIZE)
+			newCache.resize(OPTIMIZER_CACHE_SIZE);
+		cache.swap(newCache);
+	}
+
+	indices.swap(output);
+}
+
+//============================================================================================================================
+
+typedef struct TriangleCluster
+{
+	unsigned int  firstTriangle;
+	unsigned int  numTriangles;
+	float         sortKey;
+
+} TriangleCluster;
+
+static bool clusterDrawsEarlier ( const TriangleCluster &a, const TriangleCluster &b )
+{
+	return a.sortKey > b.sortKey;
+}
+
+void optimizeOverdraw ( std::vector<unsigned int> &indices, const std::vector<float> &vertices )
+{
+	const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+	const unsigned int numVertices = (unsigned int)(vertices.size() / meshFloatsPerVertex);
+	if (numTriangles == 0)
+		return;
+
+	// split into clusters at triangles which miss the cache with all three vertices, reordering those costs nothing
+	std::vector<TriangleCluster> clusters;
+	std::vector<unsigned int> transformedAt(numVertices, 0);
+	unsigned int misses = 0;
+
+	for (unsigned int t = 0; t < numTriangles; t++)
+	{
+		int triangleMisses = 0;
+
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[3 * t + k];
+			if (transformedAt[v] == 0 || misses + 1 - transformedAt[v] > VERTEX_CACHE_SIZE)
+			{
+				misses++;
+				transformedAt[v] = misses;
+				triangleMisses++;
+			}
+		}
+
+		if (t == 0 || triangleMisses == 3)
+		{
+			TriangleCluster cluster = { t, 0, 0.0f };
+			clusters.push_back(cluster);
+		}
+		clusters.back().numTriangles++;
+	}
+
+	// area weighted centroid of the whole mesh
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	std::vector<glm::vec3> clusterCentroid(clusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormal(clusters.size(), glm::vec3(0.0f));
+	std::vector<float> clusterArea(clusters.size(), 0.0f);
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		for (unsigned int t = clusters[c].firstTriangle; t < clusters[c].firstTriangle + clusters[c].numTriangles; t++)
+		{
+			const float * p0 = &vertices[indices[3 * t] * meshFloatsPerVertex];
+			const float * p1 = &vertices[indices[3 * t + 1] * meshFloatsPerVertex];
+			const float * p2 = &vertices[indices[3 * t + 2] * meshFloatsPerVertex];
+
+			glm::vec3 a(p0[0], p0[1], p0[2]);
+			glm::vec3 b(p1[0], p1[1], p1[2]);
+			glm::vec3 d(p2[0], p2[1], p2[2]);
+
+			// length of the cross product is twice the area, it weights the normal by area on its own
+			glm::vec3 normal = glm::cross(b - a, d - a);
+			float area = 0.5f * glm::length(normal);
+
+			clusterNormal[c] += normal;
+			clusterCentroid[c] += (a + b + d) * (area / 3.0f);
+			clusterArea[c] += area;
+		}
+
+		meshCentroid += clusterCentroid[c];
+		meshArea += clusterArea[c];
+	}
+
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	// clusters facing away from the center are on the outside and likely occlude the others, draw them first
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		if (clusterArea[c] == 0.0f || glm::length(clusterNormal[c]) == 0.0f)
+			continue;
+
+		glm::vec3 centroid = clusterCentroid[c] / clusterArea[c];
+		clusters[c].sortKey = glm::dot(centroid - meshCentroid, glm::normalize(clusterNormal[c]));
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), clusterDrawsEarlier);
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		output.insert(output.end(), indices.begin() + 3 * clusters[c].firstTriangle,
+			indices.begin() + 3 * (clusters[c].firstTriangle + clusters[c].numTriangles));
+	}
+
+	indices.swap(output);
+}
+
+//============================================================================================================================
+
+void optimizeVertexFetch ( std::vector<float> &vertices, std::vector<unsigned int> &indices )
+{
+	const unsigned int numVertices = (unsigned int)(vertices.size() / meshFloatsPerVertex);
+	const unsigned int unused = ~0u;
+
+	std::vector<unsigned int> remap(numVertices, unused);
+	unsigned int nextVertex = 0;
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (remap[indices[i]] == unused)
+			remap[indices[i]] = nextVertex++;
+		indices[i] = remap[indices[i]];
+	}
+
+	// vertices not referenced by any triangle are dropped
+	std::vector<float> output(nextVertex * meshFloatsPerVertex);
+
+	for (unsigned int v = 0; v < numVertices; v++)
+	{
+		if (remap[v] != unused)
+			std::copy(&vertices[v * meshFloatsPerVertex], &vertices[v * meshFloatsPerVertex] + meshFloatsPerVertex,
+				&output[remap[v] * meshFloatsPerVertex]);
+	}
+
+	vertices.swap(output);
+}
+
+void optimizeMesh ( const std::string &name, MeshData &mesh )
+{
+	unsigned int numVertices = (unsigned int)(mesh.vertices.size() / meshFloatsPerVertex);
+
+	VertexCacheStatistics before = analyzeVertexCache(mesh.indices, numVertices);
+
+	// triangles may only move within their submesh, the ranges must stay as they are
+	std::vector<unsigned int> range;
+	for (size_t s = 0; s < mesh.subMeshes.size(); s++)
+	{
+		std::vector<unsigned int>::iterator first = mesh.indices.begin() + mesh.subMeshes[s].firstIndex;
+		range.assign(first, first + mesh.subMeshes[s].numIndices);
+
+		optimizeVertexCache(range, numVertices);
+		optimizeOverdraw(range, mesh.vertices);
+
+		std::copy(range.begin(), range.end(), first);
+	}
+
+	// vertices are shared by all submeshes, their order follows the first use over the whole buffer
+	optimizeVertexFetch(mesh.vertices, mesh.indices);
+
+	numVertices = (unsigned int)(mesh.vertices.size() / meshFloatsPerVertex);
+	VertexCacheStatistics after = analyzeVertexCache(mesh.indices, numVertices);
+
+	std::cout << "Optimized mesh " << name << ": ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
@@ -0,0 +1,39 @@
+/**
+* \file       MeshOptimizer.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Import-time reordering of triangles and vertices for the post-transform cache, overdraw and vertex fetch.
+*/
+
+#pragma once
+#include <vector>
+
+#include "MeshData.h"
+
+// size of the simulated FIFO post-transform cache used for the statistics
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+typedef struct VertexCacheStatistics
+{
+	float  acmr;    // average cache miss ratio, transformed vertices per triangle (0.5 ideal, 3.0 worst)
+	float  atvr;    // average transformed vertex ratio, transformed vertices per vertex (1.0 ideal)
+
+} VertexCacheStatistics;
+
+/// Simulate FIFO post-transform cache of VERTEX_CACHE_SIZE entries over the index buffer.
+VertexCacheStatistics analyzeVertexCache ( const std::vector<unsigned int> &indices, unsigned int numVertices );
+
+/// Reorder triangles for post-transform cache locality (Forsyth's linear-speed optimizer).
+void optimizeVertexCache ( std::vector<unsigned int> &indices, unsigned int numVertices );
+
+/** Reorder clusters of the cache-optimized triangles so that the outward facing ones go first.
+* Clusters are split where the cache is flushed anyway, so the ACMR stays the same.
+* \param vertices [in] interleaved float vertices |x,y,z,nx,ny,nz,u,v|...
+*/
+void optimizeOverdraw ( std::vector<unsigned int> &indices, const std::vector<float> &vertices );
+
+/// Reorder vertices in the order they are first referenced by the index buffer.
+void optimizeVertexFetch ( std::vector<float> &vertices, std::vector<unsigned int> &indices );
+
+/// All passes above, triangles are reordered within each submesh. Reports ACMR/ATVR before and after.
+void optimizeMesh ( const std::string &name, MeshData &mesh );
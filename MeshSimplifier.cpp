@@ -0,0 +1,195 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+
+#include "MeshSimplifier.h"
+
+// grid cells along the longest side of the mesh for the levels 1, 2, 3
+static const unsigned int LOD_GRID_SIZES[MAX_MESH_LODS - 1] = { 48, 24, 12 };
+
+// a level is kept only if it has at most this fraction of triangles of the previous one
+static const float LOD_MIN_REDUCTION = 0.8f;
+
+//============================================================================================================================
+
+// dominant axis and direction of the normal, keeps the two sides of thin parts and sharp edges apart
+static unsigned int normalBucket ( const float * normal )
+{
+	const float ax = fabsf(normal[0]), ay = fabsf(normal[1]), az = fabsf(normal[2]);
+
+	if (ax >= ay && ax >= az)
+		return normal[0] >= 0.0f ? 0 : 1;
+	if (ay >= az)
+		return normal[1] >= 0.0f ? 2 : 3;
+	return normal[2] >= 0.0f ? 4 : 5;
+}
+
+void simplifyMesh ( const std::vector<unsigned int> &indices, const std::vector<float> &vertices, const glm::vec3 &gridMin, float cellSize,
+	std::vector<unsigned int> &simplified )
+{
+	typedef struct Cluster
+	{
+		glm::vec3     positionSum;
+		unsigned int  count;
+		unsigned int  representative;
+		float         distance;
+
+	} Cluster;
+
+	simplified.clear();
+
+	const unsigned int numVertices = (unsigned int)(vertices.size() / meshFloatsPerVertex);
+	const unsigned int unassigned = ~0u;
+
+	// cell of every referenced vertex, 20 bits per axis and 3 bits of the normal bucket
+	std::vector<unsigned int> vertexCluster(numVertices, unassigned);
+	std::map<unsigned long long, unsigned int> cellCluster;
+	std::vector<Cluster> clusters;
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		const unsigned int v = indices[i];
+		if (vertexCluster[v] != unassigned)
+			continue;
+
+		const float * vertex = &vertices[v * meshFloatsPerVertex];
+		const glm::vec3 position(vertex[0], vertex[1], vertex[2]);
+		const glm::vec3 cell = glm::floor((position - gridMin) / cellSize);
+
+		const unsigned long long key = ((unsigned long long)cell.x << 43) | ((unsigned long long)cell.y << 23)
+			| ((unsigned long long)cell.z << 3) | normalBucket(vertex + 3);
+
+		std::map<unsigned long long, unsigned int>::iterator it = cellCluster.find(key);
+		if (it == cellCluster.end())
+		{
+			Cluster cluster = { glm::vec3(0.0f), 0, v, -1.0f };
+			it = cellCluster.insert(std::make_pair(key, (unsigned int)clusters.size())).first;
+			clusters.push_back(cluster);
+		}
+
+		vertexCluster[v] = it->second;
+		clusters[it->second].positionSum += position;
+		clusters[it->second].count++;
+	}
+
+	// the vertex closest to the average of the cell represents it
+	for (unsigned int v = 0; v < numVertices; v++)
+	{
+		if (vertexCluster[v] == unassigned)
+			continue;
+
+		Cluster &cluster = clusters[vertexCluster[v]];
+		const float * vertex = &vertices[v * meshFloatsPerVertex];
+		const float distance = glm::length(glm::vec3(vertex[0], vertex[1], vertex[2]) - cluster.positionSum / (float)cluster.count);
+
+		if (cluster.distance < 0.0f || distance < cluster.distance)
+		{
+			cluster.distance = distance;
+			cluster.representative = v;
+		}
+	}
+
+	// collapsed triangles disappear, triangles collapsed onto the same three vertices are kept once
+	std::set<std::pair<unsigned long long, unsigned int> > emitted;
+
+	for (size_t t = 0; t + 2 < indices.size(); t += 3)
+	{
+		unsigned int a = clusters[vertexCluster[indices[t]]].representative;
+		unsigned int b = clusters[vertexCluster[indices[t + 1]]].representative;
+		unsigned int c = clusters[vertexCluster[indices[t + 2]]].representative;
+
+		if (a == b || b == c || a == c)
+			continue;
+
+		// rotate the smallest index first, the winding stays the same
+		while (a > b || a > c)
+		{
+			unsigned int first = a;
+			a = b;
+			b = c;
+			c = first;
+		}
+
+		if (!emitted.insert(std::make_pair(((unsigned long long)a << 32) | b, c)).second)
+			continue;
+
+		simplified.push_back(a);
+		simplified.push_back(b);
+		simplified.push_back(c);
+	}
+}
+
+void generateLods ( const std::string &name, MeshData &mesh )
+{
+	const size_t numVertices = mesh.vertices.size() / meshFloatsPerVertex;
+	if (numVertices == 0)
+		return;
+
+	glm::vec3 boxMin(mesh.vertices[0], mesh.vertices[1], mesh.vertices[2]);
+	glm::vec3 boxMax = boxMin;
+
+	for (size_t v = 1; v < numVertices; v++)
+	{
+		const glm::vec3 position(mesh.vertices[v * meshFloatsPerVertex], mesh.vertices[v * meshFloatsPerVertex + 1], mesh.vertices[v * meshFloatsPerVertex + 2]);
+		boxMin = glm::min(boxMin, position);
+		boxMax = glm::max(boxMax, position);
+	}
+
+	const glm::vec3 extent = boxMax - boxMin;
+	const float longestSide = std::max(extent.x, std::max(extent.y, extent.z));
+	if (longestSide <= 0.0f)
+		return;
+
+	// levels are built from the full resolution submeshes, the coarser ones are appended behind them
+	const size_t numBaseSubMeshes = mesh.subMeshes.size();
+	size_t previousTriangles = mesh.indices.size() / 3;
+
+	std::cout << "LODs of " << name << ": " << previousTriangles;
+
+	std::vector<unsigned int> range, simplified;
+
+	for (unsigned int lod = 1; lod < MAX_MESH_LODS; lod++)
+	{
+		const float cellSize = longestSide / LOD_GRID_SIZES[lod - 1];
+		const size_t levelStart = mesh.indices.size();
+		const size_t levelSubMeshes = mesh.subMeshes.size();
+
+		for (size_t s = 0; s < numBaseSubMeshes; s++)
+		{
+			const SubMeshData &base = mesh.subMeshes[s];
+			range.assign(mesh.indices.begin() + base.firstIndex, mesh.indices.begin() + base.firstIndex + base.numIndices);
+
+			simplifyMesh(range, mesh.vertices, boxMin, cellSize, simplified);
+
+			// small parts may vanish completely in the distance
+			if (simplified.empty())
+				continue;
+
+			SubMeshData subMesh;
+			subMesh.firstIndex = (unsigned int)mesh.indices.size();
+			subMesh.numIndices = (unsigned int)simplified.size();
+			subMesh.material = base.material;
+			subMesh.lod = lod;
+
+			mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+			mesh.subMeshes.push_back(subMesh);
+		}
+
+		const size_t levelTriangles = (mesh.indices.size() - levelStart) / 3;
+
+		// level not worth the memory, the coarser ones would not be either
+		if (levelTriangles == 0 || levelTriangles > LOD_MIN_REDUCTION * previousTriangles)
+		{
+			mesh.indices.resize(levelStart);
+			mesh.subMeshes.resize(levelSubMeshes);
+			break;
+		}
+
+		std::cout << " / " << levelTriangles;
+		previousTriangles = levelTriangles;
+	}
+
+	std::cout << " triangles" << std::endl;
+}
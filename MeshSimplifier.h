@@ -0,0 +1,31 @@
+/**
+* \file       MeshSimplifier.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Import-time generation of coarser levels of detail by vertex clustering.
+*
+* The levels reuse the vertices of the full resolution mesh, only new index ranges are added,
+* so all levels live in the same vertex and index buffer.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+// maximum number of levels of detail including the full resolution one
+const unsigned int MAX_MESH_LODS = 4;
+
+/** Simplify triangles by vertex clustering, vertices falling into one grid cell (and facing the same way) collapse into one of them.
+* \param indices [in] triangles to simplify
+* \param vertices [in] interleaved float vertices |x,y,z,nx,ny,nz,u,v|...
+* \param gridMin [in] corner of the grid, the bounding box of the whole mesh
+* \param cellSize [in] edge length of one grid cell
+* \param simplified [out] remaining triangles indexing the same vertices, degenerate and duplicate ones are dropped
+*/
+void simplifyMesh ( const std::vector<unsigned int> &indices, const std::vector<float> &vertices, const glm::vec3 &gridMin, float cellSize,
+	std::vector<unsigned int> &simplified );
+
+/// Append up to MAX_MESH_LODS - 1 coarser levels of all submeshes, each level gets its own submesh entries.
+void generateLods ( const std::string &name, MeshData &mesh );
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "OcclusionCuller.h"
+
+// window depth of the cleared buffer, nothing is hidden behind it
+static const float FAR_DEPTH = 1.0f;
+
+// one screen vertex of a triangle being rasterized
+typedef struct ScreenVertex
+{
+	float  x;
+	float  y;
+	float  z;
+
+} ScreenVertex;
+
+//============================================================================================================================
+
+static ScreenVertex toScreen ( const glm::vec4 &clip )
+{
+	ScreenVertex vertex;
+	vertex.x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+	vertex.y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+	vertex.z = clip.z / clip.w * 0.5f + 0.5f;
+
+	return vertex;
+}
+
+// point of the edge a-b on the near plane z = -w
+static glm::vec4 nearIntersection ( const glm::vec4 &a, const glm::vec4 &b )
+{
+	const float da = a.z + a.w;
+	const float db = b.z + b.w;
+
+	return a + (b - a) * (da / (da - db));
+}
+
+OcclusionCuller::OcclusionCuller ( )
+	: valid(false), jobPending(false), jobRunning(false), stopping(false)
+{
+	int width = OCCLUSION_WIDTH;
+	int height = OCCLUSION_HEIGHT;
+
+	while (true)
+	{
+		levels.push_back(std::vector<float>(width * height, FAR_DEPTH));
+		levelWidths.push_back(width);
+		levelHeights.push_back(height);
+
+		if (width == 1 && height == 1)
+			break;
+
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+
+	worker = std::thread(&OcclusionCuller::workerLoop, this);
+}
+
+OcclusionCuller::~OcclusionCuller ( )
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	worker.join();
+}
+
+void OcclusionCuller::setOccluders ( const std::vector<glm::vec3> &newVertices, const std::vector<unsigned int> &newIndices )
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (jobPending || jobRunning)
+		jobDone.wait(lock);
+
+	vertices = newVertices;
+	indices = newIndices;
+	valid = false;
+}
+
+void OcclusionCuller::begin ( const glm::mat4 &matrix )
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobMatrix = matrix;
+		jobPending = true;
+		valid = false;
+	}
+	jobAvailable.notify_one();
+}
+
+void OcclusionCuller::finish ( void )
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (jobPending || jobRunning)
+		jobDone.wait(lock);
+}
+
+void OcclusionCuller::workerLoop ( void )
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		while (!jobPending && !stopping)
+			jobAvailable.wait(lock);
+
+		if (stopping)
+			return;
+
+		const glm::mat4 matrix = jobMatrix;
+		jobPending = false;
+		jobRunning = true;
+
+		// the occluders only change while no job is running
+		lock.unlock();
+		rasterize(matrix);
+		buildPyramid();
+		lock.lock();
+
+		jobRunning = false;
+		// a newer begin() came meanwhile, its job follows
+		valid = !jobPending;
+		jobDone.notify_all();
+	}
+}
+
+void OcclusionCuller::rasterize ( const glm::mat4 &matrix )
+{
+	PVmatrix = matrix;
+
+	std::vector<float> &depth = levels[0];
+	std::fill(depth.begin(), depth.end(), FAR_DEPTH);
+
+	clipVertices.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+		clipVertices[i] = matrix * glm::vec4(vertices[i], 1.0f);
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const glm::vec4 * corners[3] = { &clipVertices[indices[i]], &clipVertices[indices[i + 1]], &clipVertices[indices[i + 2]] };
+
+		int numBehind = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			if (corners[c]->z < -corners[c]->w)
+				numBehind++;
+		}
+
+		if (numBehind == 3)
+			continue;
+
+		if (numBehind == 0)
+		{
+			rasterizeTriangle(*corners[0], *corners[1], *corners[2]);
+			continue;
+		}
+
+		// clip the triangle by the near plane, one corner behind leaves a quad, two of them a smaller triangle
+		glm::vec4 polygon[4];
+		int numCorners = 0;
+
+		for (int c = 0; c < 3; c++)
+		{
+			const glm::vec4 &current = *corners[c];
+			const glm::vec4 &next = *corners[(c + 1) % 3];
+			const bool currentInside = (current.z >= -current.w);
+			const bool nextInside = (next.z >= -next.w);
+
+			if (currentInside)
+				polygon[numCorners++] = current;
+			if (currentInside != nextInside)
+				polygon[numCorners++] = nearIntersection(current, next);
+		}
+
+		for (int c = 2; c < numCorners; c++)
+			rasterizeTriangle(polygon[0], polygon[c - 1], polygon[c]);
+	}
+}
+
+void OcclusionCuller::rasterizeTriangle ( const glm::vec4 &clipA, const glm::vec4 &clipB, const glm::vec4 &clipC )
+{
+	const ScreenVertex a = toScreen(clipA);
+	ScreenVertex b = toScreen(clipB);
+	ScreenVertex c = toScreen(clipC);
+
+	float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+	if (!(area != 0.0f))
+		return;
+
+	// both windings are drawn, the edges are oriented to have the inside positive
+	if (area < 0.0f)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	const float minX = std::min(a.x, std::min(b.x, c.x));
+	const float maxX = std::max(a.x, std::max(b.x, c.x));
+	const float minY = std::min(a.y, std::min(b.y, c.y));
+	const float maxY = std::max(a.y, std::max(b.y, c.y));
+
+	// pixels with the center in the bounds, the rows start at a multiple of 4 for the SIMD loop
+	if (maxX < 0.5f || maxY < 0.5f || minX > OCCLUSION_WIDTH - 0.5f || minY > OCCLUSION_HEIGHT - 0.5f)
+		return;
+
+	const int firstX = std::max((int)std::floor(minX - 0.5f) + 1, 0) & ~3;
+	const int lastX = std::min((int)std::ceil(maxX - 0.5f), OCCLUSION_WIDTH - 1);
+	const int firstY = std::max((int)std::floor(minY - 0.5f) + 1, 0);
+	const int lastY = std::min((int)std::ceil(maxY - 0.5f), OCCLUSION_HEIGHT - 1);
+
+	// edge functions and depth as planes value = dx * x + dy * y + offset, the pixels on the edges are inside
+	const ScreenVertex * edgeStart[3] = { &b, &c, &a };
+	const ScreenVertex * edgeEnd[3] = { &c, &a, &b };
+
+	float edgeDx[3], edgeDy[3], edgeOffset[3];
+	for (int e = 0; e < 3; e++)
+	{
+		edgeDx[e] = edgeStart[e]->y - edgeEnd[e]->y;
+		edgeDy[e] = edgeEnd[e]->x - edgeStart[e]->x;
+		edgeOffset[e] = -(edgeDx[e] * edgeStart[e]->x + edgeDy[e] * edgeStart[e]->y);
+	}
+
+	// the edge function opposite of a vertex is the barycentric weight of the vertex times area
+	const float depthDx = (edgeDx[0] * a.z + edgeDx[1] * b.z + edgeDx[2] * c.z) / area;
+	const float depthDy = (edgeDy[0] * a.z + edgeDy[1] * b.z + edgeDy[2] * c.z) / area;
+	const float depthOffset = (edgeOffset[0] * a.z + edgeOffset[1] * b.z + edgeOffset[2] * c.z) / area;
+
+	std::vector<float> &depth = levels[0];
+
+#ifdef OCCLUSION_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 pixelOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+	const __m128 edge0Dx = _mm_set1_ps(edgeDx[0]), edge1Dx = _mm_set1_ps(edgeDx[1]), edge2Dx = _mm_set1_ps(edgeDx[2]);
+	const __m128 edge0Step = _mm_set1_ps(4.0f * edgeDx[0]), edge1Step = _mm_set1_ps(4.0f * edgeDx[1]), edge2Step = _mm_set1_ps(4.0f * edgeDx[2]);
+	const __m128 depthStep = _mm_set1_ps(4.0f * depthDx);
+
+	for (int y = firstY; y <= lastY; y++)
+	{
+		const float centerY = y + 0.5f;
+		const __m128 centersX = _mm_add_ps(_mm_set1_ps((float)firstX), pixelOffsets);
+
+		__m128 edge0 = _mm_add_ps(_mm_mul_ps(edge0Dx, centersX), _mm_set1_ps(edgeDy[0] * centerY + edgeOffset[0]));
+		__m128 edge1 = _mm_add_ps(_mm_mul_ps(edge1Dx, centersX), _mm_set1_ps(edgeDy[1] * centerY + edgeOffset[1]));
+		__m128 edge2 = _mm_add_ps(_mm_mul_ps(edge2Dx, centersX), _mm_set1_ps(edgeDy[2] * centerY + edgeOffset[2]));
+		__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthDx), centersX), _mm_set1_ps(depthDy * centerY + depthOffset));
+
+		float * row = &depth[y * OCCLUSION_WIDTH];
+
+		for (int x = firstX; x <= lastX; x += 4)
+		{
+			__m128 inside = _mm_cmpge_ps(edge0, zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(edge1, zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(edge2, zero));
+
+			if (_mm_movemask_ps(inside) != 0)
+			{
+				const __m128 old = _mm_loadu_ps(row + x);
+				const __m128 nearer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+
+			edge0 = _mm_add_ps(edge0, edge0Step);
+			edge1 = _mm_add_ps(edge1, edge1Step);
+			edge2 = _mm_add_ps(edge2, edge2Step);
+			z = _mm_add_ps(z, depthStep);
+		}
+	}
+#else
+	for (int y = firstY; y <= lastY; y++)
+	{
+		const float centerY = y + 0.5f;
+		float * row = &depth[y * OCCLUSION_WIDTH];
+
+		for (int x = firstX; x <= lastX; x++)
+		{
+			const float centerX = x + 0.5f;
+
+			bool inside = true;
+			for (int e = 0; e < 3; e++)
+			{
+				if (edgeDx[e] * centerX + edgeDy[e] * centerY + edgeOffset[e] < 0.0f)
+					inside = false;
+			}
+
+			if (inside)
+				row[x] = std::min(row[x], depthDx * centerX + depthDy * centerY + depthOffset);
+		}
+	}
+#endif
+}
+
+void OcclusionCuller::buildPyramid ( void )
+{
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		const std::vector<float> &source = levels[level - 1];
+		const int sourceWidth = levelWidths[level - 1];
+		const int sourceHeight = levelHeights[level - 1];
+
+		std::vector<float> &target = levels[level];
+		const int width = levelWidths[level];
+		const int height = levelHeights[level];
+
+		for (int y = 0; y < height; y++)
+		{
+			// a level one texel high is halved only horizontally
+			const float * row0 = &source[std::min(2 * y, sourceHeight - 1) * sourceWidth];
+			const float * row1 = &source[std::min(2 * y + 1, sourceHeight - 1) * sourceWidth];
+			float * targetRow = &target[y * width];
+
+			int x = 0;
+#ifdef OCCLUSION_SSE
+			// eight source texels of two rows give four target texels
+			for (; x + 4 <= width && sourceWidth >= 8; x += 4)
+			{
+				const __m128 low = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x), _mm_loadu_ps(row1 + 2 * x));
+				const __m128 high = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x + 4), _mm_loadu_ps(row1 + 2 * x + 4));
+
+				const __m128 even = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+				const __m128 odd = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+				_mm_storeu_ps(targetRow + x, _mm_max_ps(even, odd));
+			}
+#endif
+			for (; x < width; x++)
+			{
+				const int x0 = std::min(2 * x, sourceWidth - 1);
+				const int x1 = std::min(2 * x + 1, sourceWidth - 1);
+
+				targetRow[x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::testBox ( const BoundingBox &box ) const
+{
+	if (!valid)
+		return true;
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearestDepth = FAR_DEPTH;
+
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const glm::vec3 position = glm::vec3(
+			(corner & 1) ? box.max.x : box.min.x,
+			(corner & 2) ? box.max.y : box.min.y,
+			(corner & 4) ? box.max.z : box.min.z
+		);
+		const glm::vec4 clip = PVmatrix * glm::vec4(position, 1.0f);
+
+		// the projection of the box would wrap around, it may surround the camera
+		if (clip.z < -clip.w || clip.w <= 0.0f)
+			return true;
+
+		const ScreenVertex vertex = toScreen(clip);
+		minX = std::min(minX, vertex.x);
+		maxX = std::max(maxX, vertex.x);
+		minY = std::min(minY, vertex.y);
+		maxY = std::max(maxY, vertex.y);
+		nearestDepth = std::min(nearestDepth, vertex.z);
+	}
+
+	// off the screen, the frustum test decides
+	if (maxX < 0.0f || maxY < 0.0f || minX >= OCCLUSION_WIDTH || minY >= OCCLUSION_HEIGHT)
+		return true;
+
+	int x0 = std::max((int)minX, 0);
+	int y0 = std::max((int)minY, 0);
+	int x1 = std::min((int)maxX, OCCLUSION_WIDTH - 1);
+	int y1 = std::min((int)maxY, OCCLUSION_HEIGHT - 1);
+
+	// the coarsest level where the rectangle covers at most 2x2 texels
+	size_t level = 0;
+	while (level + 1 < levels.size() && (x1 - x0 > 1 || y1 - y0 > 1))
+	{
+		level++;
+		x0 >>= 1;
+		y0 >>= 1;
+		x1 >>= 1;
+		y1 >>= 1;
+	}
+
+	const std::vector<float> &depth = levels[level];
+	const int width = levelWidths[level];
+
+	x1 = std::min(x1, width - 1);
+	y1 = std::min(y1, levelHeights[level] - 1);
+
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			// some occluder texel is farther than the box, the box may show there
+			if (depth[y * width + x] >= nearestDepth)
+				return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,78 @@
+/**
+* \file       OcclusionCuller.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Software occlusion culling of object bounds against a few large occluders rasterized on the CPU.
+*
+* The occluder triangles (the castle walls) are rasterized into a small depth buffer on a worker thread while the
+* scene is being submitted, and a pyramid of the farthest depths of 2x2 texels is built over it. A box is hidden when
+* its nearest depth lies behind the farthest occluder depth of the pyramid texels covering it, at most 2x2 reads.
+*/
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "pgr.h"
+#include "Culling.h"
+
+// resolution of the occlusion depth buffer, the width is a multiple of 4 for the SIMD rows
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
+
+class OcclusionCuller
+{
+public:
+	OcclusionCuller ( );
+	~OcclusionCuller ( );
+
+	/** Replace the occluders, waits for the running rasterization.
+	* \param vertices [in] world space positions
+	* \param indices [in] triangles, either winding
+	*/
+	void setOccluders ( const std::vector<glm::vec3> &vertices, const std::vector<unsigned int> &indices );
+
+	/// Start rasterizing the occluders seen through the matrix on the worker thread, returns immediately.
+	void begin ( const glm::mat4 &PVmatrix );
+
+	/// Wait for the depth pyramid of the last begin(), testBox() uses it afterwards.
+	void finish ( void );
+
+	/// False if the box is completely hidden behind the occluders. Boxes reaching in front of the near plane are visible.
+	bool testBox ( const BoundingBox &box ) const;
+
+	unsigned int occluderTriangles ( void ) const { return (unsigned int)indices.size() / 3; }
+
+private:
+	OcclusionCuller ( const OcclusionCuller & );
+	OcclusionCuller & operator= ( const OcclusionCuller & );
+
+	void workerLoop ( void );
+	void rasterize ( const glm::mat4 &PVmatrix );
+	void rasterizeTriangle ( const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c );
+	void buildPyramid ( void );
+
+	// occluders
+	std::vector<glm::vec3>     vertices;
+	std::vector<unsigned int>  indices;
+	std::vector<glm::vec4>     clipVertices;
+
+	// level 0 is the depth buffer, window depth 0..1 with rows from the bottom of the view, every next level is half of it
+	std::vector< std::vector<float> >  levels;
+	std::vector<int>                   levelWidths;
+	std::vector<int>                   levelHeights;
+
+	glm::mat4                PVmatrix;       // of the pyramid
+	bool                     valid;          // the pyramid belongs to the last begin()
+
+	std::thread              worker;
+	std::mutex               mutex;
+	std::condition_variable  jobAvailable;
+	std::condition_variable  jobDone;
+	glm::mat4                jobMatrix;
+	bool                     jobPending;     // begin() was called, the worker did not take the job yet
+	bool                     jobRunning;
+	bool                     stopping;
+};
@@ -0,0 +1,186 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "ProgramCache.h"
+#include "MeshCache.h"
+#include "GLCaps.h"
+
+static const char PROGRAM_CACHE_MAGIC[4] = { 'P', 'R', 'O', 'G' };
+
+static unsigned int cacheHits = 0;
+static unsigned int cacheMisses = 0;
+
+//============================================================================================================================
+
+bool programCacheSupported ( void )
+{
+	// -1 = not queried yet
+	static int supported = -1;
+
+	if (supported < 0)
+	{
+		supported = 0;
+		if (glVersionAtLeast(4, 1) || glHasExtension("GL_ARB_get_program_binary"))
+		{
+			GLint numFormats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+			supported = (numFormats > 0) ? 1 : 0;
+		}
+	}
+
+	return supported == 1;
+}
+
+static uint64_t driverHash ( void )
+{
+	std::string driver;
+
+	const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; i++)
+	{
+		const GLubyte * name = glGetString(names[i]);
+		if (name != NULL)
+			driver += (const char *)name;
+		driver += '\n';
+	}
+
+	return hashBytes((const unsigned char *)driver.data(), driver.size());
+}
+
+std::string programCacheFileName ( const char * vertexShaderFile, const char * fragmentShaderFile, const std::string &defines )
+{
+	std::string fileName = std::string(vertexShaderFile) + "+" + fragmentShaderFile;
+
+	if (!defines.empty())
+	{
+		char variant[20];
+		snprintf(variant, sizeof(variant), ".%016llx", (unsigned long long)hashBytes((const unsigned char *)defines.data(), defines.size()));
+		fileName += variant;
+	}
+
+	return fileName + ".program";
+}
+
+uint64_t programSourceHash ( const std::string &vertexSource, const std::string &fragmentSource, const std::string &attributes )
+{
+	// the separators keep text moved from one part to another from hashing the same
+	const std::string key = vertexSource + '\0' + fragmentSource + '\0' + attributes;
+	return hashBytes((const unsigned char *)key.data(), key.size());
+}
+
+static GLuint restoreProgram ( const std::string &cacheFileName, uint64_t sourceHash )
+{
+	if (!programCacheSupported())
+		return 0;
+
+	std::ifstream in(cacheFileName.c_str(), std::ios::binary);
+	if (!in)
+		return 0;
+
+	ProgramCacheHeader header;
+	if (!in.read((char *)&header, sizeof(header)))
+		return 0;
+
+	if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_CACHE_VERSION
+		|| header.sourceHash != sourceHash || header.driverHash != driverHash() || header.binarySize == 0)
+		return 0;
+
+	std::vector<char> binary(header.binarySize);
+	if (!in.read(&binary[0], binary.size()))
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.binaryFormat, &binary[0], header.binarySize);
+
+	// a driver update may refuse binaries of the same version string
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+GLuint loadProgramBinary ( const std::string &cacheFileName, uint64_t sourceHash )
+{
+	const GLuint program = restoreProgram(cacheFileName, sourceHash);
+	if (program != 0)
+		cacheHits++;
+	else
+		cacheMisses++;
+
+	return program;
+}
+
+bool saveProgramBinary ( const std::string &cacheFileName, uint64_t sourceHash, GLuint program )
+{
+	if (!programCacheSupported())
+		return false;
+
+	GLint binarySize = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+	if (binarySize <= 0)
+		return false;
+
+	std::vector<char> binary(binarySize);
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, binarySize, &written, &binaryFormat, &binary[0]);
+	if (written <= 0)
+		return false;
+
+	ProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.driverHash = driverHash();
+	header.binaryFormat = binaryFormat;
+	header.binarySize = (uint32_t)written;
+
+	// write into a temporary file first so that an interrupted run never leaves a broken cache file behind
+	const std::string tmpFileName = cacheFileName + ".tmp";
+
+	std::ofstream out(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "cannot write program cache file: " << tmpFileName << std::endl;
+		return false;
+	}
+
+	out.write((const char *)&header, sizeof(header));
+	out.write(&binary[0], written);
+	out.close();
+
+	if (!out)
+	{
+		std::cerr << "cannot write program cache file: " << tmpFileName << std::endl;
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	std::remove(cacheFileName.c_str());
+	if (std::rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0)
+	{
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+unsigned int programCacheHits ( void )
+{
+	return cacheHits;
+}
+
+unsigned int programCacheMisses ( void )
+{
+	return cacheMisses;
+}
@@ -0,0 +1,60 @@
+/**
+* \file       ProgramCache.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Linked shader programs stored with glGetProgramBinary() and restored with glProgramBinary() on later runs.
+*
+* Each program has its own file next to its fragment shader. The file is keyed by a hash of the sources as compiled
+* (with the defines of a variant) and of the attribute locations bound before linking, and by a hash of the vendor,
+* renderer and version strings of the driver. A file written by other sources or another driver, or a binary the
+* driver refuses, is simply compiled from the sources again and overwritten.
+*
+* Cache file layout: | ProgramCacheHeader | binarySize bytes of the program binary |
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string>
+
+#include "pgr.h"
+
+// bump whenever the layout of the cache file changes, old files are then rebuilt
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+typedef struct ProgramCacheHeader
+{
+	char      magic[4];         // "PROG"
+	uint32_t  version;          // PROGRAM_CACHE_VERSION
+
+	uint64_t  sourceHash;       // see programSourceHash()
+	uint64_t  driverHash;       // FNV-1a of GL_VENDOR, GL_RENDERER and GL_VERSION
+
+	uint32_t  binaryFormat;     // as returned by glGetProgramBinary()
+	uint32_t  binarySize;
+
+} ProgramCacheHeader;
+
+/// GL 4.1 or GL_ARB_get_program_binary, with at least one binary format the driver can save.
+bool programCacheSupported ( void );
+
+/// Name of the cache file of the program, the defines of a variant give it its own file.
+std::string programCacheFileName ( const char * vertexShaderFile, const char * fragmentShaderFile, const std::string &defines );
+
+/** Invalidation key of the program.
+* \param attributes names and locations of the attributes bound before linking, in any stable form
+*/
+uint64_t programSourceHash ( const std::string &vertexSource, const std::string &fragmentSource, const std::string &attributes );
+
+/** Create the program from its cache file.
+* \return 0 if there is no file, it was written for other sources or another driver, or the driver rejects the binary
+*/
+GLuint loadProgramBinary ( const std::string &cacheFileName, uint64_t sourceHash );
+
+/** Store the binary of the linked program for the next run.
+* \param program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+*/
+bool saveProgramBinary ( const std::string &cacheFileName, uint64_t sourceHash, GLuint program );
+
+/// Programs restored by loadProgramBinary() and the ones it could not restore, since the start.
+unsigned int programCacheHits ( void );
+unsigned int programCacheMisses ( void );
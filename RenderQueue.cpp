@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <climits>
+
+#include "RenderQueue.h"
+#include "render_stuff.h"
+
+//============================================================================================================================
+
+static bool sortKeyLess ( const DrawItem &a, const DrawItem &b )
+{
+	return a.sortKey < b.sortKey;
+}
+
+void RenderQueue::clear ( void )
+{
+	items.clear();
+	views.clear();
+	transforms.clear();
+}
+
+unsigned int RenderQueue::addView ( const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, OcclusionCuller * occlusion )
+{
+	RenderView renderView;
+	renderView.viewMatrix = viewMatrix;
+	renderView.projectionMatrix = projectionMatrix;
+	renderView.PVmatrix = projectionMatrix * viewMatrix;
+	renderView.frustum = extractFrustum(renderView.PVmatrix);
+	renderView.occlusion = occlusion;
+
+	views.push_back(renderView);
+	return (unsigned int)views.size() - 1;
+}
+
+unsigned int RenderQueue::addTransform ( const glm::mat4 &modelMatrix, const glm::mat4 &normalMatrix, const BoundingBox * bounds )
+{
+	RenderTransform transform;
+	transform.modelMatrix = modelMatrix;
+	transform.normalMatrix = normalMatrix;
+	transform.bounded = (bounds != NULL);
+	if (bounds != NULL)
+		transform.bounds = *bounds;
+
+	transforms.push_back(transform);
+	return (unsigned int)transforms.size() - 1;
+}
+
+void RenderQueue::submit ( const DrawItem &item )
+{
+	// |pass:4|shader:4|texture:16|vao:16|stencil:8|submission:16|, GL names only group the items,
+	// a truncated one costs a state change at worst
+	const uint64_t sequence = items.size();
+	uint64_t key = (uint64_t)item.pass << 60;
+
+	if (item.pass == RENDER_PASS_OPAQUE)
+	{
+		const GLuint texture = (item.subMesh != NULL) ? item.subMesh->texture : item.geometry->texture;
+
+		key |= (uint64_t)item.shader << 56;
+		key |= (uint64_t)(texture & 0xFFFF) << 40;
+		key |= (uint64_t)(item.geometry->vertexArrayObject & 0xFFFF) << 24;
+		key |= (uint64_t)item.stencilId << 16;
+		key |= sequence & 0xFFFF;
+	}
+	else
+		key |= sequence & 0xFFFFFFFF;
+
+	items.push_back(item);
+	items.back().sortKey = key;
+}
+
+void RenderQueue::cull ( void )
+{
+	statistics = CullingStatistics();
+
+	// the items of one transform are all drawn from one view
+	transformViews.assign(transforms.size(), UINT_MAX);
+	for (size_t i = 0; i < items.size(); i++)
+		transformViews[items[i].transform] = items[i].view;
+
+	visibleTransforms.assign(transforms.size(), 1);
+
+	for (unsigned int view = 0; view < views.size(); view++)
+	{
+		cullBoxes.clear();
+		cullTransforms.clear();
+
+		for (unsigned int i = 0; i < transforms.size(); i++)
+		{
+			if (transforms[i].bounded && transformViews[i] == view)
+			{
+				cullBoxes.push_back(transforms[i].bounds);
+				cullTransforms.push_back(i);
+			}
+		}
+
+		if (cullBoxes.empty())
+			continue;
+
+		hierarchy.build(cullBoxes);
+		hierarchy.cull(views[view].frustum, visibleBoxes, statistics);
+
+		// the occluders were rasterized meanwhile
+		OcclusionCuller * occlusion = views[view].occlusion;
+		if (occlusion != NULL)
+			occlusion->finish();
+
+		for (size_t i = 0; i < cullBoxes.size(); i++)
+		{
+			statistics.objects++;
+
+			if (!visibleBoxes[i])
+				statistics.culled++;
+			else if (occlusion != NULL && !occlusion->testBox(cullBoxes[i]))
+			{
+				visibleBoxes[i] = 0;
+				statistics.occluded++;
+			}
+			else
+				statistics.visible++;
+
+			visibleTransforms[cullTransforms[i]] = visibleBoxes[i];
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (visibleTransforms[items[i].transform])
+			items[kept++] = items[i];
+	}
+	items.resize(kept);
+}
+
+void RenderQueue::sort ( void )
+{
+	std::sort(items.begin(), items.end(), sortKeyLess);
+}
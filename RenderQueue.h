@@ -0,0 +1,127 @@
+/**
+* \file       RenderQueue.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Draw items of one frame, sorted by the GL state they need.
+*
+* The scene submits one item per drawn part (mesh part with its material, skybox, banner, flame) and
+* drawRenderQueue() issues them pass by pass. Within the opaque pass the items are grouped by program,
+* texture and vao, so the number of state changes follows the number of distinct states, not of objects.
+* Items of objects outside of the view frustum, or hidden behind the occluders of the view, are dropped by cull() before that.
+*/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+#include "pgr.h"
+#include "Culling.h"
+#include "OcclusionCuller.h"
+
+struct MeshGeometry;
+struct SubMesh;
+struct InstanceBuffer;
+
+// passes in the order they are drawn
+enum RenderPass
+{
+	RENDER_PASS_OPAQUE = 0,     // depth tested, writes the stencil IDs of the items for picking
+	RENDER_PASS_SKYBOX = 1,     // far plane, after everything opaque so that most of it fails the depth test
+	RENDER_PASS_ADDITIVE = 2,   // blended GL_ONE, GL_ONE, in the order of submission
+	RENDER_PASS_OVERLAY = 3,    // alpha blended without depth test, in the order of submission
+	NUM_RENDER_PASSES
+};
+
+// program (and the uniforms it needs) an item is drawn with
+enum DrawShader
+{
+	DRAW_SHADER_COMMON = 0,
+	DRAW_SHADER_SKYBOX,
+	DRAW_SHADER_BANNER,
+	DRAW_SHADER_ANIM_BANNER,
+	DRAW_SHADER_FLAME
+};
+
+typedef struct DrawItem
+{
+	RenderPass            pass;
+	DrawShader            shader;
+	const MeshGeometry *  geometry;       // vao, texture of the non-mesh items
+	const SubMesh *       subMesh;        // index range and material, NULL = the whole geometry with its own material
+	unsigned int          view;           // index of the camera in the queue
+	unsigned int          transform;      // index of the model matrix in the queue
+	const InstanceBuffer * instances;     // drawn instanced with these, the transform places the whole group, NULL = one instance
+	unsigned char         stencilId;      // written to the stencil buffer in the opaque pass, 0 = not pickable
+	float                 time;           // animation time of banners and flames
+	float                 frameDuration;  // of the flame animation
+
+	uint64_t              sortKey;        // set by submit()
+
+} DrawItem;
+
+typedef struct RenderView
+{
+	glm::mat4  viewMatrix;
+	glm::mat4  projectionMatrix;
+	glm::mat4  PVmatrix;           // projectionMatrix * viewMatrix, once per view instead of per draw
+	Frustum    frustum;            // world space planes of PVmatrix
+	OcclusionCuller * occlusion;   // objects in the frustum are tested against its occluders, NULL = no occlusion culling
+
+} RenderView;
+
+typedef struct RenderTransform
+{
+	glm::mat4  modelMatrix;
+	glm::mat4  normalMatrix;       // inverse transpose of the model matrix without translation
+	BoundingBox bounds;            // world space bounds of the object, valid if bounded is set
+	bool       bounded;            // objects without bounds are never culled
+
+} RenderTransform;
+
+class RenderQueue
+{
+public:
+	/// Drop all items, views and transforms, the memory is kept for the next frame.
+	void clear ( void );
+
+	/** \param occlusion [in] started with begin() for this view, cull() waits for it
+	* \return index to put in DrawItem::view
+	*/
+	unsigned int addView ( const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, OcclusionCuller * occlusion = NULL );
+	/** \param bounds [in] world space bounds of the object, NULL = it is never culled
+	* \return index to put in DrawItem::transform, items of one object share it
+	*/
+	unsigned int addTransform ( const glm::mat4 &modelMatrix, const glm::mat4 &normalMatrix, const BoundingBox * bounds = NULL );
+
+	/// Add the item, its sort key is computed from the state it needs.
+	void submit ( const DrawItem &item );
+
+	/** Drop the items of the objects outside of the frustum of their view, the objects are tested through a hierarchy of their bounds.
+	* The objects left are tested against the occluders of the view.
+	*/
+	void cull ( void );
+
+	/// Order the items by pass, then by state in the opaque pass and by submission in the blended ones.
+	void sort ( void );
+
+	const std::vector<DrawItem> &   drawItems ( void ) const { return items; }
+	const RenderView &              view ( unsigned int index ) const { return views[index]; }
+	const RenderTransform &         transform ( unsigned int index ) const { return transforms[index]; }
+	unsigned int                    transformCount ( void ) const { return (unsigned int)transforms.size(); }
+	const CullingStatistics &       cullingStatistics ( void ) const { return statistics; }
+
+private:
+	std::vector<DrawItem>         items;
+	std::vector<RenderView>       views;
+	std::vector<RenderTransform>  transforms;
+
+	// culling, kept to reuse the memory
+	BoundingVolumeHierarchy       hierarchy;
+	std::vector<BoundingBox>      cullBoxes;
+	std::vector<unsigned int>     cullTransforms;   // transform of each of cullBoxes
+	std::vector<unsigned int>     transformViews;
+	std::vector<unsigned char>    visibleBoxes;
+	std::vector<unsigned char>    visibleTransforms;
+	CullingStatistics             statistics;       // of the last cull()
+};
+
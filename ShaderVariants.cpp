@@ -0,0 +1,281 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "ShaderVariants.h"
+#include "ProgramCache.h"
+
+// macros tested by perFrag.fs, in the order of the ShaderFeature bits
+static const char * FEATURE_MACROS[] = { "DIRECT_LIGHT", "REFLECTOR_LIGHT", "FOG", "USE_TEXTURE" };
+
+static const unsigned int NUM_FEATURES = sizeof(FEATURE_MACROS) / sizeof(FEATURE_MACROS[0]);
+
+// sources shared by several shaders, prepended to them after their #version line and the defines, in this order
+typedef struct ShaderCommonSources
+{
+	const char *  shaderFile;
+	const char *  commonFiles[2];     // NULL = unused
+
+} ShaderCommonSources;
+
+static const ShaderCommonSources SHADER_COMMON_SOURCES[] = {
+	{ "perFrag.vs",           { "frameBlock.glsl", NULL } },
+	{ "indirect.vs",          { "frameBlock.glsl", NULL } },
+	{ "perFrag.fs",           { "frameBlock.glsl", "lighting.glsl" } },
+	{ "deferredLight.fs",     { "frameBlock.glsl", "lighting.glsl" } },
+	{ "deferredComposite.fs", { "frameBlock.glsl", "lighting.glsl" } },
+};
+static const unsigned int NUM_SHADER_COMMON_SOURCES = sizeof(SHADER_COMMON_SOURCES) / sizeof(SHADER_COMMON_SOURCES[0]);
+
+static const ShaderCommonSources * findCommonSources ( const char * shaderFile )
+{
+	for (unsigned int i = 0; i < NUM_SHADER_COMMON_SOURCES; i++)
+	{
+		if (strcmp(SHADER_COMMON_SOURCES[i].shaderFile, shaderFile) == 0)
+			return &SHADER_COMMON_SOURCES[i];
+	}
+
+	return NULL;
+}
+
+//============================================================================================================================
+
+std::string shaderVariantDefines ( unsigned int features )
+{
+	std::string defines;
+
+	for (unsigned int i = 0; i < NUM_FEATURES; i++)
+		defines += std::string("#define ") + FEATURE_MACROS[i] + ((features & (1u << i)) ? " true\n" : " false\n");
+
+	return defines;
+}
+
+bool shaderUsesFile ( const char * shaderFile, const std::string &fileName )
+{
+	if (fileName == shaderFile)
+		return true;
+
+	const ShaderCommonSources * common = findCommonSources(shaderFile);
+	if (common == NULL)
+		return false;
+
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		if (common->commonFiles[i] != NULL && fileName == common->commonFiles[i])
+			return true;
+	}
+
+	return false;
+}
+
+void commonShaderFiles ( std::vector<std::string> &files )
+{
+	for (unsigned int i = 0; i < NUM_SHADER_COMMON_SOURCES; i++)
+	{
+		for (unsigned int j = 0; j < 2; j++)
+		{
+			const char * fileName = SHADER_COMMON_SOURCES[i].commonFiles[j];
+			if (fileName != NULL && std::find(files.begin(), files.end(), fileName) == files.end())
+				files.push_back(fileName);
+		}
+	}
+}
+
+static bool readShaderFile ( const char * fileName, std::string &source )
+{
+	std::ifstream file(fileName, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "couldn't open shader " << fileName << std::endl;
+		return false;
+	}
+
+	std::stringstream contents;
+	contents << file.rdbuf();
+	source = contents.str();
+	return true;
+}
+
+// the source of the file with the defines and its common sources after its #version line, which has to stay the first one
+static bool loadShaderSource ( const char * fileName, const std::string &defines, std::string &source )
+{
+	if (!readShaderFile(fileName, source))
+		return false;
+
+	std::string prefix = defines;
+
+	const ShaderCommonSources * common = findCommonSources(fileName);
+	for (unsigned int i = 0; common != NULL && i < 2; i++)
+	{
+		if (common->commonFiles[i] == NULL)
+			continue;
+
+		std::string commonSource;
+		if (!readShaderFile(common->commonFiles[i], commonSource))
+			return false;
+
+		prefix += commonSource;
+		if (!commonSource.empty() && commonSource[commonSource.size() - 1] != '\n')
+			prefix += '\n';
+	}
+
+	if (prefix.empty())
+		return true;
+
+	size_t insertAt = 0;
+	const size_t version = source.find("#version");
+	if (version != std::string::npos)
+	{
+		const size_t lineEnd = source.find('\n', version);
+		insertAt = (lineEnd == std::string::npos) ? source.size() : lineEnd + 1;
+	}
+
+	source.insert(insertAt, prefix);
+	return true;
+}
+
+GLuint linkShaderProgram ( const char * vertexShaderFile, const char * fragmentShaderFile, const std::string &defines, GLuint attributesOf )
+{
+	std::string vertexSource;
+	std::string fragmentSource;
+	if (!loadShaderSource(vertexShaderFile, defines, vertexSource) || !loadShaderSource(fragmentShaderFile, defines, fragmentSource))
+		return 0;
+
+	// attribute locations to bind, "name=location" lines, they are linked into the program and so part of the cache key
+	std::vector<std::string> attributeNames;
+	std::vector<GLint> attributeLocations;
+	std::string attributes;
+
+	GLint numAttributes = 0;
+	if (attributesOf != 0)
+		glGetProgramiv(attributesOf, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+
+	for (GLint i = 0; i < numAttributes; i++)
+	{
+		char name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(attributesOf, i, sizeof(name), NULL, &size, &type, name);
+
+		GLint location = glGetAttribLocation(attributesOf, name);
+		if (location < 0)
+			continue;
+
+		std::ostringstream line;
+		line << name << "=" << location << "\n";
+		attributes += line.str();
+
+		attributeNames.push_back(name);
+		attributeLocations.push_back(location);
+	}
+
+	// unchanged sources on the same driver skip compiling and linking
+	const std::string cacheFileName = programCacheFileName(vertexShaderFile, fragmentShaderFile, defines);
+	const uint64_t sourceHash = programSourceHash(vertexSource, fragmentSource, attributes);
+
+	GLuint program = loadProgramBinary(cacheFileName, sourceHash);
+	if (program != 0)
+		return program;
+
+	GLuint shaders[2];
+	shaders[0] = pgr::createShaderFromSource(GL_VERTEX_SHADER, vertexSource);
+	shaders[1] = pgr::createShaderFromSource(GL_FRAGMENT_SHADER, fragmentSource);
+
+	if (shaders[0] == 0 || shaders[1] == 0)
+	{
+		std::cerr << "couldn't compile " << vertexShaderFile << " + " << fragmentShaderFile << std::endl;
+		glDeleteShader(shaders[0]);
+		glDeleteShader(shaders[1]);
+		return 0;
+	}
+
+	program = glCreateProgram();
+	glAttachShader(program, shaders[0]);
+	glAttachShader(program, shaders[1]);
+
+	for (size_t i = 0; i < attributeNames.size(); i++)
+		glBindAttribLocation(program, attributeLocations[i], attributeNames[i].c_str());
+
+	if (programCacheSupported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(program);
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE)
+	{
+		char log[4096];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		std::cerr << "couldn't link " << vertexShaderFile << " + " << fragmentShaderFile << ":\n" << log << std::endl;
+
+		pgr::deleteProgramAndShaders(program);
+		return 0;
+	}
+
+	saveProgramBinary(cacheFileName, sourceHash, program);
+	return program;
+}
+
+ShaderVariantCache::ShaderVariantCache ( const char * vertexFile, const char * fragmentFile ) :
+	vertexShaderFile(vertexFile), fragmentShaderFile(fragmentFile)
+{
+	for (unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++)
+	{
+		programs[i] = 0;
+		tried[i] = false;
+	}
+}
+
+ShaderVariantCache::~ShaderVariantCache ( )
+{
+	clear();
+}
+
+GLuint ShaderVariantCache::program ( unsigned int features, GLuint attributesOf )
+{
+	features %= NUM_SHADER_VARIANTS;
+
+	if (!tried[features])
+	{
+		programs[features] = linkShaderProgram(vertexShaderFile, fragmentShaderFile, shaderVariantDefines(features), attributesOf);
+		tried[features] = true;
+
+		if (programs[features] == 0)
+			std::cerr << "shader variant " << features << " of " << fragmentShaderFile << " failed, drawing with the generic program" << std::endl;
+	}
+
+	return programs[features];
+}
+
+bool ShaderVariantCache::uses ( const std::string &fileName ) const
+{
+	return shaderUsesFile(vertexShaderFile, fileName) || shaderUsesFile(fragmentShaderFile, fileName);
+}
+
+void ShaderVariantCache::clear ( void )
+{
+	for (unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++)
+	{
+		if (programs[i] != 0)
+			pgr::deleteProgramAndShaders(programs[i]);
+
+		programs[i] = 0;
+		tried[i] = false;
+	}
+}
+
+unsigned int ShaderVariantCache::linkedVariants ( void ) const
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++)
+	{
+		if (programs[i] != 0)
+			count++;
+	}
+
+	return count;
+}
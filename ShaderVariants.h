@@ -0,0 +1,80 @@
+/**
+* \file       ShaderVariants.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Programs of perFrag.fs specialized at compile time for the light switches and the material.
+*
+* perFrag.fs tests the DIRECT_LIGHT, REFLECTOR_LIGHT, FOG and USE_TEXTURE macros, which default to the FrameBlock
+* switches and the material flag. A variant defines each of them as true or false after the #version line of both of
+* its sources, so the compiler drops the branches and the light functions the variant does not use. Variants are linked
+* when their combination is drawn first and kept until one of their sources is reloaded.
+*
+* The FrameBlock (frameBlock.glsl) and the lights and fog of the forward and the deferred renderer (lighting.glsl) are
+* shared by several shaders. They are inserted after the defines of the shaders using them, so a change to them relinks
+* all of these programs.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "pgr.h"
+
+// features fixed by a variant, their combination is its index in the cache
+enum ShaderFeature
+{
+	SHADER_FEATURE_DIRECT_LIGHT = 1,
+	SHADER_FEATURE_REFLECTOR    = 2,
+	SHADER_FEATURE_FOG          = 4,
+	SHADER_FEATURE_TEXTURE      = 8
+};
+
+const unsigned int NUM_SHADER_VARIANTS = 16;
+
+/// One #define line per feature, true for the ones in the combination.
+std::string shaderVariantDefines ( unsigned int features );
+
+/// Whether the file is the shader itself or one of the common sources inserted into it.
+bool shaderUsesFile ( const char * shaderFile, const std::string &fileName );
+
+/// All common sources of the shaders, to be watched with them.
+void commonShaderFiles ( std::vector<std::string> &files );
+
+/** Compile the sources with the defines and their common sources after their #version lines and link them, or restore the program from its
+* binary cache file if the sources, the attribute locations and the driver did not change (ProgramCache.h).
+* \param defines empty for the generic program
+* \param attributesOf program whose attribute locations are bound, so that its vaos work with the new one, 0 = none
+* \return the program, 0 if compiling or linking failed
+*/
+GLuint linkShaderProgram ( const char * vertexShaderFile, const char * fragmentShaderFile, const std::string &defines, GLuint attributesOf );
+
+class ShaderVariantCache
+{
+public:
+	ShaderVariantCache ( const char * vertexShaderFile, const char * fragmentShaderFile );
+	~ShaderVariantCache ( );
+
+	/** Program of the combination, linked now if it was not drawn before.
+	* \param attributesOf generic program of the same sources, the variants share its vaos
+	* \return 0 if the variant failed to build, it is not tried again until clear()
+	*/
+	GLuint program ( unsigned int features, GLuint attributesOf );
+
+	/// Whether the file is one of the sources of the variants.
+	bool uses ( const std::string &fileName ) const;
+
+	/// Delete all variants, when a source changed.
+	void clear ( void );
+
+	unsigned int linkedVariants ( void ) const;
+
+private:
+	ShaderVariantCache ( const ShaderVariantCache & );
+	ShaderVariantCache & operator= ( const ShaderVariantCache & );
+
+	const char *  vertexShaderFile;
+	const char *  fragmentShaderFile;
+
+	GLuint        programs[NUM_SHADER_VARIANTS];
+	bool          tried[NUM_SHADER_VARIANTS];      // linked or failed since the last clear()
+};
@@ -0,0 +1,236 @@
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include "StaticBatch.h"
+#include "MeshData.h"
+#include "TextureManager.h"
+
+// part of the batch being collected, the material of its first source part
+typedef struct BatchPart
+{
+	SubMesh                    material;
+	std::vector<unsigned int>  indices;
+
+} BatchPart;
+
+//============================================================================================================================
+
+// GL_COPY_READ_BUFFER leaves the array buffer and the element buffer of the bound vao alone
+static void readBuffer ( GLuint buffer, std::vector<unsigned char> &data )
+{
+	GLint size = 0;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+
+	data.resize(size);
+	if (size > 0)
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, &data[0]);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void readBackGeometry ( const MeshGeometry * geometry, std::vector<float> &vertices, std::vector<unsigned int> &indices )
+{
+	std::vector<unsigned char> data;
+
+	readBuffer(geometry->vertexBufferObject, data);
+	const unsigned int numVertices = (unsigned int)(data.size() / geometry->vertexLayout.stride);
+	unpackVertexLayout(geometry->vertexLayout, data.empty() ? NULL : &data[0], numVertices, vertices);
+
+	readBuffer(geometry->elementBufferObject, data);
+	if (geometry->indexType == GL_UNSIGNED_SHORT)
+	{
+		indices.resize(data.size() / sizeof(GLushort));
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			GLushort index;
+			memcpy(&index, &data[i * sizeof(GLushort)], sizeof(index));
+			indices[i] = index;
+		}
+	}
+	else
+	{
+		indices.resize(data.size() / sizeof(GLuint));
+		if (!indices.empty())
+			memcpy(&indices[0], &data[0], indices.size() * sizeof(GLuint));
+	}
+}
+
+static bool sameBatchPart ( const SubMesh &a, const SubMesh &b )
+{
+	return a.lod == b.lod && a.texture == b.texture && a.stencilId == b.stencilId && a.shininess == b.shininess &&
+		a.ambient == b.ambient && a.diffuse == b.diffuse && a.specular == b.specular;
+}
+
+// level, then texture, then stencil ID, as the render queue orders the items anyway
+static bool batchPartLess ( const BatchPart &a, const BatchPart &b )
+{
+	if (a.material.lod != b.material.lod)
+		return a.material.lod < b.material.lod;
+	if (a.material.texture != b.material.texture)
+		return a.material.texture < b.material.texture;
+	return a.material.stencilId < b.material.stencilId;
+}
+
+MeshGeometry * createStaticBatch ( const std::vector<StaticBatchObject> &objects, const SCommonShaderProgram &shader )
+{
+	unsigned int numLods = 1;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].geometry != NULL)
+			numLods = std::max(numLods, objects[i].geometry->numLods);
+	}
+
+	std::vector<float> vertices;
+	std::vector<BatchPart> parts;
+
+	std::vector<float> objectVertices;
+	std::vector<unsigned int> objectIndices;
+
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const StaticBatchObject &object = objects[i];
+
+		// model which failed to load
+		if (object.geometry == NULL || object.geometry->subMeshes.empty())
+			continue;
+
+		readBackGeometry(object.geometry, objectVertices, objectIndices);
+
+		// vertices of all levels of the object are shared by its parts
+		const unsigned int firstVertex = (unsigned int)(vertices.size() / meshFloatsPerVertex);
+
+		for (size_t v = 0; v < objectVertices.size(); v += meshFloatsPerVertex)
+		{
+			const float * vertex = &objectVertices[v];
+
+			const glm::vec3 position = glm::vec3(object.modelMatrix * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+			glm::vec3 normal = glm::vec3(object.normalMatrix * glm::vec4(vertex[3], vertex[4], vertex[5], 0.0f));
+			if (glm::length(normal) > 0.0f)
+				normal = glm::normalize(normal);
+
+			const float transformed[meshFloatsPerVertex] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, vertex[6], vertex[7] };
+			vertices.insert(vertices.end(), transformed, transformed + meshFloatsPerVertex);
+		}
+
+		for (unsigned int lod = 0; lod < numLods; lod++)
+		{
+			const unsigned int objectLod = std::min(lod, object.geometry->numLods - 1);
+
+			for (size_t p = 0; p < object.geometry->subMeshes.size(); p++)
+			{
+				const SubMesh &subMesh = object.geometry->subMeshes[p];
+				if (subMesh.lod != objectLod)
+					continue;
+
+				SubMesh material = subMesh;
+				material.lod = lod;
+				material.stencilId = object.stencilId;
+
+				size_t part = 0;
+				while (part < parts.size() && !sameBatchPart(parts[part].material, material))
+					part++;
+
+				if (part == parts.size())
+				{
+					parts.push_back(BatchPart());
+					parts.back().material = material;
+				}
+
+				for (unsigned int index = subMesh.firstIndex; index < subMesh.firstIndex + subMesh.numIndices; index++)
+					parts[part].indices.push_back(firstVertex + objectIndices[index]);
+			}
+		}
+	}
+
+	if (parts.empty())
+		return NULL;
+
+	std::sort(parts.begin(), parts.end(), batchPartLess);
+
+	MeshGeometry * batch = new MeshGeometry();
+
+	std::vector<unsigned int> indices;
+	batch->subMeshes.resize(parts.size());
+
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		SubMesh &subMesh = batch->subMeshes[i];
+
+		subMesh = parts[i].material;
+		subMesh.firstIndex = (unsigned int)indices.size();
+		subMesh.numIndices = (unsigned int)parts[i].indices.size();
+
+		// the part holds its own reference, as the parts of the source models do
+		retainTexture(subMesh.texture);
+
+		indices.insert(indices.end(), parts[i].indices.begin(), parts[i].indices.end());
+	}
+
+	const unsigned int numVertices = (unsigned int)(vertices.size() / meshFloatsPerVertex);
+
+	std::vector<unsigned char> packedVertices;
+	VertexFormat format = packVertices(vertices, packedVertices);
+	if (!packedNormalsSupported())
+	{
+		packedVertices.resize(vertices.size() * sizeof(float));
+		memcpy(&packedVertices[0], &vertices[0], packedVertices.size());
+		format = VERTEX_FORMAT_FLOAT;
+	}
+
+	std::vector<unsigned char> packedIndices;
+	const unsigned int indexSize = packIndices(indices, numVertices, packedIndices);
+
+	batch->vertexLayout = vertexFormatLayout(format);
+	batch->indexType = indexSizeType(indexSize);
+	batch->numTriangles = (unsigned int)indices.size() / 3;
+	batch->numLods = numLods;
+
+	glGenBuffers(1, &(batch->vertexBufferObject));
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vertexBufferObject);
+	glBufferData(GL_ARRAY_BUFFER, packedVertices.size(), &packedVertices[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &(batch->elementBufferObject));
+
+	glGenVertexArrays(1, &(batch->vertexArrayObject));
+	glBindVertexArray(batch->vertexArrayObject);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->elementBufferObject);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.size(), &packedIndices[0], GL_STATIC_DRAW);
+
+	setupVertexAttributes(batch->vertexLayout, shader.posLocation, shader.normalLocation, shader.texCoordLocation);
+
+	glBindVertexArray(0);
+
+	createMaterialBlocks(batch);
+	CHECK_GL_ERROR();
+
+	// whole mesh material is the first part's one, textures are owned by the submeshes
+	batch->ambient = batch->subMeshes[0].ambient;
+	batch->diffuse = batch->subMeshes[0].diffuse;
+	batch->specular = batch->subMeshes[0].specular;
+	batch->shininess = batch->subMeshes[0].shininess;
+	batch->texture = 0;
+
+	glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+	for (size_t v = 0; v < vertices.size(); v += meshFloatsPerVertex)
+	{
+		boxMin = glm::min(boxMin, glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]));
+		boxMax = glm::max(boxMax, glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]));
+	}
+
+	batch->boundingBox.min = boxMin;
+	batch->boundingBox.max = boxMax;
+	batch->boundingCenter = 0.5f * (boxMin + boxMax);
+	batch->boundingRadius = 0.0f;
+	for (size_t v = 0; v < vertices.size(); v += meshFloatsPerVertex)
+		batch->boundingRadius = std::max(batch->boundingRadius, glm::length(glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]) - batch->boundingCenter));
+
+	std::cout << "Static batch: " << objects.size() << " objects, " << numVertices << " vertices, " << parts.size() << " parts in "
+		<< numLods << " LODs" << std::endl;
+
+	return batch;
+}
@@ -0,0 +1,39 @@
+/**
+* \file       StaticBatch.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Load-time merging of static objects into one pre-transformed mesh.
+*
+* The parts of all objects sharing a material, texture and stencil ID are merged into one part, so the batch
+* costs one draw call per material instead of a vao, transform and draw per object and part. Objects with
+* different stencil IDs never share a part, so picking still sees every pickable object.
+*/
+
+#pragma once
+#include <vector>
+
+#include "render_stuff.h"
+
+// object placed into the batch
+typedef struct StaticBatchObject
+{
+	const MeshGeometry *  geometry;
+	glm::mat4             modelMatrix;
+	glm::mat4             normalMatrix;
+	unsigned char         stencilId;
+
+} StaticBatchObject;
+
+/** Read the vertices and indices of uploaded geometry back from its buffers.
+* \param vertices [out] unpacked |x,y,z,nx,ny,nz,u,v|... of all levels of detail
+* \param indices [out] indices of all parts, see the index ranges of the submeshes
+*/
+void readBackGeometry ( const MeshGeometry * geometry, std::vector<float> &vertices, std::vector<unsigned int> &indices );
+
+/** Pre-transform the objects into one vertex and one index buffer. The vertices are read back from the buffers of
+* the objects, so any uploaded geometry can be batched. Level l of the batch holds level l of every object, or its
+* coarsest one if it has fewer levels.
+* \param shader [in] vao will connect the merged data to shader
+* \return geometry drawn with identity model matrix, NULL if there is nothing to merge
+*/
+MeshGeometry * createStaticBatch ( const std::vector<StaticBatchObject> &objects, const SCommonShaderProgram &shader );
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include "StreamBuffer.h"
+#include "GLCaps.h"
+
+// fence after the last draw of each frame in flight, 0 once waited for
+static GLsync frameFences[STREAM_FRAMES] = { 0 };
+static unsigned int streamFrame = 0;
+
+static unsigned int stalledFrames = 0;
+static unsigned int streamedFrames = 0;
+
+//============================================================================================================================
+
+bool persistentStreamingSupported ( void )
+{
+	static int supported = -1;
+
+	if (supported < 0)
+	{
+		supported = glVersionAtLeast(4, 4) ||
+			(glHasExtension("GL_ARB_buffer_storage") && (glVersionAtLeast(3, 2) || glHasExtension("GL_ARB_sync")));
+	}
+
+	return supported != 0;
+}
+
+bool streamedTextureBuffersSupported ( void )
+{
+	return persistentStreamingSupported() && (glVersionAtLeast(4, 3) || glHasExtension("GL_ARB_texture_buffer_range"));
+}
+
+void beginStreamFrame ( void )
+{
+	streamFrame++;
+	streamedFrames++;
+
+	GLsync &fence = frameFences[streamFrame % STREAM_FRAMES];
+	if (fence == 0)
+		return;
+
+	// the commands are flushed by the swap normally, the flush bit only matters if the GPU is that far behind
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		stalledFrames++;
+		do
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		while (result == GL_TIMEOUT_EXPIRED);
+	}
+
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+void endStreamFrame ( void )
+{
+	if (!persistentStreamingSupported())
+		return;
+
+	GLsync &fence = frameFences[streamFrame % STREAM_FRAMES];
+	if (fence != 0)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void cleanupStreamFrames ( void )
+{
+	for (unsigned int i = 0; i < STREAM_FRAMES; i++)
+	{
+		if (frameFences[i] != 0)
+			glDeleteSync(frameFences[i]);
+		frameFences[i] = 0;
+	}
+}
+
+void printStreamStatistics ( void )
+{
+	std::cout << "Streaming: " << (persistentStreamingSupported() ? "persistent mapping" : "orphaning") << ", " << stalledFrames
+		<< " of " << streamedFrames << " frames waited for the GPU" << std::endl;
+}
+
+StreamBuffer::StreamBuffer ( GLenum target, GLsizeiptr frameSize, GLsizeiptr alignment ) :
+	target(target), name(0), partSize(0), alignment(std::max<GLsizeiptr>(alignment, 4)), mapped(NULL), cursor(0), frame(0)
+{
+	create(frameSize);
+}
+
+StreamBuffer::~StreamBuffer ( )
+{
+	release();
+}
+
+void StreamBuffer::create ( GLsizeiptr frameSize )
+{
+	release();
+
+	partSize = (std::max<GLsizeiptr>(frameSize, 1) + alignment - 1) / alignment * alignment;
+	const GLsizeiptr size = partSize * STREAM_FRAMES;
+
+	glGenBuffers(1, &name);
+	glBindBuffer(target, name);
+
+	if (persistentStreamingSupported())
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, size, NULL, flags);
+		mapped = (unsigned char *)glMapBufferRange(target, 0, size, flags);
+
+		// the storage is immutable, a buffer written with glBufferSubData() needs a new name
+		if (mapped == NULL)
+		{
+			std::cerr << "Stream buffer: could not map " << size << " bytes persistently, orphaning instead" << std::endl;
+			glDeleteBuffers(1, &name);
+			glGenBuffers(1, &name);
+			glBindBuffer(target, name);
+		}
+	}
+
+	if (mapped == NULL)
+		glBufferData(target, size, NULL, GL_STREAM_DRAW);
+
+	glBindBuffer(target, 0);
+	CHECK_GL_ERROR();
+
+	frame = streamFrame;
+	cursor = (mapped != NULL) ? (streamFrame % STREAM_FRAMES) * partSize : 0;
+}
+
+void StreamBuffer::release ( void )
+{
+	// deleting unmaps it, the draws already issued keep the storage until they are done
+	if (name != 0)
+		glDeleteBuffers(1, &name);
+
+	name = 0;
+	mapped = NULL;
+}
+
+GLintptr StreamBuffer::write ( const void * data, GLsizeiptr size )
+{
+	const GLsizeiptr alignedSize = (size + alignment - 1) / alignment * alignment;
+
+	if (mapped != NULL)
+	{
+		const GLintptr part = (streamFrame % STREAM_FRAMES) * partSize;
+
+		if (frame != streamFrame)
+		{
+			frame = streamFrame;
+			cursor = part;
+		}
+
+		// the frame outgrew its part, the rest of it goes to a larger buffer, which create() may not be able to map
+		if (cursor + size > part + partSize)
+			create(std::max(2 * partSize, alignedSize));
+	}
+
+	if (mapped != NULL)
+		memcpy(mapped + cursor, data, size);
+	else
+	{
+		glBindBuffer(target, name);
+
+		// wrapping around: a fresh buffer, the driver keeps the old one until the GPU is done with it
+		if (cursor + size > partSize * STREAM_FRAMES)
+		{
+			partSize = std::max(partSize, alignedSize);
+			glBufferData(target, partSize * STREAM_FRAMES, NULL, GL_STREAM_DRAW);
+			cursor = 0;
+		}
+
+		glBufferSubData(target, cursor, size, data);
+	}
+
+	const GLintptr offset = cursor;
+	cursor += alignedSize;
+
+	return offset;
+}
@@ -0,0 +1,70 @@
+/**
+* \file       StreamBuffer.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Ring buffers for the data written anew every frame, persistently mapped and fenced when the context can.
+*
+* Every stream buffer is split into STREAM_FRAMES parts and each frame writes only into its own part, straight into
+* the mapped memory. Before a part is written again the frame that used it last is waited for with its fence, which
+* with triple buffering normally passed long ago. Contexts without GL_ARB_buffer_storage write with glBufferSubData()
+* and orphan the buffer when it is full instead.
+*/
+
+#pragma once
+#include "pgr.h"
+
+// frames the CPU may be ahead of the GPU, each of them writes its own part of every stream buffer
+const unsigned int STREAM_FRAMES = 3;
+
+/// GL 4.4, or buffer storage and sync objects as extensions.
+bool persistentStreamingSupported ( void );
+
+/// Persistent streaming and glTexBufferRange(), texture buffers can then show the range written in this frame.
+bool streamedTextureBuffersSupported ( void );
+
+/// Wait until the GPU is done with the parts of the stream buffers this frame is going to write, before the first write of the frame.
+void beginStreamFrame ( void );
+
+/// Fence the commands of the frame, after its last draw.
+void endStreamFrame ( void );
+
+/// Delete the fences of the frames in flight.
+void cleanupStreamFrames ( void );
+
+/// Print how many frames had to wait for the GPU to release their part of the stream buffers.
+void printStreamStatistics ( void );
+
+class StreamBuffer
+{
+public:
+	/**
+	* \param target buffer target the data is written through, e.g. GL_UNIFORM_BUFFER
+	* \param frameSize bytes one frame writes usually, the buffer grows when a frame needs more
+	* \param alignment of the offsets returned by write(), e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	*/
+	StreamBuffer ( GLenum target, GLsizeiptr frameSize, GLsizeiptr alignment );
+	~StreamBuffer ( );
+
+	/** Copy the data into the part of the current frame.
+	* \return offset of the data in buffer(), the buffer may be replaced by the next write() when the frame outgrows its part
+	*/
+	GLintptr write ( const void * data, GLsizeiptr size );
+
+	GLuint buffer ( void ) const { return name; }
+	bool persistent ( void ) const { return mapped != NULL; }
+
+private:
+	StreamBuffer ( const StreamBuffer & );
+	StreamBuffer & operator= ( const StreamBuffer & );
+
+	void create ( GLsizeiptr frameSize );
+	void release ( void );
+
+	GLenum           target;
+	GLuint           name;
+	GLsizeiptr       partSize;       // bytes of one frame, the buffer holds STREAM_FRAMES of them
+	GLsizeiptr       alignment;
+	unsigned char *  mapped;         // whole buffer, NULL if it is written with glBufferSubData()
+	GLintptr         cursor;         // next free byte
+	unsigned int     frame;          // of the last write, a new frame starts at the beginning of its part
+};
@@ -0,0 +1,559 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cmath>
+
+#include "TextureCache.h"
+#include "MeshCache.h"
+#include "GLCaps.h"
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+// keys of our entries in the key/value data
+static const char KTX_KEY_VERSION[] = "CookedVersion";
+static const char KTX_KEY_SOURCE[] = "CookedSource";
+
+typedef struct KtxHeader
+{
+	unsigned char  identifier[12];
+	uint32_t       endianness;
+	uint32_t       glType;                 // 0 for compressed data
+	uint32_t       glTypeSize;
+	uint32_t       glFormat;               // 0 for compressed data
+	uint32_t       glInternalFormat;
+	uint32_t       glBaseInternalFormat;
+	uint32_t       pixelWidth;
+	uint32_t       pixelHeight;
+	uint32_t       pixelDepth;
+	uint32_t       numberOfArrayElements;
+	uint32_t       numberOfFaces;
+	uint32_t       numberOfMipmapLevels;
+	uint32_t       bytesOfKeyValueData;
+
+} KtxHeader;
+
+// invalidation key of the source image, value of the KTX_KEY_SOURCE entry
+typedef struct CookedSourceKey
+{
+	uint64_t  size;
+	uint64_t  mtime;
+	uint64_t  hash;
+
+} CookedSourceKey;
+
+//============================================================================================================================
+
+size_t compressedLevelSize ( GLenum format, int width, int height )
+{
+	const size_t blockBytes = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+	return ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+// next mip level by averaging 2x2 pixels, odd edges reuse their last pixel
+static void downsample ( const std::vector<unsigned char> &src, int width, int height, std::vector<unsigned char> &dst )
+{
+	const int dstWidth = std::max(1, width / 2);
+	const int dstHeight = std::max(1, height / 2);
+
+	dst.resize(dstWidth * dstHeight * 4);
+
+	for (int y = 0; y < dstHeight; y++)
+	{
+		const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+
+		for (int x = 0; x < dstWidth; x++)
+		{
+			const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+
+			for (int c = 0; c < 4; c++)
+			{
+				int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c]
+					+ src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+				dst[(y * dstWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+static unsigned short packRgb565 ( const float * color )
+{
+	int r = std::max(0, std::min(31, (int)(color[0] * 31.0f / 255.0f + 0.5f)));
+	int g = std::max(0, std::min(63, (int)(color[1] * 63.0f / 255.0f + 0.5f)));
+	int b = std::max(0, std::min(31, (int)(color[2] * 31.0f / 255.0f + 0.5f)));
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRgb565 ( unsigned short packed, int * color )
+{
+	color[0] = ((packed >> 11) & 31) * 255 / 31;
+	color[1] = ((packed >> 5) & 63) * 255 / 63;
+	color[2] = (packed & 31) * 255 / 31;
+}
+
+/** BC1 color block: endpoints at the extremes of the principal axis of the block colors, 2 bit index per pixel.
+* \param block [in] 16 RGBA pixels
+* \param out [out] 8 bytes
+*/
+static void encodeColorBlock ( const unsigned char * block, unsigned char * out )
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += block[i * 4 + c] / 16.0f;
+
+	float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+		covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+		covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+	}
+
+	// a few power iterations are enough to find the dominant direction
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float length = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+		if (length == 0.0f)
+			break;
+		axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+	}
+
+	float minProjection = 0.0f, maxProjection = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float projection = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+		minProjection = std::min(minProjection, projection);
+		maxProjection = std::max(maxProjection, projection);
+	}
+
+	const float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float endpoint0[3], endpoint1[3];
+	for (int c = 0; c < 3; c++)
+	{
+		endpoint0[c] = mean[c] + axis[c] * maxProjection / lengthSquared;
+		endpoint1[c] = mean[c] + axis[c] * minProjection / lengthSquared;
+	}
+
+	unsigned short color0 = packRgb565(endpoint0);
+	unsigned short color1 = packRgb565(endpoint1);
+
+	// color0 > color1 selects the four color mode, equal colors need no indices
+	if (color0 < color1)
+		std::swap(color0, color1);
+
+	unsigned int indices = 0;
+
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = INT_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (2 * i);
+		}
+	}
+
+	out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+	out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+	out[4] = indices & 0xFF; out[5] = (indices >> 8) & 0xFF; out[6] = (indices >> 16) & 0xFF; out[7] = indices >> 24;
+}
+
+/** BC3 alpha block: the extreme alphas and 6 values between them, 3 bit index per pixel.
+* \param block [in] 16 RGBA pixels
+* \param out [out] 8 bytes
+*/
+static void encodeAlphaBlock ( const unsigned char * block, unsigned char * out )
+{
+	int alpha0 = 0, alpha1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		alpha0 = std::max(alpha0, (int)block[i * 4 + 3]);
+		alpha1 = std::min(alpha1, (int)block[i * 4 + 3]);
+	}
+
+	unsigned long long indices = 0;
+
+	if (alpha0 != alpha1)
+	{
+		int palette[8] = { alpha0, alpha1 };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int distance = abs(block[i * 4 + 3] - palette[p]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)alpha0;
+	out[1] = (unsigned char)alpha1;
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+static void compressLevel ( const std::vector<unsigned char> &pixels, int width, int height, GLenum format, unsigned char * out )
+{
+	unsigned char block[64];
+
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			// blocks of levels smaller than 4x4 repeat their edge pixels
+			for (int y = 0; y < 4; y++)
+			{
+				for (int x = 0; x < 4; x++)
+				{
+					const int sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+					memcpy(&block[(y * 4 + x) * 4], &pixels[(sy * width + sx) * 4], 4);
+				}
+			}
+
+			if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+			{
+				encodeAlphaBlock(block, out);
+				out += 8;
+			}
+			encodeColorBlock(block, out);
+			out += 8;
+		}
+	}
+}
+
+void compressImage ( DecodedImage &image )
+{
+	bool opaque = true;
+	for (size_t i = 3; i < image.pixels.size() && opaque; i += 4)
+		opaque = (image.pixels[i] == 255);
+
+	image.compressedFormat = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	image.numFaces = 1;
+	image.compressed.clear();
+	image.levelOffsets.clear();
+
+	std::vector<unsigned char> level, next;
+	level.swap(image.pixels);
+
+	int width = image.width, height = image.height;
+
+	// full chain down to 1x1, the same levels glGenerateMipmap would make
+	for (;;)
+	{
+		image.levelOffsets.push_back(image.compressed.size());
+		image.compressed.resize(image.compressed.size() + compressedLevelSize(image.compressedFormat, width, height));
+		compressLevel(level, width, height, image.compressedFormat, &image.compressed[image.levelOffsets.back()]);
+
+		if (width == 1 && height == 1)
+			break;
+
+		downsample(level, width, height, next);
+		level.swap(next);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+}
+
+//============================================================================================================================
+
+std::string textureCacheFileName ( const std::string &sourceFileName )
+{
+	return sourceFileName + ".ktx";
+}
+
+static size_t padTo4 ( size_t size )
+{
+	return (size + 3) & ~(size_t)3;
+}
+
+/** Load a cooked KTX file.
+* \param sourceFileNames [in] images the file was cooked from, one per face of a cube map
+*/
+static bool openKtx ( const std::string &cacheFileName, const std::string * sourceFileNames, unsigned int numSources, DecodedImage &image )
+{
+	MappedFile file;
+
+	if (!file.open(cacheFileName) || file.size() < sizeof(KtxHeader))
+		return false;
+
+	KtxHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS
+		|| (header.glInternalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && header.glInternalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		|| header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 || header.numberOfArrayElements != 0
+		|| (header.numberOfFaces != 1 && header.numberOfFaces != 6) || header.numberOfMipmapLevels == 0
+		|| sizeof(KtxHeader) + (size_t)header.bytesOfKeyValueData > file.size())
+	{
+		return false;
+	}
+
+	// our version and the source key have to be there and match
+	bool versionMatches = false;
+	bool sourceMatches = false;
+
+	size_t offset = sizeof(KtxHeader);
+	const size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+
+	while (offset + sizeof(uint32_t) <= keyValueEnd)
+	{
+		uint32_t entrySize;
+		memcpy(&entrySize, file.data() + offset, sizeof(entrySize));
+		offset += sizeof(entrySize);
+
+		if (offset + entrySize > keyValueEnd)
+			return false;
+
+		const char * key = (const char *)(file.data() + offset);
+		const size_t keyLength = strnlen(key, entrySize);
+		const unsigned char * value = file.data() + offset + keyLength + 1;
+		const size_t valueSize = (keyLength < entrySize) ? entrySize - keyLength - 1 : 0;
+
+		if (strcmp(key, KTX_KEY_VERSION) == 0 && valueSize == sizeof(uint32_t))
+		{
+			uint32_t version;
+			memcpy(&version, value, sizeof(version));
+			versionMatches = (version == TEXTURE_CACHE_VERSION);
+		}
+		else if (strcmp(key, KTX_KEY_SOURCE) == 0 && valueSize == numSources * sizeof(CookedSourceKey))
+		{
+			sourceMatches = true;
+			for (unsigned int i = 0; i < numSources && sourceMatches; i++)
+			{
+				CookedSourceKey source;
+				memcpy(&source, value + i * sizeof(source), sizeof(source));
+				sourceMatches = sourceFileUnchanged(sourceFileNames[i], source.size, source.mtime, source.hash);
+			}
+		}
+
+		offset += padTo4(entrySize);
+	}
+
+	if (!versionMatches || !sourceMatches)
+		return false;
+
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.pixels.clear();
+	image.compressedFormat = header.glInternalFormat;
+	image.numFaces = header.numberOfFaces;
+	image.compressed.clear();
+	image.levelOffsets.clear();
+
+	offset = keyValueEnd;
+	int width = image.width, height = image.height;
+
+	for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+	{
+		const size_t faceSize = compressedLevelSize(image.compressedFormat, width, height);
+
+		uint32_t imageSize;
+		if (offset + sizeof(imageSize) > file.size())
+			return false;
+		memcpy(&imageSize, file.data() + offset, sizeof(imageSize));
+		offset += sizeof(imageSize);
+
+		// block sizes are multiples of 4, there is no cube or mip padding
+		if (imageSize != faceSize || offset + faceSize * image.numFaces > file.size())
+			return false;
+
+		image.levelOffsets.push_back(image.compressed.size());
+		image.compressed.insert(image.compressed.end(), file.data() + offset, file.data() + offset + faceSize * image.numFaces);
+		offset += faceSize * image.numFaces;
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+
+	return true;
+}
+
+static void writeKeyValue ( std::ofstream &out, const char * key, const void * value, uint32_t valueSize )
+{
+	const char padding[4] = { 0 };
+	const uint32_t entrySize = (uint32_t)strlen(key) + 1 + valueSize;
+
+	out.write((const char *)&entrySize, sizeof(entrySize));
+	out.write(key, strlen(key) + 1);
+	out.write((const char *)value, valueSize);
+	out.write(padding, padTo4(entrySize) - entrySize);
+}
+
+static bool writeKtx ( const std::string &cacheFileName, const std::string * sourceFileNames, unsigned int numSources, const DecodedImage &image )
+{
+	if (image.compressedFormat == 0)
+		return false;
+
+	std::vector<CookedSourceKey> sources(numSources);
+	for (unsigned int i = 0; i < numSources; i++)
+	{
+		if (!getSourceFileKey(sourceFileNames[i], sources[i].size, sources[i].mtime, sources[i].hash))
+			return false;
+	}
+
+	const uint32_t version = TEXTURE_CACHE_VERSION;
+
+	KtxHeader header;
+	memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.endianness = KTX_ENDIANNESS;
+	header.glType = 0;
+	header.glTypeSize = 1;
+	header.glFormat = 0;
+	header.glInternalFormat = image.compressedFormat;
+	header.glBaseInternalFormat = (image.compressedFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? GL_RGB : GL_RGBA;
+	header.pixelWidth = image.width;
+	header.pixelHeight = image.height;
+	header.pixelDepth = 0;
+	header.numberOfArrayElements = 0;
+	header.numberOfFaces = image.numFaces;
+	header.numberOfMipmapLevels = (uint32_t)image.levelOffsets.size();
+	header.bytesOfKeyValueData = (uint32_t)(sizeof(uint32_t) + padTo4(sizeof(KTX_KEY_VERSION) + sizeof(version))
+		+ sizeof(uint32_t) + padTo4(sizeof(KTX_KEY_SOURCE) + numSources * sizeof(CookedSourceKey)));
+
+	// write into a temporary file first so that an interrupted run never leaves a broken cooked file behind
+	const std::string tmpFileName = cacheFileName + ".tmp";
+
+	std::ofstream out(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "cannot write texture cache file: " << tmpFileName << std::endl;
+		return false;
+	}
+
+	out.write((const char *)&header, sizeof(header));
+	writeKeyValue(out, KTX_KEY_VERSION, &version, sizeof(version));
+	writeKeyValue(out, KTX_KEY_SOURCE, &sources[0], numSources * sizeof(CookedSourceKey));
+
+	int width = image.width, height = image.height;
+	for (size_t level = 0; level < image.levelOffsets.size(); level++)
+	{
+		// imageSize is the size of one face for cube maps
+		const uint32_t faceSize = (uint32_t)compressedLevelSize(image.compressedFormat, width, height);
+
+		out.write((const char *)&faceSize, sizeof(faceSize));
+		out.write((const char *)&image.compressed[image.levelOffsets[level]], (std::streamsize)faceSize * image.numFaces);
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	out.close();
+
+	if (!out)
+	{
+		std::cerr << "cannot write texture cache file: " << tmpFileName << std::endl;
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	std::remove(cacheFileName.c_str());
+	if (std::rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0)
+	{
+		std::remove(tmpFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool openTextureCache ( const std::string &sourceFileName, DecodedImage &image )
+{
+	return openKtx(textureCacheFileName(sourceFileName), &sourceFileName, 1, image);
+}
+
+bool writeTextureCache ( const std::string &sourceFileName, const DecodedImage &image )
+{
+	return writeKtx(textureCacheFileName(sourceFileName), &sourceFileName, 1, image);
+}
+
+bool buildCubeMap ( const DecodedImage faces[6], DecodedImage &cubeMap )
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (faces[i].compressedFormat == 0 || faces[i].compressedFormat != faces[0].compressedFormat || faces[i].numFaces != 1
+			|| faces[i].width != faces[0].width || faces[i].height != faces[0].height || faces[i].levelOffsets.size() != faces[0].levelOffsets.size())
+		{
+			return false;
+		}
+	}
+
+	cubeMap = DecodedImage();
+	cubeMap.width = faces[0].width;
+	cubeMap.height = faces[0].height;
+	cubeMap.compressedFormat = faces[0].compressedFormat;
+	cubeMap.numFaces = 6;
+
+	// KTX order, all faces of a level before the next level
+	int width = cubeMap.width, height = cubeMap.height;
+	for (size_t level = 0; level < faces[0].levelOffsets.size(); level++)
+	{
+		const size_t faceSize = compressedLevelSize(cubeMap.compressedFormat, width, height);
+
+		cubeMap.levelOffsets.push_back(cubeMap.compressed.size());
+		for (int i = 0; i < 6; i++)
+		{
+			const unsigned char * face = &faces[i].compressed[faces[i].levelOffsets[level]];
+			cubeMap.compressed.insert(cubeMap.compressed.end(), face, face + faceSize);
+		}
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+
+	return true;
+}
+
+bool openCubeMapCache ( const std::string &cacheFileName, const std::string faceFileNames[6], DecodedImage &cubeMap )
+{
+	return openKtx(cacheFileName, faceFileNames, 6, cubeMap) && cubeMap.numFaces == 6;
+}
+
+bool writeCubeMapCache ( const std::string &cacheFileName, const std::string faceFileNames[6], const DecodedImage &cubeMap )
+{
+	return cubeMap.numFaces == 6 && writeKtx(cacheFileName, faceFileNames, 6, cubeMap);
+}
+
+bool compressedTexturesSupported ( void )
+{
+	static int supported = -1;
+
+	if (supported < 0)
+		supported = glHasExtension("GL_EXT_texture_compression_s3tc") ? 1 : 0;
+
+	return supported == 1;
+}
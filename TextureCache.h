@@ -0,0 +1,79 @@
+/**
+* \file       TextureCache.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Block compressed textures with a baked mip chain, cooked into KTX files next to the source images.
+*
+* Images without alpha are stored as BC1 (DXT1, 4 bits per pixel), images with alpha as BC3 (DXT5,
+* 8 bits per pixel). The cooked file is a standard KTX 1.1 file, the invalidation key of the source
+* image is stored in its key/value data. Cube maps keep all six faces in one file.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "pgr.h"
+
+// the loader headers do not have to know the S3TC extension
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#endif
+
+// bump whenever the encoder or the stored data change, old files are then re-cooked
+// 2: images decoded with the origin at the lower left, version 1 files are upside down
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+// image ready for upload, either RGBA pixels of the base level or a block compressed mip chain
+typedef struct DecodedImage
+{
+	int                        width;
+	int                        height;
+	std::vector<unsigned char> pixels;            // 4 bytes (RGBA) per pixel, empty if the image is compressed
+
+	GLenum                     compressedFormat;  // GL_COMPRESSED_*_S3TC_*, 0 if not compressed
+	unsigned int               numFaces;          // 6 for cube maps, 1 otherwise
+	std::vector<unsigned char> compressed;        // level after level, faces one after another within a level
+	std::vector<size_t>        levelOffsets;      // where each level starts in compressed
+
+	DecodedImage() : width(0), height(0), compressedFormat(0), numFaces(1) {}
+
+} DecodedImage;
+
+/// Bytes of one face of a compressed mip level.
+size_t compressedLevelSize ( GLenum format, int width, int height );
+
+/// Build the mip chain of the RGBA pixels and block compress it, the pixels are dropped.
+void compressImage ( DecodedImage &image );
+
+/// Name of the cooked file belonging to the source image.
+std::string textureCacheFileName ( const std::string &sourceFileName );
+
+/** Load the cooked version of an image file if it is up to date.
+* \param sourceFileName [in] source image file (e.g. .png)
+* \param image [out] compressed mip chain
+* \return false if there is no cooked file or it does not match the source file any more
+*/
+bool openTextureCache ( const std::string &sourceFileName, DecodedImage &image );
+
+/// Cook a compressed image so that the next run can skip the decode and compression.
+bool writeTextureCache ( const std::string &sourceFileName, const DecodedImage &image );
+
+/// Join six compressed faces (+X, -X, +Y, -Y, +Z, -Z) of the same size and format into one cube map image.
+bool buildCubeMap ( const DecodedImage faces[6], DecodedImage &cubeMap );
+
+/** Load a cube map baked from six face images into one file (all faces and mips) if it is up to date.
+* \param cacheFileName [in] baked cube map file
+* \param faceFileNames [in] source images of the faces, any change of them invalidates the file
+*/
+bool openCubeMapCache ( const std::string &cacheFileName, const std::string faceFileNames[6], DecodedImage &cubeMap );
+
+/// Bake a cube map made by buildCubeMap() for the next run.
+bool writeCubeMapCache ( const std::string &cacheFileName, const std::string faceFileNames[6], const DecodedImage &cubeMap );
+
+/// True if the context can sample S3TC compressed textures. Call from the GL thread.
+bool compressedTexturesSupported ( void );
@@ -0,0 +1,293 @@
+#include <iostream>
+#include <map>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+
+#include "TextureManager.h"
+#include "AssetLoader.h"
+#include "MeshCache.h"
+
+typedef struct ManagedTexture
+{
+	GLuint        texture;
+	std::string   fileName;       // canonical path the texture was first loaded from
+	uint64_t      contentHash;
+	int           width;
+	int           height;
+	size_t        memory;         // bytes on the GPU with all mipmap levels
+	bool          compressed;
+	unsigned int  references;
+
+} ManagedTexture;
+
+static std::map<GLuint, ManagedTexture> textures;
+static std::map<std::string, GLuint>    texturesByPath;
+static std::map<uint64_t, GLuint>       texturesByContent;
+
+//============================================================================================================================
+
+// absolute path with forward slashes, so that "a/../b.png" and "b.png" are one image
+static std::string canonicalPath ( const std::string &fileName )
+{
+	std::string path = fileName;
+
+#ifdef _WIN32
+	char absolute[_MAX_PATH];
+	if (_fullpath(absolute, fileName.c_str(), _MAX_PATH) != NULL)
+		path = absolute;
+#else
+	char absolute[PATH_MAX];
+	if (realpath(fileName.c_str(), absolute) != NULL)
+		path = absolute;
+#endif
+
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		if (path[i] == '\\')
+			path[i] = '/';
+	}
+	return path;
+}
+
+bool uploadTextureImage ( GLenum target, const DecodedImage &image, unsigned int face )
+{
+	if (image.compressedFormat == 0)
+	{
+		glTexImage2D(target, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		return false;
+	}
+
+	// baked mip chain, straight from the cooked file
+	int width = image.width, height = image.height;
+	for (size_t level = 0; level < image.levelOffsets.size(); level++)
+	{
+		const size_t faceSize = compressedLevelSize(image.compressedFormat, width, height);
+
+		glCompressedTexImage2D(target, (GLint)level, image.compressedFormat, width, height, 0, (GLsizei)faceSize,
+			&image.compressed[image.levelOffsets[level] + face * faceSize]);
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return true;
+}
+
+bool replaceTextureImage ( GLenum target, const DecodedImage &image, unsigned int face )
+{
+	if (image.compressedFormat == 0)
+	{
+		glTexSubImage2D(target, 0, 0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		return false;
+	}
+
+	int width = image.width, height = image.height;
+	for (size_t level = 0; level < image.levelOffsets.size(); level++)
+	{
+		const size_t faceSize = compressedLevelSize(image.compressedFormat, width, height);
+
+		glCompressedTexSubImage2D(target, (GLint)level, 0, 0, width, height, image.compressedFormat, (GLsizei)faceSize,
+			&image.compressed[image.levelOffsets[level] + face * faceSize]);
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return true;
+}
+
+// (re)define all levels of the texture, its sampling parameters stay as they are
+static void uploadTexture ( GLuint texture, const DecodedImage &image )
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	if (uploadTextureImage(GL_TEXTURE_2D, image))
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levelOffsets.size() - 1);
+	else
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	CHECK_GL_ERROR();
+}
+
+static GLuint uploadTexture ( const DecodedImage &image )
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	uploadTexture(texture, image);
+
+	return texture;
+}
+
+static uint64_t imageContentHash ( const DecodedImage &image )
+{
+	const std::vector<unsigned char> &content = (image.compressedFormat != 0) ? image.compressed : image.pixels;
+	uint64_t contentHash = hashBytes(&content[0], content.size());
+	return contentHash ^ (((uint64_t)image.width << 32) | (uint64_t)image.height);
+}
+
+static size_t imageMemory ( const DecodedImage &image )
+{
+	// the mipmap chain adds one third to the uncompressed ones
+	return (image.compressedFormat != 0) ? image.compressed.size() : image.pixels.size() + image.pixels.size() / 3;
+}
+
+GLuint acquireTexture ( const std::string &fileName, AssetLoader * loader )
+{
+	const std::string path = canonicalPath(fileName);
+
+	std::map<std::string, GLuint>::iterator byPath = texturesByPath.find(path);
+	if (byPath != texturesByPath.end())
+	{
+		textures[byPath->second].references++;
+		return byPath->second;
+	}
+
+	DecodedImage image;
+
+	bool loaded = (loader != NULL) ? loader->takeImage(fileName, image) : loadImage(fileName, compressedTexturesSupported(), image);
+	if (!loaded)
+		return 0;
+
+	// same pixels under another path, e.g. a texture copied next to each model using it
+	const uint64_t contentHash = imageContentHash(image);
+
+	std::map<uint64_t, GLuint>::iterator byContent = texturesByContent.find(contentHash);
+	if (byContent != texturesByContent.end())
+	{
+		texturesByPath[path] = byContent->second;
+		textures[byContent->second].references++;
+		return byContent->second;
+	}
+
+	ManagedTexture managed;
+	managed.texture = uploadTexture(image);
+	managed.fileName = path;
+	managed.contentHash = contentHash;
+	managed.width = image.width;
+	managed.height = image.height;
+	managed.memory = imageMemory(image);
+	managed.compressed = (image.compressedFormat != 0);
+	managed.references = 1;
+
+	textures[managed.texture] = managed;
+	texturesByPath[path] = managed.texture;
+	texturesByContent[contentHash] = managed.texture;
+
+	return managed.texture;
+}
+
+bool retainTexture ( GLuint texture )
+{
+	std::map<GLuint, ManagedTexture>::iterator it = textures.find(texture);
+	if (it == textures.end())
+		return false;
+
+	it->second.references++;
+	return true;
+}
+
+void releaseTexture ( GLuint texture )
+{
+	if (texture == 0)
+		return;
+
+	std::map<GLuint, ManagedTexture>::iterator it = textures.find(texture);
+	if (it == textures.end())
+	{
+		glDeleteTextures(1, &texture);
+		return;
+	}
+
+	if (--it->second.references > 0)
+		return;
+
+	// forget every path which led to the texture
+	for (std::map<std::string, GLuint>::iterator path = texturesByPath.begin(); path != texturesByPath.end(); )
+	{
+		if (path->second == texture)
+			texturesByPath.erase(path++);
+		else
+			++path;
+	}
+
+	// a reloaded texture may have the same content as another one, which then owns the hash
+	std::map<uint64_t, GLuint>::iterator byContent = texturesByContent.find(it->second.contentHash);
+	if (byContent != texturesByContent.end() && byContent->second == texture)
+		texturesByContent.erase(byContent);
+	textures.erase(it);
+
+	glDeleteTextures(1, &texture);
+}
+
+bool reloadTexture ( const std::string &fileName )
+{
+	std::map<std::string, GLuint>::const_iterator byPath = texturesByPath.find(canonicalPath(fileName));
+	if (byPath == texturesByPath.end())
+		return false;
+
+	DecodedImage image;
+	if (!loadImage(fileName, compressedTexturesSupported(), image))
+	{
+		std::cerr << "couldn't reload texture " << fileName << ", keeping the old one" << std::endl;
+		return false;
+	}
+
+	ManagedTexture &managed = textures[byPath->second];
+
+	// users which got the texture by the same content keep sharing it, they are not told apart any more
+	std::map<uint64_t, GLuint>::iterator byContent = texturesByContent.find(managed.contentHash);
+	if (byContent != texturesByContent.end() && byContent->second == managed.texture)
+		texturesByContent.erase(byContent);
+
+	managed.contentHash = imageContentHash(image);
+	if (texturesByContent.find(managed.contentHash) == texturesByContent.end())
+		texturesByContent[managed.contentHash] = managed.texture;
+
+	managed.width = image.width;
+	managed.height = image.height;
+	managed.memory = imageMemory(image);
+	managed.compressed = (image.compressedFormat != 0);
+
+	uploadTexture(managed.texture, image);
+
+	std::cout << "Reloaded texture " << managed.fileName << std::endl;
+	return true;
+}
+
+void managedTextureFiles ( std::vector<std::string> &fileNames )
+{
+	fileNames.clear();
+
+	for (std::map<std::string, GLuint>::const_iterator it = texturesByPath.begin(); it != texturesByPath.end(); ++it)
+		fileNames.push_back(it->first);
+}
+
+size_t textureMemoryUsage ( void )
+{
+	size_t memory = 0;
+
+	for (std::map<GLuint, ManagedTexture>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+		memory += it->second.memory;
+
+	return memory;
+}
+
+void printTextureStatistics ( void )
+{
+	for (std::map<GLuint, ManagedTexture>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+	{
+		const ManagedTexture &managed = it->second;
+		std::cout << "Texture " << managed.fileName << ": " << managed.width << "x" << managed.height
+			<< (managed.compressed ? " BC, " : " RGBA, ") << managed.memory / 1024 << " KB, " << managed.references << " users" << std::endl;
+	}
+
+	std::cout << "Texture memory: " << textureMemoryUsage() / 1024 << " KB in " << textures.size() << " textures" << std::endl;
+}
@@ -0,0 +1,58 @@
+/**
+* \file       TextureManager.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Shared, reference counted 2D textures loaded from image files.
+*
+* Textures are looked up by the canonical path of the image first and by the hash of the decoded
+* pixels second, so an image referenced by several materials (or copied to several model directories)
+* is decoded and uploaded only once. Every acquireTexture() has to be paired with a releaseTexture().
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "pgr.h"
+#include "TextureCache.h"
+
+class AssetLoader;
+
+/** Mipmapped 2D texture of the image file, shared with all other users of the same image.
+* \param fileName [in] image file
+* \param loader [in] asset loader which may have the image decoded already, NULL = decode on this thread
+* \return texture name with one more reference, 0 if the image couldn't be loaded
+*/
+GLuint acquireTexture ( const std::string &fileName, AssetLoader * loader = NULL );
+
+/** Upload one face of the image to the bound texture.
+* \param target [in] GL_TEXTURE_2D or one of the cube map faces
+* \param face [in] face of a compressed cube map image
+* \return true if the whole mip chain was uploaded, otherwise only the base level was
+*/
+bool uploadTextureImage ( GLenum target, const DecodedImage &image, unsigned int face = 0 );
+
+/** Overwrite one face of the bound texture with an image of the size and format it was created with.
+* \return true if the whole mip chain was replaced, otherwise only the base level was and the mips have to be generated
+*/
+bool replaceTextureImage ( GLenum target, const DecodedImage &image, unsigned int face = 0 );
+
+/// Drop one reference, the texture is deleted with the last one. Textures not created by acquireTexture() are deleted right away.
+void releaseTexture ( GLuint texture );
+
+/// One more reference of a texture from acquireTexture(), for another owner of it. Returns false for other textures.
+bool retainTexture ( GLuint texture );
+
+/** Load the image again into the same texture name, so its users see the change without acquiring it again.
+* \return false if no texture was loaded from the file or the new image couldn't be loaded (the old one stays)
+*/
+bool reloadTexture ( const std::string &fileName );
+
+/// Canonical paths of all image files backing the textures, for watching them.
+void managedTextureFiles ( std::vector<std::string> &fileNames );
+
+/// GPU memory held by all textures, including their mipmaps.
+size_t textureMemoryUsage ( void );
+
+/// Print every texture with its size, memory and number of users.
+void printTextureStatistics ( void );
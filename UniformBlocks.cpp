@@ -0,0 +1,128 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "UniformBlocks.h"
+#include "StreamBuffer.h"
+
+// room for the transforms of one frame, grows with the scene
+static const GLsizeiptr TRANSFORM_FRAME_SIZE = 64 * 1024;
+
+static StreamBuffer * frameStream = NULL;
+static StreamBuffer * transformStream = NULL;
+
+// staging memory of the padded transforms, kept between frames
+static std::vector<unsigned char> transformStaging;
+
+//============================================================================================================================
+
+// 0 -> 0.5 -> 0 over every period, the pulse of the torches and the fog
+static float triangleWave ( float time, float period )
+{
+	const float t = time / period;
+	const float phase = t - std::floor(t);
+	return (phase < 0.5f) ? phase : 1.0f - phase;
+}
+
+void bindUniformBlocks ( GLuint program )
+{
+	static const char * names[] = { "FrameBlock", "MaterialBlock", "TransformBlock" };
+	static const GLuint bindings[] = { FRAME_BLOCK_BINDING, MATERIAL_BLOCK_BINDING, TRANSFORM_BLOCK_BINDING };
+
+	for (int i = 0; i < 3; i++)
+	{
+		GLuint index = glGetUniformBlockIndex(program, names[i]);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, bindings[i]);
+	}
+}
+
+GLsizeiptr uniformBlockStride ( GLsizeiptr blockSize )
+{
+	static GLint alignment = 0;
+
+	if (alignment == 0)
+	{
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, 16);
+	}
+
+	return (blockSize + alignment - 1) / alignment * alignment;
+}
+
+GLuint createMaterialBuffer ( const std::vector<MaterialBlock> &materials )
+{
+	const GLsizeiptr stride = uniformBlockStride(sizeof(MaterialBlock));
+	std::vector<unsigned char> data(materials.size() * stride, 0);
+
+	for (size_t i = 0; i < materials.size(); i++)
+		memcpy(&data[i * stride], &materials[i], sizeof(MaterialBlock));
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.empty() ? NULL : &data[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	return buffer;
+}
+
+void initializeUniformBuffers ( void )
+{
+	const GLsizeiptr alignment = uniformBlockStride(1);
+
+	frameStream = new StreamBuffer(GL_UNIFORM_BUFFER, sizeof(FrameBlock), alignment);
+	transformStream = new StreamBuffer(GL_UNIFORM_BUFFER, TRANSFORM_FRAME_SIZE, alignment);
+}
+
+void cleanupUniformBuffers ( void )
+{
+	delete frameStream;
+	delete transformStream;
+	frameStream = NULL;
+	transformStream = NULL;
+
+	cleanupStreamFrames();
+}
+
+void computeLightingConstants ( FrameBlock &frame )
+{
+	const glm::vec3 direction = glm::vec3(frame.Vmatrix * glm::vec4(frame.reflectorDirection, 0.0f));
+	frame.reflectorSpotDirection = (glm::length(direction) > 0.0f) ? glm::normalize(direction) : glm::vec3(0.0f, 0.0f, -1.0f);
+
+	frame.torchFlicker = 2.0f * triangleWave(frame.time, 1.8f) / 20.0f;
+
+	const float fogPulse = triangleWave(frame.time, 3.0f);
+	frame.fogParams = glm::vec4(0.25f + fogPulse / 10.0f, fogPulse / 30.0f, 0.0f, 0.0f);
+}
+
+void updateFrameBlock ( const FrameBlock &frame )
+{
+	const GLintptr offset = frameStream->write(&frame, sizeof(FrameBlock));
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameStream->buffer(), offset, sizeof(FrameBlock));
+}
+
+GLintptr uploadTransformBlocks ( const std::vector<TransformBlock> &transforms )
+{
+	const GLsizeiptr stride = uniformBlockStride(sizeof(TransformBlock));
+	const GLsizeiptr size = (GLsizeiptr)transforms.size() * stride;
+
+	if (size == 0)
+		return 0;
+
+	transformStaging.resize(size);
+	for (size_t i = 0; i < transforms.size(); i++)
+		memcpy(&transformStaging[i * stride], &transforms[i], sizeof(TransformBlock));
+
+	return transformStream->write(&transformStaging[0], size);
+}
+
+void bindTransformBlock ( GLintptr offset )
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, TRANSFORM_BLOCK_BINDING, transformStream->buffer(), offset, sizeof(TransformBlock));
+}
+
+void bindMaterialBlock ( GLuint buffer, GLintptr offset )
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, buffer, offset, sizeof(MaterialBlock));
+}
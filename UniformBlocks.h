@@ -0,0 +1,95 @@
+/**
+* \file       UniformBlocks.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      std140 uniform blocks of the lit program and the buffers feeding them.
+*
+* Frame constants go to one block updated once per frame, the materials of a mesh are stored in one
+* buffer created at load time and the frame block and the per draw transforms are written into stream buffers
+* (StreamBuffer.h), so a draw changes its uniforms with glBindBufferRange() only.
+*/
+
+#pragma once
+#include <vector>
+
+#include "pgr.h"
+
+// binding points of the blocks, the same in every program using them
+enum UniformBlockBinding
+{
+	FRAME_BLOCK_BINDING = 0,
+	MATERIAL_BLOCK_BINDING = 1,
+	TRANSFORM_BLOCK_BINDING = 2
+};
+
+// mirrors of the std140 blocks in frameBlock.glsl and perFrag.vs, vec3 takes 16 bytes unless a scalar follows it
+
+typedef struct FrameBlock
+{
+	glm::mat4  Vmatrix;                 // 0
+	glm::vec3  reflectorPosition;       // 64
+	float      padding0;
+	glm::vec3  reflectorDirection;      // 80
+	float      time;                    // 92
+	GLint      reflectOn;               // 96
+	GLint      dirLight;                // 100
+	GLint      fogOn;                   // 104
+	GLint      padding1;
+	glm::vec4  clusterParams;           // 112, see LightClusters::clusterParams()
+
+	// lighting constants, derived from the members above by computeLightingConstants()
+	glm::vec3  reflectorSpotDirection;  // 128, reflectorDirection in view space, normalized
+	float      torchFlicker;            // 140, added to every lit color
+	glm::vec4  fogParams;               // 144, density and brightening of the fog, zw unused
+
+} FrameBlock;
+
+typedef struct MaterialBlock
+{
+	glm::vec3  ambient;                 // 0
+	float      shininess;               // 12
+	glm::vec3  diffuse;                 // 16
+	GLint      useTexture;              // 28
+	glm::vec3  specular;                // 32
+	float      padding;
+
+} MaterialBlock;
+
+typedef struct TransformBlock
+{
+	glm::mat4  PVMmatrix;               // 0
+	glm::mat4  Mmatrix;                 // 64
+	glm::mat4  normalMatrix;            // 128
+
+} TransformBlock;
+
+/// Connect the blocks the program declares to their binding points, call after every (re)link.
+void bindUniformBlocks ( GLuint program );
+
+/// Size of one block rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, the stride of block arrays in buffers.
+GLsizeiptr uniformBlockStride ( GLsizeiptr blockSize );
+
+/** Static buffer with the blocks one after another, each at a multiple of uniformBlockStride().
+* \return buffer name, bind the i-th block at offset i * uniformBlockStride(sizeof(MaterialBlock))
+*/
+GLuint createMaterialBuffer ( const std::vector<MaterialBlock> &materials );
+
+void initializeUniformBuffers ( void );
+void cleanupUniformBuffers ( void );
+
+/// Fill the lighting constants of the frame from its view matrix, reflector and time, the shaders do not recompute them per fragment.
+void computeLightingConstants ( FrameBlock &frame );
+
+/// Upload the frame constants and bind them, once per frame.
+void updateFrameBlock ( const FrameBlock &frame );
+
+/** Append the transforms to the stream buffer, bind them before the next upload which may move the buffer.
+* \return offset of the first one, the others follow at uniformBlockStride(sizeof(TransformBlock))
+*/
+GLintptr uploadTransformBlocks ( const std::vector<TransformBlock> &transforms );
+
+/// Bind one transform uploaded by uploadTransformBlocks().
+void bindTransformBlock ( GLintptr offset );
+
+/// Bind one material of a buffer from createMaterialBuffer().
+void bindMaterialBlock ( GLuint buffer, GLintptr offset );
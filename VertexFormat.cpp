@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "VertexFormat.h"
+#include "MeshData.h"
+#include "GLCaps.h"
+
+//============================================================================================================================
+
+// float in [-1,1] to 10-bit signed normalized integer
+static unsigned int packSnorm10 ( float value )
+{
+	value = std::max(-1.0f, std::min(1.0f, value));
+	int packed = (int)floorf(value * 511.0f + 0.5f);
+	return (unsigned int)packed & 0x3FF;
+}
+
+static float unpackSnorm10 ( unsigned int bits )
+{
+	int value = (bits & 0x200) ? (int)(bits | ~0x3FFu) : (int)bits;
+	return std::max(-1.0f, value / 511.0f);
+}
+
+static unsigned short packUnorm16 ( float value )
+{
+	value = std::max(0.0f, std::min(1.0f, value));
+	return (unsigned short)floorf(value * 65535.0f + 0.5f);
+}
+
+VertexLayout vertexFormatLayout ( VertexFormat format )
+{
+	VertexLayout layout;
+
+	layout.positionOffset = 0;
+
+	switch (format)
+	{
+	case VERTEX_FORMAT_PACKED:
+		layout.stride = 20;
+		layout.normalOffset = 12;
+		layout.normalType = GL_INT_2_10_10_10_REV;
+		layout.texCoordOffset = 16;
+		layout.texCoordType = GL_UNSIGNED_SHORT;
+		break;
+
+	case VERTEX_FORMAT_PACKED_FLOAT_UV:
+		layout.stride = 24;
+		layout.normalOffset = 12;
+		layout.normalType = GL_INT_2_10_10_10_REV;
+		layout.texCoordOffset = 16;
+		layout.texCoordType = GL_FLOAT;
+		break;
+
+	case VERTEX_FORMAT_FLOAT:
+	default:
+		layout.stride = meshFloatsPerVertex * sizeof(float);
+		layout.normalOffset = 3 * sizeof(float);
+		layout.normalType = GL_FLOAT;
+		layout.texCoordOffset = 6 * sizeof(float);
+		layout.texCoordType = GL_FLOAT;
+		break;
+	}
+
+	return layout;
+}
+
+VertexFormat packVertices ( const std::vector<float> &vertices, std::vector<unsigned char> &packed )
+{
+	const size_t numVertices = vertices.size() / meshFloatsPerVertex;
+
+	// repeated textures need the full float range
+	bool texCoordsInUnitRange = true;
+	for (size_t i = 0; i < numVertices && texCoordsInUnitRange; i++)
+	{
+		const float * uv = &vertices[i * meshFloatsPerVertex + 6];
+		if (uv[0] < 0.0f || uv[0] > 1.0f || uv[1] < 0.0f || uv[1] > 1.0f)
+			texCoordsInUnitRange = false;
+	}
+
+	const VertexFormat format = texCoordsInUnitRange ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_PACKED_FLOAT_UV;
+	const VertexLayout layout = vertexFormatLayout(format);
+
+	packed.resize(numVertices * layout.stride);
+
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		const float * src = &vertices[i * meshFloatsPerVertex];
+		unsigned char * dst = &packed[i * layout.stride];
+
+		memcpy(dst + layout.positionOffset, src, 3 * sizeof(float));
+
+		// normalize again, the importer does not guarantee unit normals and the 10 bits are best used fully
+		float length = sqrtf(src[3] * src[3] + src[4] * src[4] + src[5] * src[5]);
+		if (length == 0.0f)
+			length = 1.0f;
+
+		unsigned int normal = packSnorm10(src[3] / length) | (packSnorm10(src[4] / length) << 10) | (packSnorm10(src[5] / length) << 20);
+		memcpy(dst + layout.normalOffset, &normal, sizeof(normal));
+
+		if (layout.texCoordType == GL_UNSIGNED_SHORT)
+		{
+			unsigned short uv[2] = { packUnorm16(src[6]), packUnorm16(src[7]) };
+			memcpy(dst + layout.texCoordOffset, uv, sizeof(uv));
+		}
+		else
+			memcpy(dst + layout.texCoordOffset, src + 6, 2 * sizeof(float));
+	}
+
+	return format;
+}
+
+void unpackVertices ( VertexFormat format, const void * packed, unsigned int numVertices, std::vector<float> &vertices )
+{
+	unpackVertexLayout(vertexFormatLayout(format), packed, numVertices, vertices);
+}
+
+void unpackVertexLayout ( const VertexLayout &layout, const void * packed, unsigned int numVertices, std::vector<float> &vertices )
+{
+	vertices.resize(numVertices * meshFloatsPerVertex);
+
+	for (unsigned int i = 0; i < numVertices; i++)
+	{
+		const unsigned char * src = (const unsigned char *)packed + i * layout.stride;
+		float * dst = &vertices[i * meshFloatsPerVertex];
+
+		memcpy(dst, src + layout.positionOffset, 3 * sizeof(float));
+
+		if (layout.normalType == GL_INT_2_10_10_10_REV)
+		{
+			unsigned int normal;
+			memcpy(&normal, src + layout.normalOffset, sizeof(normal));
+			dst[3] = unpackSnorm10(normal);
+			dst[4] = unpackSnorm10(normal >> 10);
+			dst[5] = unpackSnorm10(normal >> 20);
+		}
+		else
+			memcpy(dst + 3, src + layout.normalOffset, 3 * sizeof(float));
+
+		if (layout.texCoordType == GL_UNSIGNED_SHORT)
+		{
+			unsigned short uv[2];
+			memcpy(uv, src + layout.texCoordOffset, sizeof(uv));
+			dst[6] = uv[0] / 65535.0f;
+			dst[7] = uv[1] / 65535.0f;
+		}
+		else
+			memcpy(dst + 6, src + layout.texCoordOffset, 2 * sizeof(float));
+	}
+}
+
+unsigned int packIndices ( const std::vector<unsigned int> &indices, unsigned int numVertices, std::vector<unsigned char> &packed )
+{
+	if (numVertices >= 65536)
+	{
+		packed.resize(indices.size() * sizeof(unsigned int));
+		memcpy(&packed[0], &indices[0], packed.size());
+		return sizeof(unsigned int);
+	}
+
+	packed.resize(indices.size() * sizeof(unsigned short));
+	unsigned short * shortIndices = (unsigned short *)&packed[0];
+
+	for (size_t i = 0; i < indices.size(); i++)
+		shortIndices[i] = (unsigned short)indices[i];
+
+	return sizeof(unsigned short);
+}
+
+GLenum indexSizeType ( unsigned int indexSize )
+{
+	return (indexSize == sizeof(unsigned short)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+bool packedNormalsSupported ( void )
+{
+	static int supported = -1;
+
+	if (supported < 0)
+		supported = (glVersionAtLeast(3, 3) || glHasExtension("GL_ARB_vertex_type_2_10_10_10_rev")) ? 1 : 0;
+
+	return supported == 1;
+}
+
+void setupVertexAttributes ( const VertexLayout &layout, GLint posLocation, GLint normalLocation, GLint texCoordLocation )
+{
+	if (posLocation != -1)
+	{
+		glEnableVertexAttribArray(posLocation);
+		glVertexAttribPointer(posLocation, 3, GL_FLOAT, GL_FALSE, layout.stride, (void*)layout.positionOffset);
+	}
+
+	if (normalLocation != -1)
+	{
+		glEnableVertexAttribArray(normalLocation);
+		// packed type needs all 4 components, the shader uses only xyz
+		if (layout.normalType == GL_INT_2_10_10_10_REV)
+			glVertexAttribPointer(normalLocation, 4, GL_INT_2_10_10_10_REV, GL_TRUE, layout.stride, (void*)layout.normalOffset);
+		else
+			glVertexAttribPointer(normalLocation, 3, GL_FLOAT, GL_FALSE, layout.stride, (void*)layout.normalOffset);
+	}
+
+	if (texCoordLocation != -1)
+	{
+		glEnableVertexAttribArray(texCoordLocation);
+		glVertexAttribPointer(texCoordLocation, 2, layout.texCoordType, layout.texCoordType != GL_FLOAT, layout.stride, (void*)layout.texCoordOffset);
+	}
+}
@@ -0,0 +1,62 @@
+/**
+* \file       VertexFormat.h
+* \author     Jakub Neustadt
+* \date       2019
+* \brief      Interleaved vertex formats of the meshes, packing of the imported vertices and indices into them.
+*/
+
+#pragma once
+#include <vector>
+
+#include "pgr.h"
+
+// formats of the cooked meshes, the values are stored in the cooked files
+enum VertexFormat
+{
+	VERTEX_FORMAT_FLOAT = 0,           // float3 position, float3 normal,      float2 uv          (32 B)
+	VERTEX_FORMAT_PACKED = 1,          // float3 position, 10:10:10:2 normal,  unorm16x2 uv       (20 B)
+	VERTEX_FORMAT_PACKED_FLOAT_UV = 2  // float3 position, 10:10:10:2 normal,  float2 uv          (24 B)
+};
+
+// where and in which type the attributes are stored in one interleaved vertex
+typedef struct VertexLayout
+{
+	GLsizei  stride;
+
+	size_t   positionOffset;      // always 3 floats
+	size_t   normalOffset;
+	GLenum   normalType;          // GL_FLOAT (3 components) or GL_INT_2_10_10_10_REV (normalized)
+	size_t   texCoordOffset;
+	GLenum   texCoordType;        // GL_FLOAT or GL_UNSIGNED_SHORT (normalized)
+
+} VertexLayout;
+
+VertexLayout vertexFormatLayout ( VertexFormat format );
+
+/** Pack interleaved float vertices |x,y,z,nx,ny,nz,u,v|... into the most compact format able to hold them.
+* Texture coordinates go to 16 bits only if all of them lie in [0,1] (no texture repeat).
+* \param vertices [in] float vertices
+* \param packed [out] vertices in the returned format
+*/
+VertexFormat packVertices ( const std::vector<float> &vertices, std::vector<unsigned char> &packed );
+
+/// Convert packed vertices back to VERTEX_FORMAT_FLOAT.
+void unpackVertices ( VertexFormat format, const void * packed, unsigned int numVertices, std::vector<float> &vertices );
+
+/// Convert vertices of any layout (e.g. read back from a vertex buffer object) to VERTEX_FORMAT_FLOAT.
+void unpackVertexLayout ( const VertexLayout &layout, const void * packed, unsigned int numVertices, std::vector<float> &vertices );
+
+/** Store indices in 16 bits if the mesh has fewer than 65536 vertices, in 32 bits otherwise.
+* \param packed [out] index data
+* \return size of one index in bytes (2 or 4)
+*/
+unsigned int packIndices ( const std::vector<unsigned int> &indices, unsigned int numVertices, std::vector<unsigned char> &packed );
+
+/// GL type of indices of given size in bytes.
+GLenum indexSizeType ( unsigned int indexSize );
+
+/// True if the context can fetch GL_INT_2_10_10_10_REV vertex attributes. Call from the GL thread.
+bool packedNormalsSupported ( void );
+
+/// Enable and point the attributes of the currently bound vao to the currently bound vbo, -1 locations are skipped.
+void setupVertexAttributes ( const VertexLayout &layout, GLint posLocation, GLint normalLocation, GLint texCoordLocation );
@@ -0,0 +1,12 @@
+#version 140
+
+// one triangle covering the screen, drawn without vertex attributes
+smooth out vec2 screenCoord_v;
+
+void main ( void )
+{
+	vec2 corner = vec2((gl_VertexID == 1) ? 3.0 : -1.0, (gl_VertexID == 2) ? 3.0 : -1.0);
+
+	screenCoord_v = corner * 0.5 + 0.5;
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
@@ -0,0 +1,37 @@
+#version 140
+
+// last pass of the deferred renderer: the lit pixels with the fog of perFrag.fs (lighting.glsl), into the window
+
+// G-buffer of gbuffer.fs and its depth
+uniform sampler2D gAlbedoSampler;
+uniform sampler2D gDepthSampler;
+uniform mat4 inverseProjection;
+
+uniform sampler2D accumulationSampler;     // lit by deferredLight.fs
+
+smooth in vec2 screenCoord_v;
+
+out vec4 color_f;
+
+vec3 viewPosition ( float depth )
+{
+	vec4 position = inverseProjection * vec4(vec3(screenCoord_v, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	float depth = texture(gDepthSampler, screenCoord_v).r;
+
+	if (depth >= 1.0)
+		discard;
+
+	// position of the pixel, reconstructed from the depth
+	vec3 fragPositionCamera = viewPosition(depth);
+	color_f = texture(accumulationSampler, screenCoord_v);
+
+	// untextured materials are always fogged, like in perFrag.fs
+	bool textured = texture(gAlbedoSampler, screenCoord_v).a > 0.5;
+	if ( fogOn || !textured )
+		color_f = addFog ( color_f, fragPositionCamera );
+}
@@ -0,0 +1,67 @@
+#version 140
+
+// lighting pass of the deferred renderer: the G-buffer lit by the sun, the flashlight and the clustered point lights
+// of perFrag.fs (lighting.glsl), accumulated before the fog is added by deferredComposite.fs
+
+// G-buffer of gbuffer.fs and its depth
+uniform sampler2D gAlbedoSampler;
+uniform sampler2D gDepthSampler;
+uniform mat4 inverseProjection;
+
+uniform sampler2D gDiffuseSampler;
+uniform sampler2D gAmbientSampler;
+uniform sampler2D gSpecularSampler;
+
+smooth in vec2 screenCoord_v;
+
+out vec4 color_f;
+
+vec3 viewPosition ( float depth )
+{
+	vec4 position = inverseProjection * vec4(vec3(screenCoord_v, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+vec3 decodeNormal ( vec2 e )
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+void main()
+{
+	float depth = texture(gDepthSampler, screenCoord_v).r;
+
+	// background, the skybox is drawn over it later
+	if (depth >= 1.0)
+		discard;
+
+	vec4 albedo = texture(gAlbedoSampler, screenCoord_v);
+	vec4 diffuse = texture(gDiffuseSampler, screenCoord_v);
+	vec4 ambient = texture(gAmbientSampler, screenCoord_v);
+	vec4 specular = texture(gSpecularSampler, screenCoord_v);
+
+	// position and normal of the pixel, reconstructed from the G-buffer
+	vec3 fragPositionCamera = viewPosition(depth);
+	vec3 fragNormalCamera = decodeNormal(vec2(ambient.a, specular.a));
+
+	Material material = Material(ambient.rgb, diffuse.rgb, specular.rgb, diffuse.a, albedo.a > 0.5);
+
+	vec3 globalAmbientLight = vec3 ( 0.16f );
+	vec4 outputColor = vec4 ( material.ambient * globalAmbientLight, 0.0f );
+
+	if(dirLight)
+		outputColor += DirectLight(sun, material, fragPositionCamera, fragNormalCamera);
+
+	outputColor += vec4(ClusterLights(material, fragPositionCamera, fragNormalCamera), 0.0f);
+
+	// flicker of the two torches at the door, as in perFrag.fs
+	outputColor += torchFlicker;
+
+	if ( reflectOn )
+		outputColor += ReflectorLight(reflector, material, fragPositionCamera, fragNormalCamera);
+
+	color_f = material.useTexture ? outputColor * vec4(albedo.rgb, 1.0) : outputColor;
+}
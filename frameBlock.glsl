@@ -0,0 +1,15 @@
+// updated once per frame (UniformBlocks.h), inserted after the #version line of the shaders using it (ShaderVariants.cpp)
+layout(std140) uniform FrameBlock
+{
+	mat4  Vmatrix;
+	vec3  reflectorPosition;
+	vec3  reflectorDirection;
+	float time;
+	bool  reflectOn;
+	bool  dirLight;
+	bool  fogOn;
+	vec4  clusterParams;     // tiles per pixel, depth slice scale and bias
+	vec3  reflectorSpotDirection;   // lighting constants computed once per frame on the CPU
+	float torchFlicker;
+	vec4  fogParams;         // density and brightening of the fog
+};
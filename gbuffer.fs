@@ -0,0 +1,40 @@
+#version 140
+
+// lit meshes drawn by perFrag.vs into the G-buffer of the deferred renderer, shaded later by deferredLight.fs
+uniform sampler2D texSampler;
+
+// material of the part, from the MaterialBlock in perFrag.vs
+flat in vec3  materialAmbient_v;
+flat in vec3  materialDiffuse_v;
+flat in vec3  materialSpecular_v;
+flat in float materialShininess_v;
+flat in int   materialUseTexture_v;
+
+smooth in vec2 texCoord_v;
+smooth in vec3 fragPositionCamera;
+smooth in vec3 fragNormalCamera;
+flat in vec3 instanceTint;
+
+// the view space normal is split over the alpha of the ambient and specular targets
+out vec4 gAlbedo;      // texture color, alpha 1 if textured
+out vec4 gDiffuse;     // diffuse material, shininess
+out vec4 gAmbient;     // ambient material, octahedral normal x
+out vec4 gSpecular;    // specular material, octahedral normal y
+
+vec2 encodeNormal ( vec3 n )
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return (n.z >= 0.0) ? n.xy : folded;
+}
+
+void main()
+{
+	bool useTexture = materialUseTexture_v != 0;
+	vec2 normal = encodeNormal(normalize(fragNormalCamera));
+
+	gAlbedo = useTexture ? vec4(texture(texSampler, texCoord_v).rgb, 1.0) : vec4(1.0, 1.0, 1.0, 0.0);
+	gDiffuse = vec4(materialDiffuse_v * instanceTint, materialShininess_v);
+	gAmbient = vec4(materialAmbient_v * instanceTint, normal.x);
+	gSpecular = vec4(materialSpecular_v, normal.y);
+}
@@ -0,0 +1,74 @@
+#version 430
+
+in vec3 position;
+in vec3 normal;
+in vec2 texCoord;
+
+// index of the draw command, an instanced attribute advanced by the base instance of each command
+in uint drawIndex;
+
+// the FrameBlock comes from frameBlock.glsl
+
+uniform mat4 PVmatrix;
+
+// patched when the objects move
+struct ObjectData
+{
+  mat4  modelMatrix;
+  mat4  normalMatrix;
+};
+
+// one per command, the material of its mesh part, written once
+struct DrawData
+{
+  vec3  ambient;
+  float shininess;
+  vec3  diffuse;
+  int   useTexture;
+  vec3  specular;
+  uint  object;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectBuffer
+{
+  ObjectData objects[];
+};
+
+layout(std430, binding = 1) readonly buffer DrawBuffer
+{
+  DrawData draws[];
+};
+
+smooth out vec2 texCoord_v;
+smooth out vec3 fragPositionCamera;
+smooth out vec3 fragNormalCamera;
+flat out vec3 instanceTint;
+
+// material of the part for perFrag.fs
+flat out vec3  materialAmbient_v;
+flat out vec3  materialDiffuse_v;
+flat out vec3  materialSpecular_v;
+flat out float materialShininess_v;
+flat out int   materialUseTexture_v;
+
+void main ( void )
+{
+  DrawData draw = draws[drawIndex];
+  ObjectData object = objects[draw.object];
+
+  vec4 worldPosition = object.modelMatrix * vec4(position, 1.0);
+
+  fragPositionCamera = (Vmatrix * worldPosition).xyz;
+  fragNormalCamera = normalize((Vmatrix * object.normalMatrix * vec4(normal, 0.0)).xyz);
+  instanceTint = vec3(1.0);
+
+  materialAmbient_v = draw.ambient;
+  materialDiffuse_v = draw.diffuse;
+  materialSpecular_v = draw.specular;
+  materialShininess_v = draw.shininess;
+  materialUseTexture_v = draw.useTexture;
+
+  texCoord_v = texCoord;
+
+  gl_Position = PVmatrix * worldPosition;
+}
@@ -0,0 +1,149 @@
+// lights and fog shared by perFrag.fs and the deferred renderer, inserted after frameBlock.glsl (ShaderVariants.cpp)
+// position and normal are in the camera space
+
+struct Material 
+{          
+	vec3  ambient;           
+	vec3  diffuse;            
+	vec3  specular;           
+	float shininess;         
+	bool  useTexture;         
+};
+
+struct Light 
+{
+	vec3  ambient;
+	vec3  diffuse;
+	vec3  specular;
+
+	vec3  position;
+
+	vec3  spotDirection;
+	float spotCosCutOff;
+	float spotExponent;
+	vec3 attenuation;
+};
+
+// cluster grid of LightClusters.h
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 8;
+const int CLUSTER_Z = 24;
+
+// binned point lights, see LightClusters.h
+uniform samplerBuffer  lightSampler;
+uniform usamplerBuffer clusterSampler;
+uniform usamplerBuffer lightIndexSampler;
+
+vec4 ReflectorLight ( Light light, Material material, vec3 position, vec3 normal ) 
+{
+	vec3 spotPosition = vec3(0.0);
+	vec3 spotDirection = reflectorSpotDirection;
+
+	vec3 L = normalize(spotPosition - position);
+	vec3 R = reflect(-L, normal);
+	vec3 V = normalize(-position);
+
+	vec3 diffuse = max(dot(L,normalize(normal)), 0.0) * material.diffuse * light.diffuse;
+	vec3 specular = pow(max(dot(R,V), 0.0), material.shininess) * material.specular * light.specular;
+    vec3 ambient = light.ambient * material.ambient;
+
+	vec3 ret = diffuse + specular + ambient;
+
+	float alpha = dot(-L, spotDirection);
+	float coef = max(0.0, alpha);
+
+	if (coef < light.spotCosCutOff) 
+	{
+		ret *= 0.0;
+	}
+	else 
+	{
+		ret *= pow(coef, light.spotExponent);
+	}
+
+	float dist = distance(spotPosition, position);
+	float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y*dist + light.attenuation.z*pow(dist, 2.0));
+
+	ret *= attenuation;
+
+	return vec4(ret, 1.0);
+}
+
+vec4 DirectLight ( Light light, Material material, vec3 position, vec3 normal )
+{
+	 vec3 ret = vec3(0.0);
+
+	 vec3 L = normalize(light.position - position);
+	 vec3 R = reflect(-L, normal);
+	 vec3 V = normalize(-position);
+
+	 vec3 diffuse = max(dot(L,normalize(normal)),0) * material.diffuse * light.diffuse;
+	 vec3 specular = pow(max(dot(R,V),0), material.shininess) * material.specular * light.specular;
+	 vec3 ambient = light.ambient * material.ambient;
+
+	 ret += diffuse + specular + ambient;
+
+	 return vec4(ret, 1.0);
+}
+
+// light of the lightSampler, three texels: view space position and range, diffuse and specular, attenuation and ambient
+vec3 PointLight ( int light, Material material, vec3 position, vec3 normal ) 
+{
+	vec4 positionRange = texelFetch(lightSampler, light * 3);
+	vec4 diffuseSpecular = texelFetch(lightSampler, light * 3 + 1);
+	vec4 attenuationAmbient = texelFetch(lightSampler, light * 3 + 2);
+
+	vec3 lightPosCamera = positionRange.xyz;
+	float dist = distance(position, lightPosCamera);
+	if (dist >= positionRange.w)
+		return vec3(0.0);
+
+	vec3 L = normalize(lightPosCamera - position);
+	vec3 R = reflect(-L, normal);
+    vec3 V = normalize(-position);
+
+	vec3 diffuse = max(dot(L,normal),0) * material.diffuse * diffuseSpecular.rgb;
+    vec3 specular = pow(max(dot(R,V),0), material.shininess) * material.specular * diffuseSpecular.a;
+    vec3 ambient = attenuationAmbient.a * material.ambient;
+
+	vec3 attenuation = attenuationAmbient.xyz;
+	float falloff = 1.0f / (attenuation.x + attenuation.y * dist + attenuation.z * dist * dist);
+
+	// fades out towards the range the light was binned with instead of ending at a visible edge
+	float window = clamp(1.0f - pow(dist / positionRange.w, 4.0f), 0.0f, 1.0f);
+
+	return falloff * window * window * (diffuse + specular + ambient);
+}
+
+// the point lights binned into the cluster of the fragment
+vec3 ClusterLights ( Material material, vec3 position, vec3 normal )
+{
+	ivec3 cell = ivec3(gl_FragCoord.xy * clusterParams.xy, log(max(-position.z, 1e-4f)) * clusterParams.z + clusterParams.w);
+	cell = clamp(cell, ivec3(0), ivec3(CLUSTER_X - 1, CLUSTER_Y - 1, CLUSTER_Z - 1));
+
+	uvec2 cluster = texelFetch(clusterSampler, (cell.z * CLUSTER_Y + cell.y) * CLUSTER_X + cell.x).xy;
+
+	vec3 ret = vec3(0.0);
+	for (uint i = 0u; i < cluster.y; i++)
+		ret += PointLight(int(texelFetch(lightIndexSampler, int(cluster.x + i)).x), material, position, normal);
+
+	return ret;
+}
+
+// the point lights come from LightClusters, only the sun and the flashlight are fixed
+const Light sun = Light ( vec3(0.1f), vec3(0.55f), vec3(0.1f), vec3(1.0f, 1.0f, 0.0f), vec3(0.0f), 0.0f, 0.0f, vec3(1.0f, 0.0f, 0.0f) );
+const Light reflector = Light ( vec3(1.0f), vec3(2.0f), vec3(2.0f), vec3(0.0f), vec3(0.0f), 0.7f, 60.0f, vec3(0.0f, 0.15f, 0.03f) );
+
+vec4 addFog ( vec4 outputColor, vec3 position )
+{
+	float distance = length(position);
+	float gradient = 2.5f;
+
+	// the density and the brightening pulse with the time, computed once per frame
+	float blendFactor = exp(-pow((fogParams.x*distance),gradient));
+	blendFactor = clamp(blendFactor, 0.0f,1.0f);
+
+	outputColor = outputColor * blendFactor + (1-blendFactor)*vec4(0.8f);
+
+	return outputColor + fogParams.y;
+}
@@ -9,11 +9,16 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <chrono>
 
 #include "pgr.h"
 #include "render_stuff.h"
+#include "GLState.h"
+#include "StreamBuffer.h"
 #include "Camera.h"
 #include "Spline.h"
 
@@ -33,6 +38,9 @@
 #define WOODEN_DOOR_SIZE  2.2f
 #define GROUND_SIZE		  100.0f
 #define TREE_SIZE		  2.0f
+#define FOREST_TREES	  3000		// default of --forest
+#define BENCHMARK_FRAMES  1000		// default of --benchmark
+#define BENCHMARK_WARMUP  60		// frames drawn before the timing starts
 #define BANNER_SIZE		  1.0f
 #define FLAME_SIZE		  1.0f
 
@@ -51,11 +59,19 @@ extern BannerShaderProgram bannerShaderProgram;
 extern BannerShaderProgram animBannerShaderProgram;
 extern FlameShaderProgram flameShaderProgram;
 
+extern int forcedLod;
+extern bool indirectDrawing;
+extern bool deferredShading;
+extern bool shaderVariants;
+
 extern glm::vec3 curveData[];
 extern size_t curveSize;
 
 bool dirLight = true;
 
+// draw items of the current frame, kept to reuse its memory
+RenderQueue renderQueue;
+
 // global vars
 struct GameState
 {
@@ -98,15 +114,92 @@ Object * door;
 Object * openedDoor;
 Object * ground;
 Object * tree;
+Object * forest;
+
+// size of the window, set by --size WxH, e.g. 3840x2160 for fragment bound benchmarks
+int windowWidth = WIN_WIDTH;
+int windowHeight = WIN_HEIGHT;
+
+// number of instanced trees around the castle grounds, 0 = none, set by --forest
+unsigned int forestTrees = 0;
+
+// castle, table and ground drawn from one merged mesh, toggled by B for comparison
+bool staticBatching = true;
+
+// objects hidden behind the castle walls are not drawn, toggled by O for comparison
+bool occlusionCulling = true;
 
 Camera * player;
 
+// frames timed along the benchmark path, 0 = not benchmarking, set by --benchmark
+unsigned int benchmarkFrames = 0;
+unsigned int benchmarkFrame = 0;
+std::vector<double> benchmarkTimes;		// milliseconds between the finished frames
+std::chrono::steady_clock::time_point lastSwap;
+
+// closed camera path of --benchmark, from the entrance along the hall to the door and back
+const glm::vec3 benchmarkPath[] = {
+	glm::vec3 ( -1.0f, 0.0f,   2.0f ),
+	glm::vec3 (  3.0f, 0.0f,  -4.0f ),
+	glm::vec3 (  5.0f, 0.0f, -10.0f ),
+	glm::vec3 (  6.0f, 0.0f, -17.0f ),
+	glm::vec3 (  2.0f, 0.0f, -15.0f ),
+	glm::vec3 ( -3.0f, 0.0f, -11.0f ),
+	glm::vec3 ( -5.0f, 0.0f,  -4.0f ),
+};
+const size_t benchmarkPathSize = sizeof(benchmarkPath) / sizeof(benchmarkPath[0]);
+
 Object * banner;
 Object * animBanner;
 FlameObject * flame;
 
 //========================================================================
 
+// camera of the benchmark frame, one lap of the path over the timed frames, the warm-up at its start
+void placeBenchmarkCamera ( void )
+{
+	const unsigned int timedFrame = ( benchmarkFrame > BENCHMARK_WARMUP ) ? benchmarkFrame - BENCHMARK_WARMUP : 0;
+	const float t = (float)benchmarkPathSize * timedFrame / benchmarkFrames;
+
+	player->freeMovement = false;
+	player->cameraPos = evaluateClosedCurve ( benchmarkPath, benchmarkPathSize, t );
+	player->cameraDir = glm::normalize ( evaluateClosedCurve_1stDerivative ( benchmarkPath, benchmarkPathSize, t ) );
+}
+
+// time the frame just swapped, print the statistics and quit after the last one
+void recordBenchmarkFrame ( void )
+{
+	// the frame is timed when the GPU finished it, not when its commands were queued
+	glFinish();
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	if ( benchmarkFrame > BENCHMARK_WARMUP )
+		benchmarkTimes.push_back ( std::chrono::duration<double, std::milli>( now - lastSwap ).count() );
+	lastSwap = now;
+
+	if ( ++benchmarkFrame <= BENCHMARK_WARMUP + benchmarkFrames )
+	{
+		glutPostRedisplay();
+		return;
+	}
+
+	std::vector<double> sorted = benchmarkTimes;
+	std::sort ( sorted.begin(), sorted.end() );
+
+	double total = 0.0;
+	for ( size_t i = 0; i < sorted.size(); i++ )
+		total += sorted[i];
+
+	std::cout << "Benchmark: " << ( deferredShadingActive() ? "deferred" : "forward" ) << " shading, "
+		<< gameState.windowWidth << "x" << gameState.windowHeight << ", " << sorted.size() << " frames on " << glGetString(GL_RENDERER) << std::endl;
+	std::cout << "  average " << total / sorted.size() << " ms, median " << sorted[sorted.size() / 2]
+		<< " ms, 95th percentile " << sorted[sorted.size() * 95 / 100] << " ms, slowest " << sorted.back() << " ms" << std::endl;
+
+	benchmarkFrames = 0;
+	glutLeaveMainLoop();
+}
+
 void drawWindowContents ( void )
 {
 	glm::mat4 orthoProjectionMatrix = glm::ortho(
@@ -124,6 +217,9 @@ void drawWindowContents ( void )
 	glm::mat4 viewMatrix = orthoViewMatrix;
 	glm::mat4 projectionMatrix = orthoProjectionMatrix;
 
+	if ( benchmarkFrames > 0 )
+		placeBenchmarkCamera();
+
 	glm::vec3 cameraPosition = player->cameraPos;
 	glm::vec3 cameraCenter = player->cameraDir + cameraPosition;
 	glm::vec3 cameraUpVector = glm::vec3(0.0f, 1.0f, 0.0f);
@@ -150,97 +246,87 @@ void drawWindowContents ( void )
 	//											FOVy				         aspect ratio								   near  far
 	projectionMatrix = glm::perspective(glm::radians(70.0f), (float)gameState.windowWidth / (float)gameState.windowHeight, 0.1f, 100.0f);
 
-	glUseProgram(shaderProgram.program);
-	glUniform1f(shaderProgram.timeLocation, gameState.elapsedTime);
-	glUniform3fv(shaderProgram.reflectorPositionLocation, 1, glm::value_ptr(player->cameraPos));
-	glUniform3fv(shaderProgram.reflectorDirectionLocation, 1, glm::value_ptr(cameraCenter - player->cameraPos));
-	glUniform1i(shaderProgram.reflectorLocation, player->spotlightOn);
+	// turn on directional light 
+	dirLight = true;
 
-	dirLight = false;
-	glUniform1i(shaderProgram.dirLightLocation, dirLight);
-	glUniform1i(shaderProgram.fogLocation, gameState.fog);
-	//glUniform1iv(shaderProgram.fireLocation, 1, true);
-	glUseProgram(0);
+	// per frame uniforms in one block, the per object ones are bound by the render queue
+	FrameBlock frame;
+	frame.Vmatrix = viewMatrix;
+	frame.reflectorPosition = player->cameraPos;
+	frame.padding0 = 0.0f;
+	frame.reflectorDirection = cameraCenter - player->cameraPos;
+	frame.time = gameState.elapsedTime;
+	frame.reflectOn = player->spotlightOn;
+	frame.dirLight = dirLight;
+	frame.fogOn = gameState.fog;
+	frame.padding1 = 0;
+	frame.clusterParams = updateLightClusters(viewMatrix, projectionMatrix, 0.1f, 100.0f, gameState.windowWidth, gameState.windowHeight);
+	computeLightingConstants(frame);
+	updateFrameBlock(frame);
+	setFrameShaderFeatures(frame.dirLight != 0, frame.reflectOn != 0, frame.fogOn != 0);
+
+	cachedUseProgram(skyboxShaderProgram.program);
+	glUniform1i(skyboxShaderProgram.fogOnLocation, gameState.fog);
 
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	CHECK_GL_ERROR();
+	// the walls are rasterized on the worker thread while the objects are submitted
+	OcclusionCuller * occlusion = NULL;
+	if ( occlusionCulling )
+		occlusion = startOcclusionCulling ( projectionMatrix * viewMatrix );
 
-	// turn on directional light 
-	dirLight = true;
-	glUseProgram(shaderProgram.program);
-	glUniform1i(shaderProgram.dirLightLocation, dirLight);
+	renderQueue.clear();
+	const unsigned int sceneView = renderQueue.addView(viewMatrix, projectionMatrix, occlusion);
+	const unsigned int overlayView = renderQueue.addView(orthoViewMatrix, orthoProjectionMatrix);
 
-	// draw interactable wand
-	glStencilFunc(GL_ALWAYS, 1, 255);
+	// interactable wand
 	if ( !gameState.wandGrabbed )
-		drawWand ( wand, viewMatrix, projectionMatrix );
-	CHECK_GL_ERROR();
+		submitWand ( renderQueue, wand, sceneView, 1 );
 
-	// draw interactable cauldron
-	glStencilFunc(GL_ALWAYS, 2, 255);
+	// interactable cauldron
 	if ( gameState.engorgio )
 	{
 		cauldron->size *= 5.0f;
 		cauldron->position += 1.0f;
+		cauldron->transformDirty = true;
 		gameState.engorgio = false;
 	}
-	drawCauldron ( cauldron, viewMatrix, projectionMatrix );
-	CHECK_GL_ERROR();
+	submitCauldron ( renderQueue, cauldron, sceneView, 2 );
 
-	// draw interactable door
-	glStencilFunc(GL_ALWAYS, 3, 255);
+	// interactable door
 	if ( !gameState.alohomora )
 	{
-		drawDoor ( door, viewMatrix, projectionMatrix );
+		submitDoor ( renderQueue, door, sceneView, 3 );
 	}
 	else
-		drawOpenedDoor ( openedDoor, viewMatrix, projectionMatrix );
-	CHECK_GL_ERROR();
+		submitOpenedDoor ( renderQueue, openedDoor, sceneView, 3 );
 
-	// draw interactable tree
+	// interactable tree
 	/*
-	glStencilFunc ( GL_ALWAYS, 4, 255 );
-	drawTree ( tree, viewMatrix, projectionMatrix );
-	CHECK_GL_ERROR();
+	submitTree ( renderQueue, tree, sceneView, 4 );
 	*/
 
-	// po vykresleni objektu s kterym interaguju disable stencil test
-	glDisable(GL_STENCIL_TEST);
-
-	drawCastle ( castle, viewMatrix, projectionMatrix );
-	drawTable ( table, viewMatrix, projectionMatrix );
-	drawBroom ( broom, viewMatrix, projectionMatrix );
-	CHECK_GL_ERROR();
-
-	glUseProgram(0);
-
-	dirLight = false;
-	glUseProgram(skyboxShaderProgram.program);
-	glUniform1i(skyboxShaderProgram.fogOnLocation, gameState.fog);
-	drawSkybox(viewMatrix, projectionMatrix);
-	CHECK_GL_ERROR();
-
-	glUseProgram(0);
-
-	// turn on directional light 
-	dirLight = true;
-	glUseProgram(shaderProgram.program);
-	glUniform1i(shaderProgram.dirLightLocation, dirLight);
-
-	glUseProgram(0);
+	if ( !staticBatching || !submitStaticBatch ( renderQueue, sceneView ) )
+	{
+		submitCastle ( renderQueue, castle, sceneView );
+		submitTable ( renderQueue, table, sceneView );
+		submitGround ( renderQueue, ground, sceneView );
+	}
+	submitBroom ( renderQueue, broom, sceneView );
+	submitForest ( renderQueue, forest, sceneView );
 
-	drawGround ( ground, viewMatrix, projectionMatrix );
-	drawFlame ( flame, viewMatrix, projectionMatrix );
+	submitSkybox ( renderQueue, sceneView );
+	submitFlame ( renderQueue, flame, sceneView );
 
 	if ( gameState.bannerOn && banner != NULL )
-		drawBanner ( banner, orthoViewMatrix, orthoProjectionMatrix );
+		submitBanner ( renderQueue, banner, overlayView );
 
 	if ( gameState.gameOver )
 	{
-		drawAnimatedBanner ( animBanner, orthoViewMatrix, orthoProjectionMatrix );
+		submitAnimatedBanner ( renderQueue, animBanner, overlayView );
 		animBanner->currentTime = gameState.elapsedTime;
 	}
+
+	drawRenderQueue ( renderQueue );
+	CHECK_GL_ERROR();
 }
 
 // create objects and assign their initial attributes
@@ -254,6 +340,7 @@ void setInitialObjectProperties ( void )
 	broom->direction = glm::vec3 ( 3.0f, -1.0f, 1.5f );
 	broom->size = BROOM_STICK_SIZE;
 	broom->speed = BROOM_STICK_SPEED;
+	broom->transformDirty = true;
 
 	// cauldron
 	if ( cauldron == NULL )
@@ -261,6 +348,7 @@ void setInitialObjectProperties ( void )
 	cauldron->position = glm::vec3 ( 11.5f, 0.0f, -11.3f );
 	cauldron->direction = glm::vec3 ( 1.0f, 0.0f, 0.0f );
 	cauldron->size = CAULDRON_SIZE;
+	cauldron->transformDirty = true;
 
 	// castle
 	if ( castle == NULL )
@@ -268,6 +356,7 @@ void setInitialObjectProperties ( void )
 	castle->position = glm::vec3 ( -2.0f, 16.6f, -23.0f );
 	castle->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	castle->size = CASTLE_SIZE;
+	castle->transformDirty = true;
 
 	// wand
 	if ( wand == NULL )
@@ -275,6 +364,7 @@ void setInitialObjectProperties ( void )
 	wand->position = glm::vec3 ( 8.3f, 0.1f, -11.0f );
 	wand->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	wand->size = WAND_SIZE;
+	wand->transformDirty = true;
 
 	// table
 	if ( table == NULL )
@@ -282,6 +372,7 @@ void setInitialObjectProperties ( void )
 	table->position = glm::vec3 ( 8.3f, -0.1f, -11.0f );
 	table->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	table->size = WOODEN_TABLE_SIZE;
+	table->transformDirty = true;
 
 	// door
 	if ( door == NULL )
@@ -289,6 +380,7 @@ void setInitialObjectProperties ( void )
 	door->position = glm::vec3 ( 6.5f, 0.7f, -23.0f );
 	door->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	door->size = WOODEN_DOOR_SIZE;
+	door->transformDirty = true;
 
 	// opened door
 	if ( openedDoor == NULL )
@@ -296,12 +388,14 @@ void setInitialObjectProperties ( void )
 	openedDoor->position = glm::vec3 ( 5.35f, 0.7f, -21.2f );
 	openedDoor->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	openedDoor->size = WOODEN_DOOR_SIZE;
+	openedDoor->transformDirty = true;
 
 	// ground
 	if ( ground == NULL )
 		ground = new Object;
 	ground->position = glm::vec3 ( -70.0f, -0.4f, -70.0f );
 	ground->size = GROUND_SIZE;
+	ground->transformDirty = true;
 
 	// tree
 	if ( tree == NULL )
@@ -309,6 +403,14 @@ void setInitialObjectProperties ( void )
 	tree->position = glm::vec3 ( 1.5f, -0.4f, -15.0f );
 	tree->direction = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	tree->size = TREE_SIZE;
+	tree->transformDirty = true;
+
+	// forest, the trees are placed relative to it
+	if ( forest == NULL )
+		forest = new Object;
+	forest->position = glm::vec3 ( 0.0f, 0.0f, 0.0f );
+	forest->size = 1.0f;
+	forest->transformDirty = true;
 
 	// camera 
 	if ( player == NULL )
@@ -325,6 +427,7 @@ void setInitialObjectProperties ( void )
 	banner->size = BANNER_SIZE;
 	banner->position = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	banner->direction = glm::vec3 ( 0.0f, 1.0f, 0.0f );
+	banner->transformDirty = true;
 
 	banner->startTime = gameState.elapsedTime;
 	banner->currentTime = banner->startTime;
@@ -335,6 +438,7 @@ void setInitialObjectProperties ( void )
 	animBanner->size = BANNER_SIZE;
 	animBanner->position = glm::vec3 ( 0.0f, 0.0f, 0.0f );
 	animBanner->direction = glm::vec3 ( 0.0f, 1.0f, 0.0f );
+	animBanner->transformDirty = true;
 	animBanner->speed = 0.0f;
 	animBanner->startTime = gameState.elapsedTime;
 	animBanner->currentTime = banner->startTime;
@@ -422,10 +526,17 @@ void buildScene()
 	mask |= GL_STENCIL_BUFFER_BIT;
 	glClear( mask );
 
+	resetGLStateStatistics();
+	beginStreamFrame();
 	drawWindowContents();
+	endStreamFrame();
 
 	glutSwapBuffers();
 	CHECK_GL_ERROR();
+
+	// the next frame right away instead of at the refresh timer
+	if ( benchmarkFrames > 0 )
+		recordBenchmarkFrame();
 }
 
 void windowResize(int width, int height) 
@@ -494,6 +605,43 @@ void keyboardCallback(unsigned char key, int x, int y)
 		player->spotlightOn = !player->spotlightOn;
 		break;
 
+	case 'k':
+		// cycle forced LOD 0..3, then back to automatic selection
+		forcedLod = (forcedLod + 2) % 5 - 1;
+		std::cout << "forced LOD: " << forcedLod << std::endl;
+		break;
+
+	case 'p':
+		// redundant state changes and culled objects of the last frame
+		printGLStateStatistics();
+		printCullingStatistics( renderQueue.cullingStatistics() );
+		printIndirectStatistics();
+		printStreamStatistics();
+		printLightStatistics();
+		printShaderVariantStatistics();
+		break;
+
+	case 'b':
+		staticBatching = !staticBatching;
+		poolStaticBatch ( staticBatching );
+		std::cout << "static batching: " << ( staticBatching ? "on" : "off" ) << std::endl;
+		break;
+
+	case 'o':
+		occlusionCulling = !occlusionCulling;
+		std::cout << "occlusion culling: " << ( occlusionCulling ? "on" : "off" ) << std::endl;
+		break;
+
+	case 'i':
+		indirectDrawing = !indirectDrawing;
+		std::cout << "indirect drawing: " << ( indirectDrawing ? "on" : "off" ) << std::endl;
+		break;
+
+	case 'v':
+		shaderVariants = !shaderVariants;
+		std::cout << "shader variants: " << ( shaderVariants ? "on" : "off" ) << std::endl;
+		break;
+
 	default:
 		break;
 	}
@@ -667,6 +815,7 @@ void timerFunc(int id)
 
 	broom->position = broom->initPosition + evaluateClosedCurve ( curveData, curveSize, curveParamT );
 	broom->direction = glm::normalize ( evaluateClosedCurve_1stDerivative ( curveData, curveSize, curveParamT ) );
+	broom->transformDirty = true;
 
 	flame->currentTime = gameState.elapsedTime;
 
@@ -681,6 +830,9 @@ void timerFunc(int id)
 		gameState.gameOver = true;
 	}
 
+	// edited shaders, models and textures are swapped in between two frames
+	reloadChangedAssets();
+
 	glutPostRedisplay();
 
 	// nastav kdy se znovu zavola timerCallback
@@ -705,10 +857,19 @@ void init()
 	//glBlendEquation(GL_FUNC_ADD);
 
 	initializeShaderPrograms();
+	initializeLights();
 	initializeModels();
+	initializeHotReload();
 
 	restartGame();
 
+	buildStaticBatch ( castle, table, ground );
+	buildOccluders ( castle );
+	buildIndirectDrawing ( );
+
+	if ( forestTrees > 0 )
+		initializeForest ( forestTrees, ground, TREE_SIZE );
+
 	//glViewport(0, 0, gameState.windowWidth, gameState.windowHeight);
 }
 
@@ -723,6 +884,7 @@ void cleanupObjects()
 	door = NULL;
 	openedDoor = NULL;
 	ground = NULL;
+	forest = NULL;
 
 	player = NULL;
 
@@ -735,6 +897,7 @@ void destroy()
 {
 	//delete all allocated resources
 	cleanupObjects();
+	cleanupHotReload();
 	cleanupModels();
 
 	// delete shaders
@@ -743,13 +906,49 @@ void destroy()
 
 int main(int argc, char **argv)
 {
+	// offline cooking of the meshes and textures, e.g. before packaging
+	if (argc > 1 && std::string(argv[1]) == "--cook-textures")
+		return cookSceneAssets() ? 0 : 1;
+
+	// --forest [number of trees]
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) != "--forest")
+			continue;
+
+		forestTrees = FOREST_TREES;
+		if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+			forestTrees = (unsigned int)atoi(argv[i + 1]);
+	}
+
+	// --deferred, --size WxH, --benchmark [number of frames]
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--deferred")
+			deferredShading = true;
+
+		int width, height;
+		if (std::string(argv[i]) == "--size" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+		{
+			windowWidth = width;
+			windowHeight = height;
+		}
+
+		if (std::string(argv[i]) != "--benchmark")
+			continue;
+
+		benchmarkFrames = BENCHMARK_FRAMES;
+		if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+			benchmarkFrames = (unsigned int)atoi(argv[i + 1]);
+	}
+
 	glutInit(&argc, argv);
 
 	glutInitContextVersion(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR);
 	glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
 
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);		// GLUT_STENCIL PIDAT??
-	glutInitWindowSize(WIN_WIDTH, WIN_HEIGHT);
+	glutInitWindowSize(windowWidth, windowHeight);
 	glutCreateWindow(WIN_TITLE);
 
 	/*
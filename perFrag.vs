@@ -1,46 +1,72 @@
 #version 140
 
-struct Material 
-{      
-  vec3  ambient;   
-  vec3  diffuse;   
-  vec3  specular;  
-  float shininess; 
-
-  bool  useTexture;
-};
-
 in vec3 position;
 in vec3 normal;
 in vec2 texCoord;
 
-uniform sampler2D texSampler;  
+// the FrameBlock comes from frameBlock.glsl
 
-uniform Material material;    
- 
-uniform int cauldronLight;
-uniform bool dirLight;
-uniform float time;
+// bound per draw from the transform ring buffer
+layout(std140) uniform TransformBlock
+{
+  mat4  PVMmatrix;
+  mat4  Mmatrix;
+  mat4  normalMatrix;
+};
+
+// one per mesh part, created at load time, passed on to perFrag.fs
+layout(std140) uniform MaterialBlock
+{
+  vec3  materialAmbient;
+  float materialShininess;
+  vec3  materialDiffuse;
+  bool  materialUseTexture;
+  vec3  materialSpecular;
+};
 
-uniform mat4 PVMmatrix;     
-uniform mat4 Vmatrix;       
-uniform mat4 Mmatrix;       
-uniform mat4 normalMatrix;
+uniform int cauldronLight;
 
-uniform vec3 reflectorPosition;
-uniform vec3 reflectorDirection;
-uniform bool reflectOn;
+// drawn instanced, each instance has a model matrix (4 texels) and a tint (1 texel), applied before the TransformBlock matrices
+uniform bool instanced;
+uniform samplerBuffer instanceSampler;
 
 smooth out vec2 texCoord_v;  
 smooth out vec3 fragPositionCamera;
 smooth out vec3 fragNormalCamera;
+flat out vec3 instanceTint;
+
+flat out vec3  materialAmbient_v;
+flat out vec3  materialDiffuse_v;
+flat out vec3  materialSpecular_v;
+flat out float materialShininess_v;
+flat out int   materialUseTexture_v;
 
 void main ( void ) 
 {
-  fragPositionCamera = (Vmatrix * Mmatrix * vec4(position, 1.0)).xyz;  
-  fragNormalCamera = normalize((Vmatrix * Mmatrix * vec4(normal, 0.0)).xyz);
+  mat4 instanceMatrix = mat4(1.0);
+  instanceTint = vec3(1.0);
+
+  if (instanced)
+  {
+    int texel = gl_InstanceID * 5;
+    instanceMatrix = mat4(texelFetch(instanceSampler, texel), texelFetch(instanceSampler, texel + 1),
+                          texelFetch(instanceSampler, texel + 2), texelFetch(instanceSampler, texel + 3));
+    instanceTint = texelFetch(instanceSampler, texel + 4).rgb;
+  }
+
+  vec4 instancePosition = instanceMatrix * vec4(position, 1.0);
+
+  fragPositionCamera = (Vmatrix * Mmatrix * instancePosition).xyz;  
+  // instances are scaled uniformly, their matrix transforms the normals as well
+  fragNormalCamera = normalize((Vmatrix * normalMatrix * instanceMatrix * vec4(normal, 0.0)).xyz);
   
+  materialAmbient_v = materialAmbient;
+  materialDiffuse_v = materialDiffuse;
+  materialSpecular_v = materialSpecular;
+  materialShininess_v = materialShininess;
+  materialUseTexture_v = materialUseTexture ? 1 : 0;
+
   texCoord_v = texCoord;
 
-  gl_Position = PVMmatrix * vec4(position, 1);  
+  gl_Position = PVMmatrix * instancePosition;  
 }
@@ -1,5 +1,22 @@
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <cfloat>
+#include <climits>
+#include <chrono>
 #include "render_stuff.h"
+#include "AssetLoader.h"
+#include "TextureManager.h"
+#include "FileWatcher.h"
+#include "GLState.h"
+#include "StaticBatch.h"
+#include "OcclusionCuller.h"
+#include "IndirectDraw.h"
+#include "DeferredRenderer.h"
+#include "ShaderVariants.h"
+#include "ProgramCache.h"
+#include <IL/il.h>
 #include "Spline.h"
 #include "lowPolyTree.h"
 
@@ -19,6 +36,19 @@ const std::string BANNER_TEXTURE_FILE = "vendor/models/banner.png";
 const std::string ANIM_BANNER_TEXTURE_FILE = "vendor/models/bannerEnd.png";
 const std::string FLAME_TEXTURE_FILE = "vendor/models/flame.png";
 
+// cube map faces in the order +X, -X, +Y, -Y, +Z, -Z
+const std::string SKYBOX_FACE_FILES[6] = {
+	"vendor/skybox/hills_rt.jpg",
+	"vendor/skybox/hills_lf.jpg",
+	"vendor/skybox/hills_up.jpg",
+	"vendor/skybox/hills_dn.jpg",
+	"vendor/skybox/hills_bk.jpg",
+	"vendor/skybox/hills_ft.jpg"
+};
+
+// all six faces with their mips baked into one compressed file
+const std::string SKYBOX_CUBE_MAP_FILE = "vendor/skybox/hills_cube.ktx";
+
 // Meshes
 MeshGeometry * castleGeometry = NULL;
 MeshGeometry * skyboxGeometry = NULL;
@@ -34,551 +64,817 @@ MeshGeometry * bannerGeometry = NULL;
 MeshGeometry * animBannerGeometry = NULL;
 MeshGeometry * flameGeometry = NULL;
 
+// trees scattered around the castle grounds in square patches culled one by one, empty unless initializeForest() was called
+std::vector<InstanceBuffer *> forestChunks;
+
+// objects merged by buildStaticBatch(), with the geometry variables so that reloaded models are picked up
+typedef struct StaticBatchSource
+{
+	MeshGeometry **  geometry;
+	Object *         object;
+	unsigned char    stencilId;
+
+} StaticBatchSource;
+
+static std::vector<StaticBatchSource> staticBatchSources;
+MeshGeometry * staticBatchGeometry = NULL;
+
+// the batch is in world space already
+static Object staticBatchOrigin;
+
+// point lights of the scene, binned into clusters for perFrag.fs every frame
+std::vector<PointLight> sceneLights;
+LightClusters * lightClusters = NULL;
+
+// pool of the static meshes drawn with multi draw indirect, NULL if the context cannot do it
+IndirectRenderer * indirectRenderer = NULL;
+static bool indirectPoolBatched = true;      // the pool holds the static batch instead of the meshes it merges
+
+// the pooled meshes are drawn indirect, toggled for comparison
+bool indirectDrawing = true;
+
+// castle walls rasterized for the occlusion culling, set by buildOccluders()
+OcclusionCuller * occlusionCuller = NULL;
+static Object * occluderObject = NULL;
+
 // Shaders
 SCommonShaderProgram shaderProgram;
 SkyboxShaderProgram skyboxShaderProgram;
 BannerShaderProgram bannerShaderProgram;
 BannerShaderProgram animBannerShaderProgram;
 FlameShaderProgram flameShaderProgram;
+IndirectShaderProgram indirectShaderProgram;
+SCommonShaderProgram gbufferShaderProgram;
+DeferredShaderProgram deferredLightShaderProgram;
+DeferredShaderProgram deferredCompositeShaderProgram;
 
-//============================================================================================================================
-/** Load mesh using assimp library
-* \param filename [in] file to open/load
-* \param shader [in] vao will connect loaded data to shader
-* \param vbo [out] vertex and normal data |VVVVV...|NNNNN...| (no interleaving)
-* \param eao [out] triangle indices
-* \param vao [out] vao connects data to shader input
-* \param numTriangles [out] how many triangles have been loaded and stored into index array eao
-*/
-bool loadSingleMesh(const std::string &fileName, SCommonShaderProgram& shader, MeshGeometry** geometry) {
-	Assimp::Importer importer;
-
-	// Unitize object in size (scale the model to fit into (-1..1)^3)
-	importer.SetPropertyInteger(AI_CONFIG_PP_PTV_NORMALIZE, 1);
-
-	// Load asset from the file - you can play with various processing steps
-	const aiScene * scn = importer.ReadFile(fileName.c_str(), 0
-		| aiProcess_Triangulate             // Triangulate polygons (if any).
-		| aiProcess_PreTransformVertices    // Transforms scene hierarchy into one root with geometry-leafs only. For more see Doc.
-		| aiProcess_GenSmoothNormals        // Calculate normals per vertex.
-		| aiProcess_JoinIdenticalVertices);
-
-	// abort if the loader fails
-	if (scn == NULL) {
-		std::cerr << "assimp error: " << importer.GetErrorString() << std::endl;
-		*geometry = NULL;
-		return false;
-	}
-
-	// some formats store whole scene (multiple meshes and materials, lights, cameras, ...) in one file, we cannot handle that in our simplified example
-	if (scn->mNumMeshes != 1) {
-		std::cerr << "this simplified loader can only process files with only one mesh" << std::endl;
-		*geometry = NULL;
-		return false;
-	}
-
-	// in this phase we know we have one mesh in our loaded scene, we can directly copy its data to OpenGL ...
-	const aiMesh * mesh = scn->mMeshes[0];
-
-	*geometry = new MeshGeometry;
+// perFrag.fs specialized for the light switches of the frame and the texture of the part, linked on first use
+ShaderVariantCache * litVariantCache = NULL;
+ShaderVariantCache * indirectVariantCache = NULL;
+static SCommonShaderProgram litVariants[NUM_SHADER_VARIANTS];
+static IndirectShaderProgram indirectVariants[NUM_SHADER_VARIANTS];
 
-	// vertex buffer object, store all vertex positions and normals
-	glGenBuffers(1, &((*geometry)->vertexBufferObject));
-	glBindBuffer(GL_ARRAY_BUFFER, (*geometry)->vertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(float)*mesh->mNumVertices, 0, GL_STATIC_DRAW); // allocate memory for vertices, normals, and texture coordinates
-																							// first store all vertices
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * sizeof(float)*mesh->mNumVertices, mesh->mVertices);
-	// then store all normals
-	glBufferSubData(GL_ARRAY_BUFFER, 3 * sizeof(float)*mesh->mNumVertices, 3 * sizeof(float)*mesh->mNumVertices, mesh->mNormals);
-
-	// just texture 0 for now
-	float *textureCoords = new float[2 * mesh->mNumVertices];  // 2 floats per vertex
-	float *currentTextureCoord = textureCoords;
-
-	// copy texture coordinates
-	aiVector3D vect;
-
-	if (mesh->HasTextureCoords(0)) {
-		// we use 2D textures with 2 coordinates and ignore the third coordinate
-		for (unsigned int idx = 0; idx<mesh->mNumVertices; idx++) {
-			vect = (mesh->mTextureCoords[0])[idx];
-			*currentTextureCoord++ = vect.x;
-			*currentTextureCoord++ = vect.y;
-		}
-	}
+// the lit items are drawn with the variants instead of the generic program, toggled for comparison
+bool shaderVariants = true;
 
-	// finally store all texture coordinates
-	glBufferSubData(GL_ARRAY_BUFFER, 6 * sizeof(float)*mesh->mNumVertices, 2 * sizeof(float)*mesh->mNumVertices, textureCoords);
+// ShaderFeature bits of the light switches, set by setFrameShaderFeatures()
+static unsigned int frameShaderFeatures = 0;
 
-	// copy all mesh faces into one big array (assimp supports faces with ordinary number of vertices, we use only 3 -> triangles)
-	unsigned int *indices = new unsigned int[mesh->mNumFaces * 3];
-	for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
-		indices[f * 3 + 0] = mesh->mFaces[f].mIndices[0];
-		indices[f * 3 + 1] = mesh->mFaces[f].mIndices[1];
-		indices[f * 3 + 2] = mesh->mFaces[f].mIndices[2];
-	}
+// lit opaque meshes shaded in screen space, set by --deferred before initializeShaderPrograms()
+bool deferredShading = false;
+DeferredRenderer * deferredRenderer = NULL;
 
-	// copy our temporary index array to OpenGL and free the array
-	glGenBuffers(1, &((*geometry)->elementBufferObject));
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*geometry)->elementBufferObject);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(unsigned) * mesh->mNumFaces, indices, GL_STATIC_DRAW);
+// worker threads doing the CPU half of asset loading, exists only during initializeModels()
+AssetLoader * assetLoader = NULL;
 
-	delete[] indices;
-	// copy the material info to MeshGeometry structure
-	const aiMaterial *mat = scn->mMaterials[mesh->mMaterialIndex];
-	aiColor4D color;
-	aiString name;
-	aiReturn retValue = AI_SUCCESS;
+// forces the level of detail of all models for benchmarking, -1 = select by the screen size
+int forcedLod = -1;
 
-	// Get returns: aiReturn_SUCCESS 0 | aiReturn_FAILURE -1 | aiReturn_OUTOFMEMORY -3
-	mat->Get(AI_MATKEY_NAME, name); // may be "" after the input mesh processing. Must be aiString type!
+// projected bounding sphere radius (fraction of half of the viewport height) below which LOD 1, 2, 3 is used
+const float LOD_SCREEN_SIZES[] = { 0.25f, 0.1f, 0.04f };
 
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+// walkable part of the scene with the castle, kept free of the forest trees (x and z)
+const glm::vec2 FOREST_CLEARING_MIN = glm::vec2(-24.0f, -42.0f);
+const glm::vec2 FOREST_CLEARING_MAX = glm::vec2(24.0f, 12.0f);
 
-	(*geometry)->diffuse = glm::vec3(color.r, color.g, color.b);
+// the forest is split into FOREST_CHUNKS x FOREST_CHUNKS patches of the ground, each with its own bounds and draw call
+const int FOREST_CHUNKS = 8;
 
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-	(*geometry)->ambient = glm::vec3(color.r, color.g, color.b);
+// the largest triangles of the occluder model, up to this many, are rasterized every frame
+const unsigned int OCCLUDER_MAX_TRIANGLES = 4096;
 
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-	(*geometry)->specular = glm::vec3(color.r, color.g, color.b);
+//============================================================================================================================
+// one MaterialBlock per part, in a buffer of the geometry
+void createMaterialBlocks( MeshGeometry * geometry )
+{
+	std::vector<MaterialBlock> materials(geometry->subMeshes.size());
+	const GLsizeiptr stride = uniformBlockStride(sizeof(MaterialBlock));
 
-	ai_real shininess, strength;
-	unsigned int max;	// changed: to unsigned
+	for (size_t i = 0; i < geometry->subMeshes.size(); i++)
+	{
+		SubMesh &subMesh = geometry->subMeshes[i];
 
-	max = 1;
-	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS, &shininess, &max)) != AI_SUCCESS)
-		shininess = 1.0f;
-	max = 1;
-	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS_STRENGTH, &strength, &max)) != AI_SUCCESS)
-		strength = 1.0f;
-	(*geometry)->shininess = shininess * strength;
+		materials[i].ambient = subMesh.ambient;
+		materials[i].shininess = subMesh.shininess;
+		materials[i].diffuse = subMesh.diffuse;
+		materials[i].useTexture = (subMesh.texture != 0);
+		materials[i].specular = subMesh.specular;
+		materials[i].padding = 0.0f;
 
-	(*geometry)->texture = 0;
+		subMesh.materialOffset = i * stride;
+	}
 
-	// load texture image
-	if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-		// get texture name 
-		aiString path; // filename
+	geometry->materialBuffer = createMaterialBuffer(materials);
+}
 
-		aiReturn texFound = mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-		std::string textureName = path.data;
+/** Upload mesh data to OpenGL
+* \param vertices [in] interleaved vertex data in given format
+* \param indices [in] triangle indices, indexSize bytes each
+* \param subMeshes [in] index ranges of the parts and their materials
+* \param materials [in] materials and texture files of the parts
+* \param shader [in] vao will connect loaded data to shader
+* \param geometry [out] vbo, eao, vao and the submeshes with their textures
+*/
+static void uploadMesh(const void *vertices, unsigned int numVertices, VertexFormat format, const void *indices, unsigned int numIndices, unsigned int indexSize,
+	const std::vector<SubMeshData> &subMeshes, const std::vector<MeshMaterial> &materials, SCommonShaderProgram& shader, MeshGeometry* geometry) {
+
+	// contexts without packed attribute types get the vertices expanded back to floats
+	std::vector<float> unpacked;
+	if (format != VERTEX_FORMAT_FLOAT && !packedNormalsSupported()) {
+		unpackVertices(format, vertices, numVertices, unpacked);
+		vertices = &unpacked[0];
+		format = VERTEX_FORMAT_FLOAT;
+	}
 
-		size_t found = fileName.find_last_of("/\\");
-		// insert correct texture file path 
-		if (found != std::string::npos) { // not found
-										  //subMesh_p->textureName.insert(0, "/");
-			textureName.insert(0, fileName.substr(0, found + 1));
+	geometry->vertexLayout = vertexFormatLayout(format);
+
+	const GLsizei floatBytes = meshFloatsPerVertex * sizeof(float) * numVertices;
+	const GLsizei vertexBytes = geometry->vertexLayout.stride * numVertices;
+	std::cout << "Vertex memory: " << floatBytes / 1024 << " KB as floats, " << vertexBytes / 1024 << " KB uploaded ("
+		<< numVertices << " vertices, " << geometry->vertexLayout.stride << " B each)" << std::endl;
+
+	// vertex buffer object, store all vertex positions, normals and texture coordinates
+	glGenBuffers(1, &(geometry->vertexBufferObject));
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBufferObject);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertices, GL_STATIC_DRAW);
+
+	// copy the index array to OpenGL, the element buffer binding belongs to the vao the last frame left bound
+	cachedBindVertexArray(0);
+	glGenBuffers(1, &(geometry->elementBufferObject));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->elementBufferObject);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize * numIndices, indices, GL_STATIC_DRAW);
+	geometry->indexType = indexSizeType(indexSize);
+
+	geometry->subMeshes.resize(subMeshes.size());
+	for (size_t i = 0; i < subMeshes.size(); i++) {
+		const MeshMaterial &material = materials[subMeshes[i].material];
+		SubMesh &subMesh = geometry->subMeshes[i];
+
+		subMesh.firstIndex = subMeshes[i].firstIndex;
+		subMesh.numIndices = subMeshes[i].numIndices;
+		subMesh.lod = subMeshes[i].lod;
+		subMesh.ambient = material.ambient;
+		subMesh.diffuse = material.diffuse;
+		subMesh.specular = material.specular;
+		subMesh.shininess = material.shininess;
+		subMesh.texture = 0;
+		subMesh.stencilId = 0;
+
+		// load texture image, parts (and models) using the same image share the texture
+		if (!material.textureName.empty()) {
+			std::cout << "Loading texture file: " << material.textureName << std::endl;
+			subMesh.texture = acquireTexture(material.textureName, assetLoader);
 		}
-
-		std::cout << "Loading texture file: " << textureName << std::endl;
-		(*geometry)->texture = pgr::createTexture(textureName);
 	}
+	createMaterialBlocks(geometry);
 	CHECK_GL_ERROR();
 
-	glGenVertexArrays(1, &((*geometry)->vertexArrayObject));
-	glBindVertexArray((*geometry)->vertexArrayObject);
+	geometry->numLods = 1;
+	for (size_t i = 0; i < subMeshes.size(); i++)
+		geometry->numLods = std::max(geometry->numLods, subMeshes[i].lod + 1);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*geometry)->elementBufferObject); // bind our element array buffer (indices) to vao
-	glBindBuffer(GL_ARRAY_BUFFER, (*geometry)->vertexBufferObject);
+	// bounding sphere around the center of the bounding box, positions are floats in every vertex format
+	glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+	for (unsigned int v = 0; v < numVertices; v++) {
+		const float * position = (const float *)((const unsigned char *)vertices + v * geometry->vertexLayout.stride + geometry->vertexLayout.positionOffset);
+		boxMin = glm::min(boxMin, glm::vec3(position[0], position[1], position[2]));
+		boxMax = glm::max(boxMax, glm::vec3(position[0], position[1], position[2]));
+	}
+
+	geometry->boundingBox.min = boxMin;
+	geometry->boundingBox.max = boxMax;
+	geometry->boundingCenter = 0.5f * (boxMin + boxMax);
+	geometry->boundingRadius = 0.0f;
+	for (unsigned int v = 0; v < numVertices; v++) {
+		const float * position = (const float *)((const unsigned char *)vertices + v * geometry->vertexLayout.stride + geometry->vertexLayout.positionOffset);
+		geometry->boundingRadius = std::max(geometry->boundingRadius, glm::length(glm::vec3(position[0], position[1], position[2]) - geometry->boundingCenter));
+	}
 
-	glEnableVertexAttribArray(shader.posLocation);
-	glVertexAttribPointer(shader.posLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// whole mesh material is the first part's one, textures are owned by the submeshes
+	geometry->ambient = geometry->subMeshes[0].ambient;
+	geometry->diffuse = geometry->subMeshes[0].diffuse;
+	geometry->specular = geometry->subMeshes[0].specular;
+	geometry->shininess = geometry->subMeshes[0].shininess;
+	geometry->texture = 0;
 
-	glEnableVertexAttribArray(shader.normalLocation);
-	glVertexAttribPointer(shader.normalLocation, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3 * sizeof(float) * mesh->mNumVertices));
+	glGenVertexArrays(1, &(geometry->vertexArrayObject));
+	glBindVertexArray(geometry->vertexArrayObject);
 
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->elementBufferObject); // bind our element array buffer (indices) to vao
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBufferObject);
 
-	glEnableVertexAttribArray(shader.texCoordLocation);
-	glVertexAttribPointer(shader.texCoordLocation, 2, GL_FLOAT, GL_FALSE, 0, (void*)(6 * sizeof(float) * mesh->mNumVertices));
+	setupVertexAttributes(geometry->vertexLayout, shader.posLocation, shader.normalLocation, shader.texCoordLocation);
 	CHECK_GL_ERROR();
 
 	glBindVertexArray(0);
 
-	(*geometry)->numTriangles = mesh->mNumFaces;
-
-	return true;
+	geometry->numTriangles = numIndices / 3;
 }
 
-void setTransformUniforms( const glm::mat4 &modelMatrix, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix )
-{
-	glm::mat4 PVMmatrix = projectionMatrix * viewMatrix * modelMatrix;
-
-	glUniformMatrix4fv(shaderProgram.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix));
+/** Load model with all its parts, from its cooked file if it is up to date, otherwise using assimp library (and cook it for the next run).
+* The CPU part runs on the asset loader threads if the model was prefetched.
+* \param fileName [in] file to open/load
+* \param shader [in] vao will connect loaded data to shader
+* \param geometry [out] vbo with interleaved (usually packed) vertex data |VNT|VNT|..., eao with triangle indices of all parts, vao and the submeshes
+*/
+bool loadModel(const std::string &fileName, SCommonShaderProgram& shader, MeshGeometry** geometry) {
+	LoadedMesh * mesh;
+
+	if (assetLoader != NULL)
+		mesh = assetLoader->takeMesh(fileName);
+	else {
+		mesh = new LoadedMesh;
+		if (!loadMesh(fileName, *mesh)) {
+			delete mesh;
+			mesh = NULL;
+		}
+	}
 
-	glUniformMatrix4fv(shaderProgram.VmatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-	glUniformMatrix4fv(shaderProgram.MmatrixLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+	if (mesh == NULL) {
+		*geometry = NULL;
+		return false;
+	}
 
-	//glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelMatrix));
+	*geometry = new MeshGeometry();
+	uploadMesh(mesh->vertices, mesh->numVertices, mesh->vertexFormat, mesh->indices, mesh->numIndices, mesh->indexSize,
+		*mesh->subMeshes, *mesh->materials, shader, *geometry);
 
-	const glm::mat4 modelRotationMatrix = glm::mat4(
-		modelMatrix[0],
-		modelMatrix[1],
-		modelMatrix[2],
-		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
-	);
-	glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelRotationMatrix));
+	std::cout << "Model " << fileName << ": " << (*geometry)->subMeshes.size() << " submeshes, " << (*geometry)->numLods << " LODs" << std::endl;
 
+	// unmaps the cooked file
+	delete mesh;
 
-	glUniformMatrix4fv(shaderProgram.normalMatrixLocation, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	return true;
 }
 
-void setMaterialUniforms( const glm::vec3 &ambient, const glm::vec3 &diffuse, const glm::vec3 &specular, float shininess, GLuint texture )
+static TransformBlock transformBlock( const RenderTransform &transform, const glm::mat4 &PVmatrix )
 {
-	glUniform3fv(shaderProgram.diffuseLocation, 1, glm::value_ptr(diffuse));	// 2nd parameter must be 1 - it declares number of vectors in the vector array
-	glUniform3fv(shaderProgram.ambientLocation, 1, glm::value_ptr(ambient));
-	glUniform3fv(shaderProgram.specularLocation, 1, glm::value_ptr(specular));
-	glUniform1f(shaderProgram.shininessLocation, shininess);
+	TransformBlock block;
+	block.PVMmatrix = PVmatrix * transform.modelMatrix;
+	block.Mmatrix = transform.modelMatrix;
+	block.normalMatrix = transform.normalMatrix;
 
-	if (texture != 0) 
-	{
-		glUniform1i(shaderProgram.useTextureLocation, 1);	// do texture sampling
-		glUniform1i(shaderProgram.texSamplerLocation, 0);	// texturing unit 0 -> samplerID   [for the GPU linker]
-		glActiveTexture(GL_TEXTURE0 + 0);					// texturing unit 0 -> to be bound [for OpenGL BindTexture]
-		glBindTexture(GL_TEXTURE_2D, texture);
-	}
-	else
-	{
-		glUniform1i(shaderProgram.useTextureLocation, 0);
-	}
+	return block;
 }
 
-void drawSkybox ( const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+// store the model matrix of the object with its normal matrix, they stay valid until the object moves again
+static void setObjectTransform ( Object * object, const glm::mat4 &modelMatrix )
 {
-	glUseProgram(skyboxShaderProgram.program);
-
-	glm::mat4 matrix = projectionMatrix * viewMatrix;
+	glm::mat4 rotationScale = modelMatrix;
+	rotationScale[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 
-	glm::mat4 viewRotation = viewMatrix;
-	viewRotation[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-
-	glm::mat4 inversePVmatrix = glm::inverse(projectionMatrix * viewRotation);
+	object->modelMatrix = modelMatrix;
+	object->normalMatrix = glm::transpose(glm::inverse(rotationScale));
+	object->transformDirty = false;
+}
 
-	glUniformMatrix4fv(skyboxShaderProgram.inversePVmatrixLocation, 1, GL_FALSE, glm::value_ptr(inversePVmatrix));
-	glUniform1i(skyboxShaderProgram.skyboxSamplerLocation, 0);
+// object placed at its position and uniformly scaled by its size
+static void updateObjectTransform ( Object * object )
+{
+	if (!object->transformDirty)
+		return;
 
-	glBindVertexArray(skyboxGeometry->vertexArrayObject);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxGeometry->texture);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, skyboxGeometry->numTriangles + 2);
+	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), object->position);
+	modelMatrix = glm::scale(modelMatrix, glm::vec3(object->size));
 
-	glBindVertexArray(0);
-	glUseProgram(0);
+	setObjectTransform(object, modelMatrix);
 }
 
-void drawBroom ( BroomObject * broom, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+/** Pick the level of detail by the projected size of the bounding sphere, or the forced one.
+* \return level of the parts to draw
+*/
+unsigned int selectLod( const MeshGeometry * geometry, const glm::mat4 &modelMatrix, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix )
 {
-	glUseProgram(shaderProgram.program);
+	if (forcedLod >= 0)
+		return std::min((unsigned int)forcedLod, geometry->numLods - 1);
 
-	//										position		   front				up vector
-	glm::mat4 modelMatrix = alignObject ( broom->position, broom->direction, glm::vec3( 0.0f, 1.0f, 0.0f ) );
-	modelMatrix = glm::rotate(modelMatrix, glm::radians(0.0f), glm::vec3(0, 1, 0));
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(broom->size));	
+	if (geometry->numLods < 2)
+		return 0;
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	const glm::vec3 center = glm::vec3(viewMatrix * modelMatrix * glm::vec4(geometry->boundingCenter, 1.0f));
+	const float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+	const float radius = geometry->boundingRadius * scale;
+	const float distance = glm::length(center);
 
-	setMaterialUniforms(broomGeometry->ambient, broomGeometry->diffuse, broomGeometry->specular, 
-		broomGeometry->shininess, broomGeometry->texture);
+	// camera inside the bounds (e.g. in the castle)
+	if (distance <= radius)
+		return 0;
 
-	// bind VAO
-	glBindVertexArray(broomGeometry->vertexArrayObject);
+	const float screenSize = radius * projectionMatrix[1][1] / distance;
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, broomGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+	unsigned int lod = 0;
+	while (lod + 1 < geometry->numLods && screenSize < LOD_SCREEN_SIZES[lod])
+		lod++;
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+	return lod;
 }
 
-void drawCauldron ( Object * cauldron, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+/** One item per part of the selected level of detail, the parts share the transform.
+* \param instances [in] draw all of them placed relative to the object, NULL = the object alone
+*/
+static void submitMeshGeometry ( RenderQueue &queue, const MeshGeometry * geometry, unsigned int view, const Object * object, unsigned char stencilId,
+	const InstanceBuffer * instances = NULL )
 {
-	glUseProgram(shaderProgram.program);
-
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), cauldron->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(cauldron->size));
-
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	// model which failed to load
+	if (geometry == NULL)
+		return;
+
+	const RenderView &camera = queue.view(view);
+
+	// instances are spread too far for one level of detail to fit them all, the finest one is drawn unless forced
+	unsigned int lod = 0;
+	if (instances == NULL)
+		lod = selectLod(geometry, object->modelMatrix, camera.viewMatrix, camera.projectionMatrix);
+	else if (forcedLod >= 0)
+		lod = std::min((unsigned int)forcedLod, geometry->numLods - 1);
+
+	// world space bounds for the culling, instances lie around their origins
+	BoundingBox bounds;
+	if (instances == NULL)
+		bounds = transformBoundingBox(geometry->boundingBox, object->modelMatrix);
+	else
+	{
+		const float meshExtent = instances->maxScale * (glm::length(geometry->boundingCenter) + geometry->boundingRadius);
 
-	setMaterialUniforms(cauldronGeometry->ambient, cauldronGeometry->diffuse, cauldronGeometry->specular, 
-		cauldronGeometry->shininess, cauldronGeometry->texture);
+		bounds.min = instances->translationBounds.min - glm::vec3(meshExtent);
+		bounds.max = instances->translationBounds.max + glm::vec3(meshExtent);
+		bounds = transformBoundingBox(bounds, object->modelMatrix);
+	}
 
-	// bind VAO
-	glBindVertexArray(cauldronGeometry->vertexArrayObject);
+	DrawItem item;
+	item.pass = RENDER_PASS_OPAQUE;
+	item.shader = DRAW_SHADER_COMMON;
+	item.geometry = geometry;
+	item.view = view;
+	item.transform = queue.addTransform(object->modelMatrix, object->normalMatrix, &bounds);
+	item.instances = instances;
+	item.stencilId = stencilId;
+	item.time = 0.0f;
+	item.frameDuration = 0.0f;
+
+	for (size_t i = 0; i < geometry->subMeshes.size(); i++)
+	{
+		if (geometry->subMeshes[i].lod != lod)
+			continue;
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, cauldronGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		// parts of a static batch carry the IDs of their objects
+		item.subMesh = &geometry->subMeshes[i];
+		item.stencilId = (item.subMesh->stencilId != 0) ? item.subMesh->stencilId : stencilId;
+		queue.submit(item);
+	}
+}
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+// model placed at the object's position and uniformly scaled by its size
+static void submitObject ( RenderQueue &queue, const MeshGeometry * geometry, Object * object, unsigned int view, unsigned char stencilId )
+{
+	updateObjectTransform(object);
+	submitMeshGeometry(queue, geometry, view, object, stencilId);
 }
 
-void drawCastle( Object * castle, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+void submitInstances ( RenderQueue &queue, const MeshGeometry * geometry, const InstanceBuffer * instances, Object * group, unsigned int view )
 {
-	glUseProgram(shaderProgram.program);
+	if (instances == NULL || instances->numInstances == 0)
+		return;
 
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), castle->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(castle->size));
+	updateObjectTransform(group);
+	submitMeshGeometry(queue, geometry, view, group, 0, instances);
+}
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+// textured quad drawn by one of the programs without lighting
+static void submitQuad ( RenderQueue &queue, RenderPass pass, DrawShader shader, const MeshGeometry * geometry, unsigned int view, const glm::mat4 &modelMatrix,
+	float time = 0.0f, float frameDuration = 0.0f )
+{
+	DrawItem item;
+	item.pass = pass;
+	item.shader = shader;
+	item.geometry = geometry;
+	item.subMesh = NULL;
+	item.view = view;
+	// the quads are not lit
+	item.transform = queue.addTransform(modelMatrix, glm::mat4(1.0f));
+	item.instances = NULL;
+	item.stencilId = 0;
+	item.time = time;
+	item.frameDuration = frameDuration;
+
+	queue.submit(item);
+}
 
-	setMaterialUniforms(castleGeometry->ambient, castleGeometry->diffuse, castleGeometry->specular, 
-		castleGeometry->shininess, castleGeometry->texture);
+void submitSkybox ( RenderQueue &queue, unsigned int view )
+{
+	submitQuad(queue, RENDER_PASS_SKYBOX, DRAW_SHADER_SKYBOX, skyboxGeometry, view, glm::mat4(1.0f));
+}
 
-	// bind VAO
-	glBindVertexArray(castleGeometry->vertexArrayObject);
+void submitBroom ( RenderQueue &queue, BroomObject * broom, unsigned int view, unsigned char stencilId )
+{
+	if (broom->transformDirty)
+	{
+		//										position		   front				up vector
+		glm::mat4 modelMatrix = alignObject ( broom->position, broom->direction, glm::vec3( 0.0f, 1.0f, 0.0f ) );
+		modelMatrix = glm::scale(modelMatrix, glm::vec3(broom->size));	
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, castleGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		setObjectTransform(broom, modelMatrix);
+	}
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+	submitMeshGeometry(queue, broomGeometry, view, broom, stencilId);
 }
 
-void drawWand ( Object * wand, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+void submitCauldron ( RenderQueue &queue, Object * cauldron, unsigned int view, unsigned char stencilId )
 {
-	glUseProgram(shaderProgram.program);
-
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), wand->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(wand->size));
+	submitObject(queue, cauldronGeometry, cauldron, view, stencilId);
+}
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+void submitCastle ( RenderQueue &queue, Object * castle, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, castleGeometry, castle, view, stencilId);
+}
 
-	setMaterialUniforms(wandGeometry->ambient, wandGeometry->diffuse, wandGeometry->specular, wandGeometry->shininess, wandGeometry->texture);
+void submitWand ( RenderQueue &queue, Object * wand, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, wandGeometry, wand, view, stencilId);
+}
 
-	// bind VAO
-	glBindVertexArray(wandGeometry->vertexArrayObject);
+void submitTable ( RenderQueue &queue, Object * table, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, tableGeometry, table, view, stencilId);
+}
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, wandGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+void submitDoor ( RenderQueue &queue, Object * door, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, doorGeometry, door, view, stencilId);
+}
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+void submitOpenedDoor ( RenderQueue &queue, Object * door, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, openedDoorGeometry, door, view, stencilId);
 }
 
-void drawTable ( Object * table, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+void submitGround ( RenderQueue &queue, Object * ground, unsigned int view, unsigned char stencilId )
 {
-	glUseProgram(shaderProgram.program);
+	submitObject(queue, groundGeometry, ground, view, stencilId);
+}
 
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), table->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(table->size));
+void submitTree ( RenderQueue &queue, Object * tree, unsigned int view, unsigned char stencilId )
+{
+	submitObject(queue, treeGeometry, tree, view, stencilId);
+}
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+void submitForest ( RenderQueue &queue, Object * forest, unsigned int view )
+{
+	for (size_t i = 0; i < forestChunks.size(); i++)
+		submitInstances(queue, treeGeometry, forestChunks[i], forest, view);
+}
 
-	setMaterialUniforms(tableGeometry->ambient, tableGeometry->diffuse, tableGeometry->specular, 
-		tableGeometry->shininess, tableGeometry->texture);
+bool submitStaticBatch ( RenderQueue &queue, unsigned int view )
+{
+	if (staticBatchGeometry == NULL)
+		return false;
 
-	// bind VAO
-	glBindVertexArray(tableGeometry->vertexArrayObject);
+	submitMeshGeometry(queue, staticBatchGeometry, view, &staticBatchOrigin, 0);
+	return true;
+}
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, tableGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+void submitBanner ( RenderQueue &queue, Object * banner, unsigned int view )
+{
+	updateObjectTransform(banner);
+	submitQuad(queue, RENDER_PASS_OVERLAY, DRAW_SHADER_BANNER, bannerGeometry, view, banner->modelMatrix);
+}
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+void submitAnimatedBanner ( RenderQueue &queue, Object * banner, unsigned int view )
+{
+	updateObjectTransform(banner);
+	submitQuad(queue, RENDER_PASS_OVERLAY, DRAW_SHADER_ANIM_BANNER, animBannerGeometry, view, banner->modelMatrix, banner->currentTime - banner->startTime);
 }
 
-void drawDoor ( Object * door, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+void submitFlame ( RenderQueue &queue, FlameObject * flame, unsigned int view )
 {
-	glUseProgram(shaderProgram.program);
+	const glm::mat4 &viewMatrix = queue.view(view).viewMatrix;
 
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), door->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(door->size));
+	glm::mat4 billboardRotationMatrix = glm::mat4(
+		viewMatrix[0],
+		viewMatrix[1],
+		viewMatrix[2],
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+	);
+	billboardRotationMatrix = glm::transpose(billboardRotationMatrix);
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	glm::mat4 matrix = glm::translate(glm::mat4(1.0f), flame->position);
+	matrix = glm::scale(matrix, glm::vec3(flame->size));
+	matrix = matrix*billboardRotationMatrix; 
 
-	setMaterialUniforms(doorGeometry->ambient, doorGeometry->diffuse, doorGeometry->specular, 
-		doorGeometry->shininess, doorGeometry->texture);
+	submitQuad(queue, RENDER_PASS_ADDITIVE, DRAW_SHADER_FLAME, flameGeometry, view, matrix, flame->currentTime - flame->startTime, flame->frameDuration);
+}
 
-	// bind VAO
-	glBindVertexArray(doorGeometry->vertexArrayObject);
+//============================================================================================================================
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, doorGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+// variants of the lit programs, next to the other programs below
+static const SCommonShaderProgram & litShaderVariant ( unsigned int features );
+static const IndirectShaderProgram & indirectShaderVariant ( unsigned int features );
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+static GLuint drawShaderProgram ( DrawShader shader )
+{
+	switch (shader)
+	{
+	case DRAW_SHADER_SKYBOX:      return skyboxShaderProgram.program;
+	case DRAW_SHADER_BANNER:      return bannerShaderProgram.program;
+	case DRAW_SHADER_ANIM_BANNER: return animBannerShaderProgram.program;
+	case DRAW_SHADER_FLAME:       return flameShaderProgram.program;
+	case DRAW_SHADER_COMMON:
+	default:                      return shaderProgram.program;
+	}
 }
 
-void drawOpenedDoor ( Object * door, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+static void beginRenderPass ( RenderPass pass )
 {
-	glUseProgram(shaderProgram.program);
-
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), door->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(door->size));
-
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	switch (pass)
+	{
+	case RENDER_PASS_OPAQUE:
+		cachedEnable(GL_STENCIL_TEST);
+		cachedStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		break;
+
+	case RENDER_PASS_ADDITIVE:
+		cachedEnable(GL_BLEND);
+		cachedBlendFunc(GL_ONE, GL_ONE);
+		break;
+
+	case RENDER_PASS_OVERLAY:
+		cachedEnable(GL_BLEND);
+		cachedBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		cachedDisable(GL_DEPTH_TEST);
+		break;
+
+	default:
+		break;
+	}
+}
 
-	setMaterialUniforms(openedDoorGeometry->ambient, openedDoorGeometry->diffuse, openedDoorGeometry->specular, 
-		openedDoorGeometry->shininess, openedDoorGeometry->texture);
+static void endRenderPass ( RenderPass pass )
+{
+	switch (pass)
+	{
+	case RENDER_PASS_OPAQUE:
+		cachedDisable(GL_STENCIL_TEST);
+		break;
 
-	// bind VAO
-	glBindVertexArray(openedDoorGeometry->vertexArrayObject);
+	case RENDER_PASS_ADDITIVE:
+		cachedDisable(GL_BLEND);
+		break;
 
-	// draw Castle													0 = location where indices are stored
-	glDrawElements(GL_TRIANGLES, openedDoorGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
+	case RENDER_PASS_OVERLAY:
+		cachedEnable(GL_DEPTH_TEST);
+		cachedDisable(GL_BLEND);
+		break;
 
-	// unbind VAO, shader
-	glBindVertexArray(0);
-	glUseProgram(0);
+	default:
+		break;
+	}
 }
 
-void drawGround ( Object * ground, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
+/** Cull, sort the queue and draw all its visible items. Binds go through the GL state cache, the transforms of the lit items
+* are uploaded at once and every item then only binds its transform and material block ranges. Opaque parts of the pooled
+* meshes are drawn with multi draw indirect instead when it is enabled. The lit items use the variant of perFrag.fs for the
+* light switches of the frame and their texture. With deferred shading the lit opaque items go to
+* the G-buffer, which is lit and composited before the first item drawn after them, usually the skybox.
+*/
+void drawRenderQueue ( RenderQueue &queue )
 {
-	glUseProgram(shaderProgram.program);
-
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), ground->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(ground->size));
+	queue.cull();
+	queue.sort();
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	const std::vector<DrawItem> &items = queue.drawItems();
 
-	setMaterialUniforms( groundGeometry->ambient, groundGeometry->diffuse, groundGeometry->specular,
-		groundGeometry->shininess, groundGeometry->texture );
-
-	glBindVertexArray(groundGeometry->vertexArrayObject);
-	CHECK_GL_ERROR();
+	// opaque parts of the pooled meshes are drawn by the indirect renderer at the start of the opaque pass
+	static std::vector<unsigned char> indirectItems;
+	indirectItems.assign(items.size(), 0);
 
-	glDrawElements(GL_TRIANGLES, groundGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
-	CHECK_GL_ERROR();
+	// the deferred renderer has no indirect G-buffer program
+	const bool deferred = (deferredRenderer != NULL);
+	const bool indirect = (indirectRenderer != NULL && indirectDrawing && !deferred);
+	if (indirect)
+	{
+		indirectRenderer->beginFrame();
 
-	glBindVertexArray(0);
-	glUseProgram(0);
-}
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			if (items[i].pass == RENDER_PASS_OPAQUE && items[i].shader == DRAW_SHADER_COMMON)
+				indirectItems[i] = indirectRenderer->addItem(items[i], queue.transform(items[i].transform));
+		}
+	}
 
-void drawTree ( Object * tree, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
-{
-	glUseProgram(shaderProgram.program);
+	// transforms used by the lit program, each is drawn from one view
+	static std::vector<TransformBlock> transforms;
+	static std::vector<int> transformSlots;
 
-	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), tree->position);
-	modelMatrix = glm::scale(modelMatrix, glm::vec3(tree->size));
+	transforms.clear();
+	transformSlots.assign(queue.transformCount(), -1);
 
-	setTransformUniforms(modelMatrix, viewMatrix, projectionMatrix);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const DrawItem &item = items[i];
+		if (item.shader != DRAW_SHADER_COMMON || indirectItems[i] || transformSlots[item.transform] >= 0)
+			continue;
 
-	setMaterialUniforms( treeGeometry->ambient, treeGeometry->diffuse, treeGeometry->specular,
-		treeGeometry->shininess, treeGeometry->texture );
+		const RenderView &camera = queue.view(item.view);
+		transformSlots[item.transform] = (int)transforms.size();
+		transforms.push_back(transformBlock(queue.transform(item.transform), camera.PVmatrix));
+	}
 
-	glBindVertexArray(treeGeometry->vertexArrayObject);
-	CHECK_GL_ERROR();
+	const GLintptr transformsOffset = uploadTransformBlocks(transforms);
+	const GLsizeiptr transformStride = uniformBlockStride(sizeof(TransformBlock));
 
-	glDrawElements(GL_TRIANGLES, treeGeometry->numTriangles * 3, GL_UNSIGNED_INT, 0);
-	CHECK_GL_ERROR();
+	RenderPass pass = NUM_RENDER_PASSES;
 
-	glBindVertexArray(0);
-	glUseProgram(0);
-}
+	// uniforms of the current program, forgotten when it changes
+	GLuint program = 0;
+	unsigned int transform = UINT_MAX;
+	unsigned int view = UINT_MAX;
+	GLuint materialBuffer = 0;
+	GLintptr materialOffset = -1;
+	int instanced = -1;
 
-void drawBanner ( Object * banner, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
-{
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// lit opaque items of the deferred renderer, resolved before the first item drawn forward after them
+	bool gbufferOpen = false;
+	unsigned int gbufferView = 0;
 
-	glDisable(GL_DEPTH_TEST);
+	cachedActiveTexture(GL_TEXTURE0);
 
-	glUseProgram(bannerShaderProgram.program);
-	CHECK_GL_ERROR();
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const DrawItem &item = items[i];
+		const bool geometryItem = deferred && item.pass == RENDER_PASS_OPAQUE && item.shader == DRAW_SHADER_COMMON;
 
-	glm::mat4 matrix = glm::translate(glm::mat4(1.0f), banner->position);
-	matrix = glm::scale(matrix, glm::vec3(banner->size));
-	CHECK_GL_ERROR();
+		if (gbufferOpen && !geometryItem)
+		{
+			deferredRenderer->resolve(deferredLightShaderProgram, deferredCompositeShaderProgram, queue.view(gbufferView).projectionMatrix);
+			gbufferOpen = false;
+			program = 0;
+		}
 
-	glm::mat4 PVMmatrix = projectionMatrix * viewMatrix * matrix;
-	glUniformMatrix4fv(bannerShaderProgram.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix));   
-	CHECK_GL_ERROR();
-	glUniform1i(bannerShaderProgram.texSamplerLocation, 0);
-	CHECK_GL_ERROR();
+		if (item.pass != pass)
+		{
+			if (pass != NUM_RENDER_PASSES)
+				endRenderPass(pass);
+			beginRenderPass(item.pass);
+			pass = item.pass;
+
+			// the indirect renderer leaves its own program bound
+			if (pass == RENDER_PASS_OPAQUE && indirect)
+			{
+				indirectRenderer->draw(queue, indirectShaderVariant(frameShaderFeatures), indirectShaderVariant(frameShaderFeatures | SHADER_FEATURE_TEXTURE));
+				program = 0;
+			}
+		}
 
-	glBindTexture(GL_TEXTURE_2D, bannerGeometry->texture);
-	glBindVertexArray(bannerGeometry->vertexArrayObject);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, bannerGeometry->numTriangles);
+		if (indirectItems[i])
+			continue;
 
-	CHECK_GL_ERROR();
+		if (geometryItem && !gbufferOpen)
+		{
+			deferredRenderer->beginGeometry(gbufferShaderProgram.program);
+			gbufferOpen = true;
+			gbufferView = item.view;
+		}
 
-	glBindVertexArray(0);
-	glUseProgram(0);
+		// texture of the item, the mesh parts have their own
+		const GLuint itemTexture = (item.subMesh != NULL) ? item.subMesh->texture : item.geometry->texture;
 
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-}
+		// the same blocks and uniforms in every lit program, only the G-buffer one writes materials instead of colors
+		const unsigned int features = frameShaderFeatures | ((itemTexture != 0) ? SHADER_FEATURE_TEXTURE : 0);
+		const SCommonShaderProgram &lit = geometryItem ? gbufferShaderProgram
+			: (item.shader == DRAW_SHADER_COMMON) ? litShaderVariant(features) : shaderProgram;
 
-void drawAnimatedBanner ( Object * banner, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
-{
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		const GLuint itemProgram = (item.shader == DRAW_SHADER_COMMON) ? lit.program : drawShaderProgram(item.shader);
+		cachedUseProgram(itemProgram);
+		if (itemProgram != program)
+		{
+			program = itemProgram;
+			view = UINT_MAX;
+			instanced = -1;
+
+			if (item.shader == DRAW_SHADER_COMMON)
+			{
+				glUniform1i(lit.texSamplerLocation, 0);
+				glUniform1i(lit.instanceSamplerLocation, INSTANCE_TEXTURE_UNIT);
+				setLightSamplers(lit.lightSamplers);
+			}
+		}
 
-	glDisable(GL_DEPTH_TEST);
+		if (pass == RENDER_PASS_OPAQUE)
+			cachedStencilFunc(GL_ALWAYS, item.stencilId, 255);
 
-	glUseProgram(animBannerShaderProgram.program);
-	CHECK_GL_ERROR();
+		cachedBindVertexArray(item.geometry->vertexArrayObject);
 
-	glm::mat4 matrix = glm::translate(glm::mat4(1.0f), banner->position);
-	matrix = glm::scale(matrix, glm::vec3(banner->size));
-	CHECK_GL_ERROR();
+		const RenderView &camera = queue.view(item.view);
+		const glm::mat4 &modelMatrix = queue.transform(item.transform).modelMatrix;
 
-	glm::mat4 PVMmatrix = projectionMatrix * viewMatrix * matrix;
-	glUniformMatrix4fv(animBannerShaderProgram.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix));   
-	glUniform1f(animBannerShaderProgram.timeLocation, banner->currentTime - banner->startTime);
-	glUniform1i(animBannerShaderProgram.texSamplerLocation, 0);
-	CHECK_GL_ERROR();
+		if (item.shader == DRAW_SHADER_SKYBOX)
+			cachedBindTexture(GL_TEXTURE_CUBE_MAP, itemTexture);
+		else if (itemTexture != 0)
+			cachedBindTexture(GL_TEXTURE_2D, itemTexture);
 
-	glBindTexture(GL_TEXTURE_2D, animBannerGeometry->texture);
-	glBindVertexArray(animBannerGeometry->vertexArrayObject);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, animBannerGeometry->numTriangles);
+		switch (item.shader)
+		{
+		case DRAW_SHADER_COMMON:
+		{
+			// block bindings are context state, they survive program changes
+			if (item.transform != transform)
+			{
+				bindTransformBlock(transformsOffset + transformSlots[item.transform] * transformStride);
+				transform = item.transform;
+			}
+
+			const SubMesh * subMesh = item.subMesh;
+			if (item.geometry->materialBuffer != materialBuffer || subMesh->materialOffset != materialOffset)
+			{
+				bindMaterialBlock(item.geometry->materialBuffer, subMesh->materialOffset);
+				materialBuffer = item.geometry->materialBuffer;
+				materialOffset = subMesh->materialOffset;
+			}
+
+			const int itemInstanced = (item.instances != NULL) ? 1 : 0;
+			if (itemInstanced != instanced)
+			{
+				glUniform1i(lit.instancedLocation, itemInstanced);
+				instanced = itemInstanced;
+			}
+
+			const GLsizeiptr indexSize = (item.geometry->indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+			if (item.instances != NULL)
+			{
+				cachedActiveTexture(GL_TEXTURE0 + INSTANCE_TEXTURE_UNIT);
+				cachedBindTexture(GL_TEXTURE_BUFFER, item.instances->texture);
+				cachedActiveTexture(GL_TEXTURE0);
+
+				glDrawElementsInstanced(GL_TRIANGLES, subMesh->numIndices, item.geometry->indexType, (void*)(subMesh->firstIndex * indexSize),
+					item.instances->numInstances);
+			}
+			else
+				glDrawElements(GL_TRIANGLES, subMesh->numIndices, item.geometry->indexType, (void*)(subMesh->firstIndex * indexSize));
+			break;
+		}
 
-	CHECK_GL_ERROR();
+		case DRAW_SHADER_SKYBOX:
+		{
+			if (item.view != view)
+			{
+				glm::mat4 viewRotation = camera.viewMatrix;
+				viewRotation[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 
-	glBindVertexArray(0);
-	glUseProgram(0);
+				glm::mat4 inversePVmatrix = glm::inverse(camera.projectionMatrix * viewRotation);
 
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-}
+				glUniformMatrix4fv(skyboxShaderProgram.inversePVmatrixLocation, 1, GL_FALSE, glm::value_ptr(inversePVmatrix));
+				glUniform1i(skyboxShaderProgram.skyboxSamplerLocation, 0);
+				view = item.view;
+			}
 
-void drawFlame ( FlameObject * flame, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix )
-{
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, item.geometry->numTriangles + 2);
+			break;
+		}
 
-	glUseProgram(flameShaderProgram.program);
+		case DRAW_SHADER_BANNER:
+		case DRAW_SHADER_ANIM_BANNER:
+		{
+			const BannerShaderProgram &banner = (item.shader == DRAW_SHADER_BANNER) ? bannerShaderProgram : animBannerShaderProgram;
 
-	glm::mat4 billboardRotationMatrix = glm::mat4(
-		viewMatrix[0],
-		viewMatrix[1],
-		viewMatrix[2],
-		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
-	);
-	billboardRotationMatrix = glm::transpose(billboardRotationMatrix);
+			glm::mat4 PVMmatrix = camera.PVmatrix * modelMatrix;
+			glUniformMatrix4fv(banner.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix));
+			if (item.shader == DRAW_SHADER_ANIM_BANNER)
+				glUniform1f(banner.timeLocation, item.time);
+			glUniform1i(banner.texSamplerLocation, 0);
 
-	glm::mat4 matrix = glm::translate(glm::mat4(1.0f), flame->position);
-	matrix = glm::scale(matrix, glm::vec3(flame->size));
-	matrix = matrix*billboardRotationMatrix; 
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, item.geometry->numTriangles);
+			break;
+		}
 
-	glm::mat4 PVMmatrix = projectionMatrix * viewMatrix * matrix;
-	glUniformMatrix4fv(flameShaderProgram.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix)); 
-	glUniformMatrix4fv(flameShaderProgram.VmatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));  
-	glUniform1f(flameShaderProgram.timeLocation, flame->currentTime - flame->startTime);
-	glUniform1i(flameShaderProgram.texSamplerLocation, 0);
-	glUniform1f(flameShaderProgram.frameDurationLocation, flame->frameDuration);
+		case DRAW_SHADER_FLAME:
+		{
+			glm::mat4 PVMmatrix = camera.PVmatrix * modelMatrix;
+			glUniformMatrix4fv(flameShaderProgram.PVMmatrixLocation, 1, GL_FALSE, glm::value_ptr(PVMmatrix));
+			glUniformMatrix4fv(flameShaderProgram.VmatrixLocation, 1, GL_FALSE, glm::value_ptr(camera.viewMatrix));
+			glUniform1f(flameShaderProgram.timeLocation, item.time);
+			glUniform1i(flameShaderProgram.texSamplerLocation, 0);
+			glUniform1f(flameShaderProgram.frameDurationLocation, item.frameDuration);
+
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, item.geometry->numTriangles);
+			break;
+		}
+		}
+	}
 
-	glBindVertexArray(flameGeometry->vertexArrayObject);
-	glBindTexture(GL_TEXTURE_2D, flameGeometry->texture);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, flameGeometry->numTriangles);
+	if (gbufferOpen)
+		deferredRenderer->resolve(deferredLightShaderProgram, deferredCompositeShaderProgram, queue.view(gbufferView).projectionMatrix);
 
-	glBindVertexArray(0);
-	glUseProgram(0);
+	// the program and vao stay bound, the next frame most likely starts with them
+	if (pass != NUM_RENDER_PASSES)
+		endRenderPass(pass);
 
-	glDisable(GL_BLEND);
+	CHECK_GL_ERROR();
 }
 
 void initializeBroom ( void )
 {
-	if (!loadSingleMesh(BROOM_STICK_FILE, shaderProgram, &broomGeometry))
+	if (!loadModel(BROOM_STICK_FILE, shaderProgram, &broomGeometry))
 	{
 		std::cerr << "couldn't load broomstick mesh" << std::endl;
 	}
@@ -587,7 +883,7 @@ void initializeBroom ( void )
 
 void initializeCauldron ( void )
 {
-	if (!loadSingleMesh(CAULDRON_FILE, shaderProgram, &cauldronGeometry))
+	if (!loadModel(CAULDRON_FILE, shaderProgram, &cauldronGeometry))
 	{
 		std::cerr << "couldn't load cauldron mesh" << std::endl;
 	}
@@ -596,7 +892,7 @@ void initializeCauldron ( void )
 
 void initializeCastle ( void )
 {
-	if (!loadSingleMesh(CASTLE_FILE, shaderProgram, &castleGeometry))
+	if (!loadModel(CASTLE_FILE, shaderProgram, &castleGeometry))
 	{
 		std::cerr << "couldn't load castle mesh" << std::endl;
 	}
@@ -607,7 +903,7 @@ void initializeCastle ( void )
 
 void initializeWand ( void )
 {
-	if (!loadSingleMesh(WAND_FILE, shaderProgram, &wandGeometry))
+	if (!loadModel(WAND_FILE, shaderProgram, &wandGeometry))
 	{
 		std::cerr << "couldn't load wand mesh" << std::endl;
 	}
@@ -616,7 +912,7 @@ void initializeWand ( void )
 
 void initializeTable ( void )
 {
-	if (!loadSingleMesh(WOODEN_TABLE_FILE, shaderProgram, &tableGeometry))
+	if (!loadModel(WOODEN_TABLE_FILE, shaderProgram, &tableGeometry))
 	{
 		std::cerr << "couldn't load table mesh" << std::endl;
 	}
@@ -625,7 +921,7 @@ void initializeTable ( void )
 
 void initializeDoor ( void )
 {
-	if (!loadSingleMesh(WOODEN_DOOR_FILE, shaderProgram, &doorGeometry))
+	if (!loadModel(WOODEN_DOOR_FILE, shaderProgram, &doorGeometry))
 	{
 		std::cerr << "couldn't load door mesh" << std::endl;
 	}
@@ -634,18 +930,39 @@ void initializeDoor ( void )
 
 void initializeOpenedDoor ( void )
 {
-	if (!loadSingleMesh(WOODEN_DOOR_OPENED_FILE, shaderProgram, &openedDoorGeometry))
+	if (!loadModel(WOODEN_DOOR_OPENED_FILE, shaderProgram, &openedDoorGeometry))
 	{
 		std::cerr << "couldn't load opened door mesh" << std::endl;
 	}
 	CHECK_GL_ERROR();
 }
 
+// hand made meshes are one part with the material of the geometry, the part owns the texture
+static void addWholeMeshPart ( MeshGeometry * geometry )
+{
+	SubMesh part;
+	part.firstIndex = 0;
+	part.numIndices = geometry->numTriangles * 3;
+	part.lod = 0;
+	part.ambient = geometry->ambient;
+	part.diffuse = geometry->diffuse;
+	part.specular = geometry->specular;
+	part.shininess = geometry->shininess;
+	part.texture = geometry->texture;
+	part.stencilId = 0;
+
+	geometry->subMeshes.assign(1, part);
+	geometry->numLods = 1;
+	geometry->texture = 0;
+
+	createMaterialBlocks(geometry);
+}
+
 void initializeGround ( void )
 {
-	groundGeometry = new MeshGeometry;
+	groundGeometry = new MeshGeometry();
 
-	groundGeometry->texture = pgr::createTexture(GROUND_TEXTURE_FILE);
+	groundGeometry->texture = acquireTexture(GROUND_TEXTURE_FILE, assetLoader);
 	glBindTexture(GL_TEXTURE_2D, groundGeometry->texture);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -662,14 +979,9 @@ void initializeGround ( void )
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, groundGeometry->elementBufferObject);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(unsigned int) * groundTrianglesCount, groundIndices, GL_STATIC_DRAW);
 
-	glEnableVertexAttribArray(shaderProgram.posLocation);
-	glVertexAttribPointer(shaderProgram.posLocation, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
-
-	glEnableVertexAttribArray(shaderProgram.texCoordLocation);
-	glVertexAttribPointer(shaderProgram.texCoordLocation, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-
-	glEnableVertexAttribArray(shaderProgram.normalLocation);
-	glVertexAttribPointer(shaderProgram.normalLocation, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+	groundGeometry->vertexLayout = groundVertexLayout;
+	groundGeometry->indexType = GL_UNSIGNED_INT;
+	setupVertexAttributes(groundGeometry->vertexLayout, shaderProgram.posLocation, shaderProgram.normalLocation, shaderProgram.texCoordLocation);
 
 
 	groundGeometry->ambient = glm::vec3(0.0f, 0.2f, 0.0f);
@@ -680,13 +992,20 @@ void initializeGround ( void )
 	glBindVertexArray(0);
 
 	groundGeometry->numTriangles = groundTrianglesCount;
+	addWholeMeshPart(groundGeometry);
+
+	// unit square in the xz plane
+	groundGeometry->boundingBox.min = glm::vec3(0.0f);
+	groundGeometry->boundingBox.max = glm::vec3(1.0f, 0.0f, 1.0f);
+	groundGeometry->boundingCenter = glm::vec3(0.5f, 0.0f, 0.5f);
+	groundGeometry->boundingRadius = 0.5f * sqrtf(2.0f);
 }
 
 void initializeTree ( void )
 {
-	treeGeometry = new MeshGeometry;
+	treeGeometry = new MeshGeometry();
 
-	treeGeometry->texture = pgr::createTexture(TREE_TEXTURE_FILE);
+	treeGeometry->texture = acquireTexture(TREE_TEXTURE_FILE, assetLoader);
 	glBindTexture(GL_TEXTURE_2D, treeGeometry->texture);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -703,14 +1022,10 @@ void initializeTree ( void )
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, treeGeometry->elementBufferObject);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(unsigned int) * treeNTriangles, treeTriangles, GL_STATIC_DRAW);
 
-	glEnableVertexAttribArray(shaderProgram.posLocation);
-	glVertexAttribPointer(shaderProgram.posLocation, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
-
-	glEnableVertexAttribArray(shaderProgram.texCoordLocation);
-	glVertexAttribPointer(shaderProgram.texCoordLocation, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-
-	glEnableVertexAttribArray(shaderProgram.normalLocation);
-	glVertexAttribPointer(shaderProgram.normalLocation, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+	// unlike the ground, the tree vertices are |x,y,z,nx,ny,nz,u,v|
+	treeGeometry->vertexLayout = vertexFormatLayout(VERTEX_FORMAT_FLOAT);
+	treeGeometry->indexType = GL_UNSIGNED_INT;
+	setupVertexAttributes(treeGeometry->vertexLayout, shaderProgram.posLocation, shaderProgram.normalLocation, shaderProgram.texCoordLocation);
 
 
 	treeGeometry->ambient = glm::vec3(0.0f, 0.2f, 0.0f);
@@ -721,30 +1036,319 @@ void initializeTree ( void )
 	glBindVertexArray(0);
 
 	treeGeometry->numTriangles = treeNTriangles;
+	addWholeMeshPart(treeGeometry);
+
+	glm::vec3 low = glm::vec3(FLT_MAX);
+	glm::vec3 high = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < treeNVertices; i++)
+	{
+		const float * vertex = &treeVertices[i * treeNAttribsPerVertex];
+		const glm::vec3 position = glm::vec3(vertex[0], vertex[1], vertex[2]);
+		low = glm::min(low, position);
+		high = glm::max(high, position);
+	}
+	treeGeometry->boundingBox.min = low;
+	treeGeometry->boundingBox.max = high;
+	treeGeometry->boundingCenter = 0.5f * (low + high);
+	treeGeometry->boundingRadius = 0.5f * glm::length(high - low);
 }
 
-void initializeBanner ( void )
+static void rebuildStaticBatch ( void )
 {
-	bannerGeometry = new MeshGeometry;
+	std::vector<StaticBatchObject> objects;
 
-	bannerGeometry->texture = pgr::createTexture(BANNER_TEXTURE_FILE);
-	glBindTexture(GL_TEXTURE_2D, bannerGeometry->texture);
+	for (size_t i = 0; i < staticBatchSources.size(); i++)
+	{
+		updateObjectTransform(staticBatchSources[i].object);
+
+		StaticBatchObject object;
+		object.geometry = *staticBatchSources[i].geometry;
+		object.modelMatrix = staticBatchSources[i].object->modelMatrix;
+		object.normalMatrix = staticBatchSources[i].object->normalMatrix;
+		object.stencilId = staticBatchSources[i].stencilId;
+		objects.push_back(object);
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	cleanupGeometry(staticBatchGeometry);
+	delete staticBatchGeometry;
+	staticBatchGeometry = createStaticBatch(objects, shaderProgram);
 
-	glGenVertexArrays(1, &(bannerGeometry->vertexArrayObject));
-	glBindVertexArray(bannerGeometry->vertexArrayObject);
+	staticBatchOrigin.modelMatrix = glm::mat4(1.0f);
+	staticBatchOrigin.normalMatrix = glm::mat4(1.0f);
+	staticBatchOrigin.transformDirty = false;
 
-	glGenBuffers(1, &(bannerGeometry->vertexBufferObject));
-	glBindBuffer(GL_ARRAY_BUFFER, bannerGeometry->vertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(bannerVertexData), bannerVertexData, GL_STATIC_DRAW);
+	// the batch was created with direct binds
+	invalidateGLState();
+}
 
-	glEnableVertexAttribArray(bannerShaderProgram.posLocation);
-	glEnableVertexAttribArray(bannerShaderProgram.texCoordLocation);
-	// vertices of triangles - start at the beginning of the interlaced array
-	glVertexAttribPointer(bannerShaderProgram.posLocation, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
-	// texture coordinates of each vertices are stored just after its position
-	glVertexAttribPointer(bannerShaderProgram.texCoordLocation, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+void buildStaticBatch ( Object * castle, Object * table, Object * ground )
+{
+	const StaticBatchSource sources[] = {
+		{ &castleGeometry, castle, 0 },
+		{ &tableGeometry,  table,  0 },
+		{ &groundGeometry, ground, 0 },
+	};
+
+	staticBatchSources.assign(sources, sources + sizeof(sources) / sizeof(sources[0]));
+	rebuildStaticBatch();
+}
+
+// every lit mesh drawn without instancing, the static batch or the meshes it merges, whichever is drawn
+static void rebuildIndirectPool ( void )
+{
+	if (indirectRenderer == NULL)
+		return;
+
+	std::vector<const MeshGeometry *> geometries;
+
+	// submitStaticBatch() falls back to the separate meshes without a batch
+	if (indirectPoolBatched && staticBatchGeometry != NULL)
+		geometries.push_back(staticBatchGeometry);
+	else
+	{
+		geometries.push_back(castleGeometry);
+		geometries.push_back(tableGeometry);
+		geometries.push_back(groundGeometry);
+	}
+
+	const MeshGeometry * others[] = {
+		cauldronGeometry, wandGeometry, doorGeometry, openedDoorGeometry, broomGeometry, treeGeometry
+	};
+	geometries.insert(geometries.end(), others, others + sizeof(others) / sizeof(others[0]));
+
+	if (!indirectRenderer->build(geometries, indirectShaderProgram))
+	{
+		delete indirectRenderer;
+		indirectRenderer = NULL;
+	}
+}
+
+void buildIndirectDrawing ( void )
+{
+	if (indirectShaderProgram.program == 0)
+	{
+		std::cout << "Indirect drawing: not supported by the context, the meshes are drawn one by one" << std::endl;
+		return;
+	}
+
+	if (indirectRenderer == NULL)
+		indirectRenderer = new IndirectRenderer();
+	rebuildIndirectPool();
+}
+
+void poolStaticBatch ( bool batched )
+{
+	if (batched == indirectPoolBatched)
+		return;
+
+	indirectPoolBatched = batched;
+	rebuildIndirectPool();
+
+	// the pool is built with direct binds
+	invalidateGLState();
+}
+
+void printIndirectStatistics ( void )
+{
+	if (indirectRenderer == NULL || !indirectDrawing)
+		return;
+
+	std::cout << "Indirect drawing: " << indirectRenderer->multiDraws() << " multi draws, " << indirectRenderer->patchedCommands()
+		<< " commands patched" << std::endl;
+}
+
+void initializeLights ( void )
+{
+	lightClusters = new LightClusters();
+	sceneLights.clear();
+
+	// torches at the door
+	PointLight torch;
+	torch.diffuse = glm::vec3(1.0f, 0.4f, 0.0f);
+	torch.ambient = 0.1f;
+	torch.specular = 0.1f;
+	torch.attenuation = glm::vec3(0.0f, 0.2f, 0.15f);
+
+	torch.position = glm::vec3(4.1f, 1.2f, -22.3f);
+	addPointLight(torch);
+	torch.position = glm::vec3(8.3f, 1.2f, -21.2f);
+	addPointLight(torch);
+}
+
+void addPointLight ( const PointLight &light )
+{
+	sceneLights.push_back(light);
+}
+
+glm::vec4 updateLightClusters ( const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, float nearPlane, float farPlane, int width, int height )
+{
+	if (lightClusters == NULL)
+		return glm::vec4(0.0f);
+
+	lightClusters->update(sceneLights, viewMatrix, projectionMatrix, nearPlane, farPlane, width, height);
+	return lightClusters->clusterParams();
+}
+
+void printLightStatistics ( void )
+{
+	if (lightClusters == NULL)
+		return;
+
+	std::cout << "Lights: " << lightClusters->lightCount() << " of " << sceneLights.size() << " in view, " << lightClusters->clusterEntries()
+		<< " cluster entries, at most " << lightClusters->busiestCluster() << " in one cluster" << std::endl;
+}
+
+static void rebuildOccluders ( void )
+{
+	// model which failed to load
+	if (occluderObject == NULL || castleGeometry == NULL)
+		return;
+
+	updateObjectTransform(occluderObject);
+
+	std::vector<float> meshVertices;
+	std::vector<unsigned int> meshIndices;
+	readBackGeometry(castleGeometry, meshVertices, meshIndices);
+
+	// triangles of the full resolution level only, the vertex clustering of the coarser ones moves the walls outwards
+	// and closes the door and window openings, which would hide objects that are in fact visible
+	const unsigned int lod = 0;
+
+	std::vector<glm::vec3> vertices(meshVertices.size() / meshFloatsPerVertex);
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		const float * vertex = &meshVertices[v * meshFloatsPerVertex];
+		vertices[v] = glm::vec3(occluderObject->modelMatrix * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+	}
+
+	std::vector<unsigned int> lodIndices;
+	for (size_t i = 0; i < castleGeometry->subMeshes.size(); i++)
+	{
+		const SubMesh &subMesh = castleGeometry->subMeshes[i];
+		if (subMesh.lod == lod)
+			lodIndices.insert(lodIndices.end(), meshIndices.begin() + subMesh.firstIndex, meshIndices.begin() + subMesh.firstIndex + subMesh.numIndices);
+	}
+
+	// a subset of the real surface never hides more than the whole model, and the walls, floors and roofs are its
+	// largest triangles while the small ones of the details barely cover anything
+	const unsigned int numTriangles = (unsigned int)lodIndices.size() / 3;
+	std::vector<std::pair<float, unsigned int> > triangleAreas(numTriangles);
+	for (unsigned int t = 0; t < numTriangles; t++)
+	{
+		const glm::vec3 &a = vertices[lodIndices[3 * t]];
+		const glm::vec3 &b = vertices[lodIndices[3 * t + 1]];
+		const glm::vec3 &c = vertices[lodIndices[3 * t + 2]];
+		triangleAreas[t] = std::make_pair(glm::length(glm::cross(b - a, c - a)), t);
+	}
+
+	const unsigned int numOccluders = std::min(numTriangles, OCCLUDER_MAX_TRIANGLES);
+	std::partial_sort(triangleAreas.begin(), triangleAreas.begin() + numOccluders, triangleAreas.end(),
+		std::greater<std::pair<float, unsigned int> >());
+
+	std::vector<unsigned int> indices;
+	indices.reserve(3 * numOccluders);
+	for (unsigned int i = 0; i < numOccluders; i++)
+	{
+		const unsigned int t = triangleAreas[i].second;
+		indices.insert(indices.end(), lodIndices.begin() + 3 * t, lodIndices.begin() + 3 * t + 3);
+	}
+
+	if (occlusionCuller == NULL)
+		occlusionCuller = new OcclusionCuller();
+	occlusionCuller->setOccluders(vertices, indices);
+
+	std::cout << "Occluders: the largest " << occlusionCuller->occluderTriangles() << " of " << numTriangles << " triangles of the castle" << std::endl;
+}
+
+void buildOccluders ( Object * castle )
+{
+	occluderObject = castle;
+	rebuildOccluders();
+}
+
+OcclusionCuller * startOcclusionCulling ( const glm::mat4 &PVmatrix )
+{
+	if (occlusionCuller == NULL)
+		return NULL;
+
+	occlusionCuller->begin(PVmatrix);
+	return occlusionCuller;
+}
+
+void initializeForest ( unsigned int numTrees, const Object * ground, float treeSize )
+{
+	if (treeGeometry == NULL || numTrees == 0)
+		return;
+
+	// the tree model is not centered, the instances stand on the middle of its base
+	const glm::vec3 pivot = glm::vec3(treeGeometry->boundingCenter.x, treeGeometry->boundingBox.min.y, treeGeometry->boundingCenter.z);
+
+	// the same forest on every run
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> groundCoord(0.0f, ground->size);
+	std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+	std::uniform_real_distribution<float> variation(0.75f, 1.25f);
+
+	// one instance buffer per patch of the ground
+	std::vector< std::vector<InstanceData> > chunks(FOREST_CHUNKS * FOREST_CHUNKS);
+
+	for (unsigned int numPlaced = 0; numPlaced < numTrees; )
+	{
+		const glm::vec3 position = ground->position + glm::vec3(groundCoord(random), 0.0f, groundCoord(random));
+
+		if (position.x > FOREST_CLEARING_MIN.x && position.x < FOREST_CLEARING_MAX.x && position.z > FOREST_CLEARING_MIN.y && position.z < FOREST_CLEARING_MAX.y)
+			continue;
+
+		glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), position);
+		modelMatrix = glm::rotate(modelMatrix, glm::radians(angle(random)), glm::vec3(0.0f, 1.0f, 0.0f));
+		modelMatrix = glm::scale(modelMatrix, glm::vec3(treeSize * variation(random)));
+		modelMatrix = glm::translate(modelMatrix, -pivot);
+
+		InstanceData tree;
+		tree.modelMatrix = modelMatrix;
+		tree.tint = glm::vec4(variation(random), variation(random), variation(random), 1.0f);
+
+		const int chunkX = std::min((int)((position.x - ground->position.x) / ground->size * FOREST_CHUNKS), FOREST_CHUNKS - 1);
+		const int chunkZ = std::min((int)((position.z - ground->position.z) / ground->size * FOREST_CHUNKS), FOREST_CHUNKS - 1);
+		chunks[chunkZ * FOREST_CHUNKS + chunkX].push_back(tree);
+		numPlaced++;
+	}
+
+	for (size_t i = 0; i < forestChunks.size(); i++)
+		deleteInstanceBuffer(forestChunks[i]);
+	forestChunks.clear();
+
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].empty())
+			forestChunks.push_back(createInstanceBuffer(chunks[i]));
+	}
+
+	std::cout << "Forest: " << numTrees << " trees in " << forestChunks.size() << " draw calls" << std::endl;
+}
+
+void initializeBanner ( void )
+{
+	bannerGeometry = new MeshGeometry();
+
+	bannerGeometry->texture = acquireTexture(BANNER_TEXTURE_FILE, assetLoader);
+	glBindTexture(GL_TEXTURE_2D, bannerGeometry->texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+	glGenVertexArrays(1, &(bannerGeometry->vertexArrayObject));
+	glBindVertexArray(bannerGeometry->vertexArrayObject);
+
+	glGenBuffers(1, &(bannerGeometry->vertexBufferObject));
+	glBindBuffer(GL_ARRAY_BUFFER, bannerGeometry->vertexBufferObject);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(bannerVertexData), bannerVertexData, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(bannerShaderProgram.posLocation);
+	glEnableVertexAttribArray(bannerShaderProgram.texCoordLocation);
+	// vertices of triangles - start at the beginning of the interlaced array
+	glVertexAttribPointer(bannerShaderProgram.posLocation, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
+	// texture coordinates of each vertices are stored just after its position
+	glVertexAttribPointer(bannerShaderProgram.texCoordLocation, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
 	glBindVertexArray(0);
 
@@ -753,9 +1357,9 @@ void initializeBanner ( void )
 
 void initializeAnimatedBanner ( void )
 {
-	animBannerGeometry = new MeshGeometry;
+	animBannerGeometry = new MeshGeometry();
 
-	animBannerGeometry->texture = pgr::createTexture(ANIM_BANNER_TEXTURE_FILE);
+	animBannerGeometry->texture = acquireTexture(ANIM_BANNER_TEXTURE_FILE, assetLoader);
 	glBindTexture(GL_TEXTURE_2D, animBannerGeometry->texture);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
@@ -781,7 +1385,7 @@ void initializeAnimatedBanner ( void )
 
 void initializeFlame ( void )
 {
-	flameGeometry = new MeshGeometry;
+	flameGeometry = new MeshGeometry();
 
 	glGenVertexArrays(1, &(flameGeometry->vertexArrayObject));
 	glBindVertexArray(flameGeometry->vertexArrayObject);
@@ -798,13 +1402,13 @@ void initializeFlame ( void )
 
 	glBindVertexArray(0);
 
-	flameGeometry->texture = pgr::createTexture(FLAME_TEXTURE_FILE);
+	flameGeometry->texture = acquireTexture(FLAME_TEXTURE_FILE, assetLoader);
 	flameGeometry->numTriangles = flameNumQuadVertices;
 }
 
-void initializeSkybox(GLuint shader, MeshGeometry ** geometry)
+void initializeSkybox(GLuint shader, MeshGeometry ** geometry, const DecodedImage * bakedCubeMap)
 {
-	*geometry = new MeshGeometry;
+	*geometry = new MeshGeometry();
 
 	// 2D coordinates of 2 triangles covering the whole screen (NDC), draw using triangle strip
 	static const float screenCoords[] = {
@@ -849,25 +1453,39 @@ void initializeSkybox(GLuint shader, MeshGeometry ** geometry)
 		GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
 	};
 
-	std::vector<const GLchar*> faces;
-
-	faces.push_back("vendor/skybox/hills_rt.jpg");
-	faces.push_back("vendor/skybox/hills_lf.jpg");
-	faces.push_back("vendor/skybox/hills_up.jpg");
-	faces.push_back("vendor/skybox/hills_dn.jpg");
-	faces.push_back("vendor/skybox/hills_bk.jpg");
-	faces.push_back("vendor/skybox/hills_ft.jpg");
+	bool mipmapped = true;
 
-	for( int i = 0; i < 6; i++ ) 
+	if ( bakedCubeMap != NULL )
 	{
-		std::string texName = faces[i];
+		std::cout << "Loading cube map texture: " << SKYBOX_CUBE_MAP_FILE << std::endl;
 
-		std::cout << "Loading cube map texture: " << texName << std::endl;
+		for( int i = 0; i < 6; i++ ) 
+			uploadTextureImage(targets[i], *bakedCubeMap, i);
+	}
+	else
+	{
+		// faces are decoded in parallel on the asset loader threads, they are uploaded as they come
+		DecodedImage faces[6];
 
-		if(!pgr::loadTexImage2D(texName, targets[i])) 
+		for( int i = 0; i < 6; i++ ) 
 		{
-			pgr::dieWithError("Skybox cube map loading failed!");
+			std::cout << "Loading cube map texture: " << SKYBOX_FACE_FILES[i] << std::endl;
+
+			bool loaded = (assetLoader != NULL) ? assetLoader->takeImage(SKYBOX_FACE_FILES[i], faces[i]) : loadImage(SKYBOX_FACE_FILES[i], compressedTexturesSupported(), faces[i]);
+			if ( !loaded ) 
+			{
+				pgr::dieWithError("Skybox cube map loading failed!");
+			}
+
+			// compressed faces come with their baked mip chains
+			if ( !uploadTextureImage(targets[i], faces[i]) )
+				mipmapped = false;
 		}
+
+		// next run reads the one baked file instead of six
+		DecodedImage cubeMap;
+		if ( buildCubeMap(faces, cubeMap) && !writeCubeMapCache(SKYBOX_CUBE_MAP_FILE, SKYBOX_FACE_FILES, cubeMap) )
+			std::cerr << "couldn't bake cube map file: " << SKYBOX_CUBE_MAP_FILE << std::endl;
 	}
 
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -875,96 +1493,118 @@ void initializeSkybox(GLuint shader, MeshGeometry ** geometry)
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	if ( !mipmapped )
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
 	// unbind the texture (just in case someone will mess up with texture calls later)
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 	CHECK_GL_ERROR();
 }
 
-void initializeShaderPrograms( void )
+static void getLitShaderLocations ( SCommonShaderProgram &lit )
 {
-	std::vector<GLuint> shaderList;
-
-	// push back shaders for objects
-	shaderList.push_back( pgr::createShaderFromFile ( GL_VERTEX_SHADER, "perFrag.vs" ) );
-	shaderList.push_back( pgr::createShaderFromFile ( GL_FRAGMENT_SHADER, "perFrag.fs" ) );
+	//load attrib locations from the program
+	lit.posLocation = glGetAttribLocation(lit.program, "position");
+	lit.normalLocation = glGetAttribLocation(lit.program, "normal");
+	lit.texCoordLocation = glGetAttribLocation(lit.program, "texCoord");
+
+	// per frame, per material and per draw uniforms come from buffers
+	bindUniformBlocks(lit.program);
+	lit.frameBlockIndex = glGetUniformBlockIndex(lit.program, "FrameBlock");
+	lit.materialBlockIndex = glGetUniformBlockIndex(lit.program, "MaterialBlock");
+	lit.transformBlockIndex = glGetUniformBlockIndex(lit.program, "TransformBlock");
+
+	lit.texSamplerLocation = glGetUniformLocation(lit.program, "texSampler");
+	lit.instancedLocation = glGetUniformLocation(lit.program, "instanced");
+	lit.instanceSamplerLocation = glGetUniformLocation(lit.program, "instanceSampler");
+	getLightSamplerLocations(lit.program, lit.lightSamplers);
+
+	lit.cauldronLightLocation = glGetUniformLocation(lit.program, "cauldronLight");
+}
 
-	shaderProgram.program = pgr::createProgram ( shaderList );
+static void getCommonShaderLocations ( void )
+{
+	getLitShaderLocations(shaderProgram);
+}
 
-	//load attrib locations from shaderProgram.program
-	shaderProgram.posLocation = glGetAttribLocation(shaderProgram.program, "position");
-	shaderProgram.normalLocation = glGetAttribLocation(shaderProgram.program, "normal");
-	shaderProgram.texCoordLocation = glGetAttribLocation(shaderProgram.program, "texCoord");
+static void getGBufferShaderLocations ( void )
+{
+	getLitShaderLocations(gbufferShaderProgram);
+}
 
-	shaderProgram.PVMmatrixLocation = glGetUniformLocation(shaderProgram.program, "PVMmatrix");
-	shaderProgram.VmatrixLocation = glGetUniformLocation(shaderProgram.program, "Vmatrix");
-	shaderProgram.MmatrixLocation = glGetUniformLocation(shaderProgram.program, "Mmatrix");
-	shaderProgram.normalMatrixLocation = glGetUniformLocation(shaderProgram.program, "normalMatrix");
-	shaderProgram.timeLocation = glGetUniformLocation(shaderProgram.program, "time");
-	shaderProgram.ambientLocation = glGetUniformLocation(shaderProgram.program, "material.ambient");
-	shaderProgram.diffuseLocation = glGetUniformLocation(shaderProgram.program, "material.diffuse");
-	shaderProgram.specularLocation = glGetUniformLocation(shaderProgram.program, "material.specular");
-	shaderProgram.shininessLocation = glGetUniformLocation(shaderProgram.program, "material.shininess");
+static void getDeferredShaderLocations ( DeferredShaderProgram &deferred )
+{
+	static const char * samplers[NUM_GBUFFER_TARGETS] = { "gAlbedoSampler", "gDiffuseSampler", "gAmbientSampler", "gSpecularSampler" };
 
-	shaderProgram.texSamplerLocation = glGetUniformLocation(shaderProgram.program, "texSampler");
-	shaderProgram.useTextureLocation = glGetUniformLocation(shaderProgram.program, "material.useTexture");
+	bindUniformBlocks(deferred.program);
 
-	shaderProgram.reflectorPositionLocation = glGetUniformLocation(shaderProgram.program, "reflectorPosition");
-	shaderProgram.reflectorDirectionLocation = glGetUniformLocation(shaderProgram.program, "reflectorDirection");
-	shaderProgram.reflectorLocation = glGetUniformLocation(shaderProgram.program, "reflectOn");
+	deferred.inverseProjectionLocation = glGetUniformLocation(deferred.program, "inverseProjection");
+	for (int i = 0; i < NUM_GBUFFER_TARGETS; i++)
+		deferred.samplerLocations[i] = glGetUniformLocation(deferred.program, samplers[i]);
+	deferred.depthSamplerLocation = glGetUniformLocation(deferred.program, "gDepthSampler");
+	deferred.accumulationSamplerLocation = glGetUniformLocation(deferred.program, "accumulationSampler");
+	getLightSamplerLocations(deferred.program, deferred.lightSamplers);
+}
 
-	shaderProgram.fogLocation = glGetUniformLocation(shaderProgram.program, "fogOn");
+static void getDeferredLightShaderLocations ( void )
+{
+	getDeferredShaderLocations(deferredLightShaderProgram);
+}
 
-	shaderProgram.dirLightLocation = glGetUniformLocation(shaderProgram.program, "dirLight");
+static void getDeferredCompositeShaderLocations ( void )
+{
+	getDeferredShaderLocations(deferredCompositeShaderProgram);
+}
 
-	shaderProgram.cauldronLightLocation = glGetUniformLocation(shaderProgram.program, "cauldronLight");
+static void getIndirectLocations ( IndirectShaderProgram &indirect )
+{
+	indirect.posLocation = glGetAttribLocation(indirect.program, "position");
+	indirect.normalLocation = glGetAttribLocation(indirect.program, "normal");
+	indirect.texCoordLocation = glGetAttribLocation(indirect.program, "texCoord");
+	indirect.drawIndexLocation = glGetAttribLocation(indirect.program, "drawIndex");
 
-	shaderList.clear();
+	// the materials and transforms are in shader storage buffers bound by the IndirectRenderer
+	bindUniformBlocks(indirect.program);
 
-	shaderList.push_back(pgr::createShaderFromFile(GL_VERTEX_SHADER, "banner.vs"));
-	shaderList.push_back(pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "banner.fs"));
+	indirect.PVmatrixLocation = glGetUniformLocation(indirect.program, "PVmatrix");
+	indirect.texSamplerLocation = glGetUniformLocation(indirect.program, "texSampler");
+	getLightSamplerLocations(indirect.program, indirect.lightSamplers);
+}
 
-	bannerShaderProgram.program = pgr::createProgram(shaderList);
+static void getIndirectShaderLocations ( void )
+{
+	getIndirectLocations(indirectShaderProgram);
+}
 
+static void getBannerShaderLocations ( void )
+{
 	bannerShaderProgram.posLocation = glGetAttribLocation(bannerShaderProgram.program, "position");
 	bannerShaderProgram.texCoordLocation = glGetAttribLocation(bannerShaderProgram.program, "texCoord");
 
 	bannerShaderProgram.PVMmatrixLocation = glGetUniformLocation(bannerShaderProgram.program, "PVMmatrix");
 	bannerShaderProgram.texSamplerLocation = glGetUniformLocation(bannerShaderProgram.program, "texSampler");
+}
 
-	shaderList.clear();
-
-	shaderList.push_back(pgr::createShaderFromFile(GL_VERTEX_SHADER, "animBanner.vs"));
-	shaderList.push_back(pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "animBanner.fs"));
-
-	animBannerShaderProgram.program = pgr::createProgram(shaderList);
-
+static void getAnimBannerShaderLocations ( void )
+{
 	animBannerShaderProgram.posLocation = glGetAttribLocation(animBannerShaderProgram.program, "position");
 	animBannerShaderProgram.texCoordLocation = glGetAttribLocation(animBannerShaderProgram.program, "texCoord");
 	animBannerShaderProgram.PVMmatrixLocation = glGetUniformLocation(animBannerShaderProgram.program, "PVMmatrix");
 	animBannerShaderProgram.timeLocation = glGetUniformLocation(animBannerShaderProgram.program, "time");
 	animBannerShaderProgram.texSamplerLocation = glGetUniformLocation(animBannerShaderProgram.program, "texSampler");
+}
 
-	shaderList.clear();
-
-	shaderList.push_back(pgr::createShaderFromFile(GL_VERTEX_SHADER, "skybox.vs"));
-	shaderList.push_back(pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "skybox.fs"));
-
-	skyboxShaderProgram.program = pgr::createProgram(shaderList);
-
+static void getSkyboxShaderLocations ( void )
+{
 	skyboxShaderProgram.screenCoordLocation = glGetAttribLocation(skyboxShaderProgram.program, "screenCoord");
 
 	skyboxShaderProgram.skyboxSamplerLocation = glGetUniformLocation(skyboxShaderProgram.program, "skyboxSampler");
 	skyboxShaderProgram.inversePVmatrixLocation = glGetUniformLocation(skyboxShaderProgram.program, "inversePVmatrix");
 	skyboxShaderProgram.fogOnLocation = glGetUniformLocation(skyboxShaderProgram.program, "fogOn");
+}
 
-	shaderList.clear();
-
-	shaderList.push_back(pgr::createShaderFromFile(GL_VERTEX_SHADER, "flame.vs"));
-	shaderList.push_back(pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "flame.fs"));
-
-	flameShaderProgram.program = pgr::createProgram(shaderList);
+static void getFlameShaderLocations ( void )
+{
 	flameShaderProgram.posLocation = glGetAttribLocation(flameShaderProgram.program, "position");
 	flameShaderProgram.texCoordLocation = glGetAttribLocation(flameShaderProgram.program, "texCoord");
 	flameShaderProgram.PVMmatrixLocation = glGetUniformLocation(flameShaderProgram.program, "PVMmatrix");
@@ -972,11 +1612,200 @@ void initializeShaderPrograms( void )
 	flameShaderProgram.timeLocation = glGetUniformLocation(flameShaderProgram.program, "time");
 	flameShaderProgram.texSamplerLocation = glGetUniformLocation(flameShaderProgram.program, "texSampler");
 	flameShaderProgram.frameDurationLocation = glGetUniformLocation(flameShaderProgram.program, "frameDuration");
-	shaderList.clear();
+}
+
+// every program with its sources and the function filling its location struct
+typedef struct ShaderProgramFiles
+{
+	const char *  vertexShaderFile;
+	const char *  fragmentShaderFile;
+	GLuint *      program;
+	void       (* getLocations) ( void );
+	bool       (* supported) ( void );     // optional programs are left 0 without it, NULL = always built
+	GLuint *      attributesOf;             // program whose attribute locations the first build takes, its vaos are shared
+
+} ShaderProgramFiles;
+
+static bool deferredShadingRequested ( void )
+{
+	return deferredShading;
+}
+
+static const ShaderProgramFiles SHADER_PROGRAM_FILES[] = {
+	{ "perFrag.vs",    "perFrag.fs",           &shaderProgram.program,                  getCommonShaderLocations,            NULL,                     NULL },
+	{ "banner.vs",     "banner.fs",            &bannerShaderProgram.program,            getBannerShaderLocations,            NULL,                     NULL },
+	{ "animBanner.vs", "animBanner.fs",        &animBannerShaderProgram.program,        getAnimBannerShaderLocations,        NULL,                     NULL },
+	{ "skybox.vs",     "skybox.fs",            &skyboxShaderProgram.program,            getSkyboxShaderLocations,            NULL,                     NULL },
+	{ "flame.vs",      "flame.fs",             &flameShaderProgram.program,             getFlameShaderLocations,             NULL,                     NULL },
+	{ "indirect.vs",   "perFrag.fs",           &indirectShaderProgram.program,          getIndirectShaderLocations,          indirectDrawSupported,    NULL },
+	{ "perFrag.vs",    "gbuffer.fs",           &gbufferShaderProgram.program,           getGBufferShaderLocations,           deferredShadingRequested, &shaderProgram.program },
+	{ "deferred.vs",   "deferredLight.fs",     &deferredLightShaderProgram.program,     getDeferredLightShaderLocations,     deferredShadingRequested, NULL },
+	{ "deferred.vs",   "deferredComposite.fs", &deferredCompositeShaderProgram.program, getDeferredCompositeShaderLocations, deferredShadingRequested, NULL },
+};
+static const int NUM_SHADER_PROGRAMS = sizeof(SHADER_PROGRAM_FILES) / sizeof(SHADER_PROGRAM_FILES[0]);
+
+/** Build the program again from its sources or its binary cache file, the running one is replaced only if the new one links.
+* Attributes keep the locations they had in the old program, so the vaos set up for it stay valid.
+* \return the new program, 0 if compiling or linking failed
+*/
+static GLuint relinkShaderProgram ( const ShaderProgramFiles &files )
+{
+	// the first build of an optional program takes them from the program it shares vaos with, if any
+	GLuint source = *files.program;
+	if (source == 0 && files.attributesOf != NULL)
+		source = *files.attributesOf;
+
+	return linkShaderProgram(files.vertexShaderFile, files.fragmentShaderFile, "", source);
+}
+
+// drop the variants of the sources using the file, they are linked again from the new source when drawn
+static void clearShaderVariants ( const std::string &fileName )
+{
+	if ( litVariantCache != NULL && litVariantCache->uses ( fileName ) )
+	{
+		litVariantCache->clear ( );
+		for ( unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++ )
+			litVariants[i].program = 0;
+	}
+
+	if ( indirectVariantCache != NULL && indirectVariantCache->uses ( fileName ) )
+	{
+		indirectVariantCache->clear ( );
+		for ( unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++ )
+			indirectVariants[i].program = 0;
+	}
+}
+
+/** Lit program for the switches of the frame and the texture of the part, the generic one if variants are off or fail.
+* \param features ShaderFeature bits
+*/
+static const SCommonShaderProgram & litShaderVariant ( unsigned int features )
+{
+	const GLuint program = ( shaderVariants && litVariantCache != NULL ) ? litVariantCache->program ( features, shaderProgram.program ) : 0;
+	if ( program == 0 )
+		return shaderProgram;
+
+	// a variant linked anew, its locations are looked up once
+	SCommonShaderProgram &variant = litVariants[features];
+	if ( variant.program != program )
+	{
+		variant.program = program;
+		getLitShaderLocations ( variant );
+	}
+
+	return variant;
+}
+
+static const IndirectShaderProgram & indirectShaderVariant ( unsigned int features )
+{
+	const GLuint program = ( shaderVariants && indirectVariantCache != NULL ) ? indirectVariantCache->program ( features, indirectShaderProgram.program ) : 0;
+	if ( program == 0 )
+		return indirectShaderProgram;
+
+	IndirectShaderProgram &variant = indirectVariants[features];
+	if ( variant.program != program )
+	{
+		variant.program = program;
+		getIndirectLocations ( variant );
+	}
+
+	return variant;
+}
+
+void setFrameShaderFeatures ( bool dirLight, bool reflectOn, bool fogOn )
+{
+	frameShaderFeatures = 0;
+	if ( dirLight )
+		frameShaderFeatures |= SHADER_FEATURE_DIRECT_LIGHT;
+	if ( reflectOn )
+		frameShaderFeatures |= SHADER_FEATURE_REFLECTOR;
+	if ( fogOn )
+		frameShaderFeatures |= SHADER_FEATURE_FOG;
+}
+
+void printShaderVariantStatistics ( void )
+{
+	if ( !shaderVariants || litVariantCache == NULL )
+		return;
+
+	std::cout << "Shader variants: " << litVariantCache->linkedVariants() << " of perFrag.vs + perFrag.fs";
+	if ( indirectVariantCache != NULL )
+		std::cout << ", " << indirectVariantCache->linkedVariants() << " of indirect.vs + perFrag.fs";
+	std::cout << " linked" << std::endl;
+}
+
+void initializeShaderPrograms( void )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for ( int i = 0; i < NUM_SHADER_PROGRAMS; i++ )
+	{
+		// optional programs may fail to build, the renderer then does without them
+		if ( SHADER_PROGRAM_FILES[i].supported != NULL )
+		{
+			*SHADER_PROGRAM_FILES[i].program = 0;
+			if ( SHADER_PROGRAM_FILES[i].supported ( ) )
+				*SHADER_PROGRAM_FILES[i].program = relinkShaderProgram ( SHADER_PROGRAM_FILES[i] );
+			if ( *SHADER_PROGRAM_FILES[i].program != 0 )
+				SHADER_PROGRAM_FILES[i].getLocations ( );
+			continue;
+		}
+
+		// restored from the binary cache when the sources did not change since the last run
+		*SHADER_PROGRAM_FILES[i].program = relinkShaderProgram ( SHADER_PROGRAM_FILES[i] );
+		SHADER_PROGRAM_FILES[i].getLocations ( );
+	}
+
+	std::cout << "Shader programs: " << programCacheHits() << " from the binary cache, " << programCacheMisses() << " compiled, "
+		<< std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count() << " ms" << std::endl;
+
+	// deferred shading needs all three of its programs, forward shading is the fallback
+	if ( deferredShading )
+	{
+		if ( gbufferShaderProgram.program != 0 && deferredLightShaderProgram.program != 0 && deferredCompositeShaderProgram.program != 0 )
+			deferredRenderer = new DeferredRenderer ( );
+		else
+			std::cerr << "Deferred shading: the G-buffer or lighting programs failed to build, shading forward" << std::endl;
+	}
+
+	// the variants are linked when their combination is drawn first
+	litVariantCache = new ShaderVariantCache ( "perFrag.vs", "perFrag.fs" );
+	if ( indirectShaderProgram.program != 0 )
+		indirectVariantCache = new ShaderVariantCache ( "indirect.vs", "perFrag.fs" );
+
+	initializeUniformBuffers ( );
 }
 
 void initializeModels( void )
 {
+	// block compressed textures are cooked on the first run if the context can use them
+	assetLoader = new AssetLoader(0, compressedTexturesSupported());
+
+	// skybox faces are the largest images, they go first unless there is an up to date baked cube map
+	DecodedImage skyboxCubeMap;
+	const bool skyboxBaked = compressedTexturesSupported() && openCubeMapCache(SKYBOX_CUBE_MAP_FILE, SKYBOX_FACE_FILES, skyboxCubeMap);
+
+	if ( !skyboxBaked )
+	{
+		for ( int i = 0; i < 6; i++ )
+			assetLoader->prefetchImage ( SKYBOX_FACE_FILES[i] );
+	}
+
+	// start the CPU half of every asset on the worker threads, the GL thread then uploads them in order
+	assetLoader->prefetchImage ( GROUND_TEXTURE_FILE );
+	assetLoader->prefetchMesh ( BROOM_STICK_FILE );
+	assetLoader->prefetchMesh ( CAULDRON_FILE );
+	assetLoader->prefetchMesh ( CASTLE_FILE );
+	assetLoader->prefetchMesh ( WAND_FILE );
+	assetLoader->prefetchMesh ( WOODEN_TABLE_FILE );
+	assetLoader->prefetchImage ( TREE_TEXTURE_FILE );
+	assetLoader->prefetchMesh ( WOODEN_DOOR_FILE );
+	assetLoader->prefetchMesh ( WOODEN_DOOR_OPENED_FILE );
+
+	assetLoader->prefetchImage ( BANNER_TEXTURE_FILE );
+	assetLoader->prefetchImage ( ANIM_BANNER_TEXTURE_FILE );
+	assetLoader->prefetchImage ( FLAME_TEXTURE_FILE );
+
 	initializeGround ( );
 	initializeBroom ( );
 	initializeCauldron ( );
@@ -987,31 +1816,137 @@ void initializeModels( void )
 	initializeDoor ( );	
 	initializeOpenedDoor ( );
 
-	initializeSkybox ( skyboxShaderProgram.program, &skyboxGeometry );
+	initializeSkybox ( skyboxShaderProgram.program, &skyboxGeometry, skyboxBaked ? &skyboxCubeMap : NULL );
 	initializeBanner ( );
 	initializeAnimatedBanner ( );
 
 	initializeFlame ( );
+
+	delete assetLoader;
+	assetLoader = NULL;
+
+	// uploads above bound objects directly
+	invalidateGLState ( );
+
+	printTextureStatistics ( );
+}
+
+bool cookSceneAssets( void )
+{
+	// image library is otherwise initialized together with the window by pgr::initialize()
+	ilInit();
+
+	const std::string meshFiles[] = {
+		BROOM_STICK_FILE, CAULDRON_FILE, CASTLE_FILE, WAND_FILE, WOODEN_TABLE_FILE, WOODEN_DOOR_FILE, WOODEN_DOOR_OPENED_FILE
+	};
+	const std::string imageFiles[] = {
+		GROUND_TEXTURE_FILE, TREE_TEXTURE_FILE, BANNER_TEXTURE_FILE, ANIM_BANNER_TEXTURE_FILE, FLAME_TEXTURE_FILE
+	};
+	const int numMeshFiles = sizeof(meshFiles) / sizeof(meshFiles[0]);
+	const int numImageFiles = sizeof(imageFiles) / sizeof(imageFiles[0]);
+
+	AssetLoader loader(0, true);
+	bool ok = true;
+
+	for ( int i = 0; i < numMeshFiles; i++ )
+		loader.prefetchMesh ( meshFiles[i] );
+	for ( int i = 0; i < numImageFiles; i++ )
+		loader.prefetchImage ( imageFiles[i] );
+	for ( int i = 0; i < 6; i++ )
+		loader.prefetchImage ( SKYBOX_FACE_FILES[i] );
+
+	// material textures are known (and prefetched) only after their mesh is loaded
+	std::vector<std::string> textureFiles(imageFiles, imageFiles + numImageFiles);
+	textureFiles.insert(textureFiles.end(), SKYBOX_FACE_FILES, SKYBOX_FACE_FILES + 6);
+
+	for ( int i = 0; i < numMeshFiles; i++ )
+	{
+		LoadedMesh * mesh = loader.takeMesh ( meshFiles[i] );
+		if ( mesh == NULL )
+		{
+			ok = false;
+			continue;
+		}
+
+		for ( size_t m = 0; m < mesh->materials->size(); m++ )
+		{
+			const std::string &textureName = (*mesh->materials)[m].textureName;
+			if ( !textureName.empty() && std::find(textureFiles.begin(), textureFiles.end(), textureName) == textureFiles.end() )
+				textureFiles.push_back ( textureName );
+		}
+		delete mesh;
+	}
+
+	DecodedImage faces[6];
+
+	for ( size_t i = 0; i < textureFiles.size(); i++ )
+	{
+		DecodedImage image;
+		if ( !loader.takeImage ( textureFiles[i], image ) )
+			ok = false;
+		else
+			std::cout << "Cooked " << textureCacheFileName(textureFiles[i]) << std::endl;
+
+		for ( int f = 0; f < 6; f++ )
+		{
+			if ( textureFiles[i] == SKYBOX_FACE_FILES[f] )
+				std::swap ( faces[f], image );
+		}
+	}
+
+	DecodedImage cubeMap;
+	if ( buildCubeMap(faces, cubeMap) && writeCubeMapCache(SKYBOX_CUBE_MAP_FILE, SKYBOX_FACE_FILES, cubeMap) )
+		std::cout << "Cooked " << SKYBOX_CUBE_MAP_FILE << std::endl;
+	else
+		ok = false;
+
+	return ok;
 }
 
 void cleanupShaderPrograms( void )
 {
-	pgr::deleteProgramAndShaders ( shaderProgram.program );
-	pgr::deleteProgramAndShaders ( skyboxShaderProgram.program );
-	pgr::deleteProgramAndShaders ( bannerShaderProgram.program );
-	pgr::deleteProgramAndShaders ( flameShaderProgram.program );
+	for ( int i = 0; i < NUM_SHADER_PROGRAMS; i++ )
+	{
+		if ( *SHADER_PROGRAM_FILES[i].program != 0 )
+			pgr::deleteProgramAndShaders ( *SHADER_PROGRAM_FILES[i].program );
+	}
+
+	delete deferredRenderer;
+	deferredRenderer = NULL;
+
+	delete litVariantCache;
+	delete indirectVariantCache;
+	litVariantCache = NULL;
+	indirectVariantCache = NULL;
+	for ( unsigned int i = 0; i < NUM_SHADER_VARIANTS; i++ )
+	{
+		litVariants[i].program = 0;
+		indirectVariants[i].program = 0;
+	}
+
+	cleanupUniformBuffers ( );
+}
+
+bool deferredShadingActive ( void )
+{
+	return deferredRenderer != NULL;
 }
 
 void cleanupGeometry(MeshGeometry * geometry)
 {
+	// model which failed to load
+	if (geometry == NULL)
+		return;
+
 	glDeleteVertexArrays(1, &(geometry->vertexArrayObject));
 	glDeleteBuffers(1, &(geometry->elementBufferObject));
 	glDeleteBuffers(1, &(geometry->vertexBufferObject));
+	glDeleteBuffers(1, &(geometry->materialBuffer));
 
-	if (geometry->texture)
-	{
-		glDeleteTextures(1, &(geometry->texture));
-	}
+	// every part holds its own reference of a shared texture
+	releaseTexture(geometry->texture);
+	for (size_t i = 0; i < geometry->subMeshes.size(); i++)
+		releaseTexture(geometry->subMeshes[i].texture);
 }
 
 void cleanupModels( void ) 
@@ -1025,6 +1960,232 @@ void cleanupModels( void )
 	cleanupGeometry( doorGeometry );
 	cleanupGeometry( openedDoorGeometry );
 	cleanupGeometry( groundGeometry );
+	cleanupGeometry( treeGeometry );
 	cleanupGeometry( bannerGeometry );
+	cleanupGeometry( animBannerGeometry );
 	cleanupGeometry( flameGeometry );	
-}
\ No newline at end of file
+
+	delete lightClusters;
+	lightClusters = NULL;
+
+	for ( size_t i = 0; i < forestChunks.size(); i++ )
+		deleteInstanceBuffer( forestChunks[i] );
+	forestChunks.clear();
+
+	cleanupGeometry( staticBatchGeometry );
+	delete staticBatchGeometry;
+	staticBatchGeometry = NULL;
+	staticBatchSources.clear();
+
+	delete occlusionCuller;
+	occlusionCuller = NULL;
+	occluderObject = NULL;
+
+	delete indirectRenderer;
+	indirectRenderer = NULL;
+}
+// models recreated when their source file changes
+typedef struct ModelFile
+{
+	const std::string *  fileName;
+	MeshGeometry **      geometry;
+
+} ModelFile;
+
+static const ModelFile MODEL_FILES[] = {
+	{ &BROOM_STICK_FILE,        &broomGeometry },
+	{ &CAULDRON_FILE,           &cauldronGeometry },
+	{ &CASTLE_FILE,             &castleGeometry },
+	{ &WAND_FILE,               &wandGeometry },
+	{ &WOODEN_TABLE_FILE,       &tableGeometry },
+	{ &WOODEN_DOOR_FILE,        &doorGeometry },
+	{ &WOODEN_DOOR_OPENED_FILE, &openedDoorGeometry },
+};
+static const int NUM_MODEL_FILES = sizeof(MODEL_FILES) / sizeof(MODEL_FILES[0]);
+
+// sources of shaders, models and textures, watched while the game runs
+FileWatcher * fileWatcher = NULL;
+
+// images of reloaded models may be new, the watcher ignores files it already has
+static void watchTextureFiles ( void )
+{
+	std::vector<std::string> textureFiles;
+	managedTextureFiles ( textureFiles );
+
+	for ( size_t i = 0; i < textureFiles.size(); i++ )
+		fileWatcher->watch ( textureFiles[i] );
+}
+
+void initializeHotReload( void )
+{
+	fileWatcher = new FileWatcher;
+
+	for ( int i = 0; i < NUM_SHADER_PROGRAMS; i++ )
+	{
+		fileWatcher->watch ( SHADER_PROGRAM_FILES[i].vertexShaderFile );
+		fileWatcher->watch ( SHADER_PROGRAM_FILES[i].fragmentShaderFile );
+	}
+
+	std::vector<std::string> commonFiles;
+	commonShaderFiles ( commonFiles );
+	for ( size_t i = 0; i < commonFiles.size(); i++ )
+		fileWatcher->watch ( commonFiles[i] );
+	for ( int i = 0; i < NUM_MODEL_FILES; i++ )
+		fileWatcher->watch ( *MODEL_FILES[i].fileName );
+	for ( int i = 0; i < 6; i++ )
+		fileWatcher->watch ( SKYBOX_FACE_FILES[i] );
+
+	watchTextureFiles ( );
+}
+
+// relink every program using the shader or common source, the location struct is refilled from the new program
+static bool reloadShaderFile ( const std::string &fileName )
+{
+	bool used = false;
+
+	for ( int i = 0; i < NUM_SHADER_PROGRAMS; i++ )
+	{
+		const ShaderProgramFiles &files = SHADER_PROGRAM_FILES[i];
+		if ( !shaderUsesFile ( files.vertexShaderFile, fileName ) && !shaderUsesFile ( files.fragmentShaderFile, fileName ) )
+			continue;
+
+		// optional program which the context cannot build
+		if ( *files.program == 0 )
+			continue;
+
+		used = true;
+
+		GLuint program = relinkShaderProgram ( files );
+		if ( program == 0 )
+		{
+			std::cerr << "keeping the old " << files.vertexShaderFile << " + " << files.fragmentShaderFile << " program" << std::endl;
+			continue;
+		}
+
+		pgr::deleteProgramAndShaders ( *files.program );
+		*files.program = program;
+		files.getLocations ( );
+
+		std::cout << "Reloaded shader program " << files.vertexShaderFile << " + " << files.fragmentShaderFile << std::endl;
+	}
+
+	if ( used )
+		clearShaderVariants ( fileName );
+
+	return used;
+}
+
+// the cooked mesh is out of date with its source, so loadModel() imports and cooks the model again
+static bool reloadModelFile ( const std::string &fileName )
+{
+	for ( int i = 0; i < NUM_MODEL_FILES; i++ )
+	{
+		if ( fileName != *MODEL_FILES[i].fileName )
+			continue;
+
+		MeshGeometry * geometry;
+		if ( !loadModel ( fileName, shaderProgram, &geometry ) )
+		{
+			std::cerr << "couldn't reload " << fileName << ", keeping the old model" << std::endl;
+			return true;
+		}
+
+		// textures of the old model are released after the new one acquired them, unchanged ones are not reloaded
+		cleanupGeometry ( *MODEL_FILES[i].geometry );
+		delete *MODEL_FILES[i].geometry;
+		*MODEL_FILES[i].geometry = geometry;
+
+		return true;
+	}
+
+	return false;
+}
+
+// only the changed face is replaced in the cube map, a face that fails to load or does not fit keeps the old skybox
+static bool reloadSkyboxFace ( const std::string &fileName )
+{
+	const std::string * faceFile = std::find(SKYBOX_FACE_FILES, SKYBOX_FACE_FILES + 6, fileName);
+	if ( faceFile == SKYBOX_FACE_FILES + 6 )
+		return false;
+
+	// the faces are in the order of the cube map targets
+	const GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)(faceFile - SKYBOX_FACE_FILES);
+
+	DecodedImage face;
+	if ( skyboxGeometry == NULL || !loadImage ( fileName, compressedTexturesSupported(), face ) )
+	{
+		std::cerr << "couldn't reload " << fileName << ", keeping the old skybox" << std::endl;
+		return true;
+	}
+
+	glBindTexture ( GL_TEXTURE_CUBE_MAP, skyboxGeometry->texture );
+
+	GLint width = 0, height = 0, compressed = GL_FALSE, format = 0;
+	glGetTexLevelParameteriv ( target, 0, GL_TEXTURE_WIDTH, &width );
+	glGetTexLevelParameteriv ( target, 0, GL_TEXTURE_HEIGHT, &height );
+	glGetTexLevelParameteriv ( target, 0, GL_TEXTURE_COMPRESSED, &compressed );
+	glGetTexLevelParameteriv ( target, 0, GL_TEXTURE_INTERNAL_FORMAT, &format );
+
+	const bool fits = width == face.width && height == face.height && ( compressed == GL_TRUE ) == ( face.compressedFormat != 0 )
+		&& ( face.compressedFormat == 0 || (GLenum)format == face.compressedFormat );
+
+	if ( !fits )
+		std::cerr << "couldn't reload " << fileName << ", its size or format differs from the other faces, keeping the old skybox" << std::endl;
+	else
+	{
+		// the baked cube map file no longer matches the face sources, the next run bakes it again
+		if ( !replaceTextureImage ( target, face ) )
+			glGenerateMipmap ( GL_TEXTURE_CUBE_MAP );
+
+		std::cout << "Reloaded skybox face " << fileName << std::endl;
+	}
+
+	glBindTexture ( GL_TEXTURE_CUBE_MAP, 0 );
+	CHECK_GL_ERROR();
+
+	return true;
+}
+
+void reloadChangedAssets( void )
+{
+	if ( fileWatcher == NULL )
+		return;
+
+	std::vector<std::string> changed;
+	fileWatcher->changedFiles ( changed );
+
+	bool modelReloaded = false;
+
+	for ( size_t i = 0; i < changed.size(); i++ )
+	{
+		if ( reloadShaderFile ( changed[i] ) )
+			continue;
+
+		if ( reloadModelFile ( changed[i] ) )
+			modelReloaded = true;
+		else if ( !reloadSkyboxFace ( changed[i] ) )
+			reloadTexture ( changed[i] );
+	}
+
+	// the batch and the occluders hold copies of the old vertices
+	if ( modelReloaded && staticBatchGeometry != NULL )
+		rebuildStaticBatch ( );
+	if ( modelReloaded && occlusionCuller != NULL )
+		rebuildOccluders ( );
+	if ( modelReloaded && indirectRenderer != NULL )
+		rebuildIndirectPool ( );
+
+	if ( !changed.empty() )
+	{
+		watchTextureFiles ( );
+
+		// reloading binds and deletes objects directly, and deleted names may come back
+		invalidateGLState ( );
+	}
+}
+
+void cleanupHotReload( void )
+{
+	delete fileWatcher;
+	fileWatcher = NULL;
+}
@@ -1,6 +1,32 @@
+#pragma once
 #include <string>
+#include <vector>
 
 #include "pgr.h"
+#include "VertexFormat.h"
+#include "TextureCache.h"
+#include "RenderQueue.h"
+#include "UniformBlocks.h"
+#include "InstanceBuffer.h"
+#include "LightClusters.h"
+
+// part of the mesh drawn with its own material, a range of the shared element buffer object
+typedef struct SubMesh
+{
+	unsigned int  firstIndex;
+	unsigned int  numIndices;
+	unsigned int  lod;                  // level of detail the part belongs to
+
+	glm::vec3     ambient;
+	glm::vec3     diffuse;
+	glm::vec3     specular;
+	float         shininess;
+
+	GLuint        texture;
+	GLintptr      materialOffset;       // of the part's MaterialBlock in the geometry's material buffer
+	unsigned char stencilId;            // of the objects merged into the part of a static batch, 0 in the other meshes
+
+} SubMesh;
 
 typedef struct MeshGeometry 
 {
@@ -8,6 +34,8 @@ typedef struct MeshGeometry
 	GLuint        elementBufferObject;  // identifier for the element buffer object
 	GLuint        vertexArrayObject;    // identifier for the vertex array object
 	unsigned int  numTriangles;         // number of triangles in the mesh
+	GLenum        indexType;            // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	VertexLayout  vertexLayout;         // layout of one vertex in the vertex buffer object
 
 										// material
 	glm::vec3     ambient;
@@ -17,6 +45,14 @@ typedef struct MeshGeometry
 
 	GLuint        texture;
 
+	std::vector<SubMesh> subMeshes;     // parts with their own materials sorted by LOD and texture, empty for the geometry of the other programs
+	GLuint        materialBuffer;       // uniform buffer with the MaterialBlock of every part
+	unsigned int  numLods;              // levels of detail in the subMeshes
+
+	glm::vec3     boundingCenter;       // model space bounding sphere, used for the LOD selection
+	float         boundingRadius;
+	BoundingBox   boundingBox;          // model space, used for the frustum culling
+
 } MeshGeometry;
 
 // parameters of individual objects in the scene (e.g. position, size, speed, etc.)
@@ -30,6 +66,11 @@ typedef struct Object
 	float startTime;
 	float currentTime;
 
+	// cached transform, recomputed by the submit functions only after position, direction or size change
+	glm::mat4 modelMatrix;
+	glm::mat4 normalMatrix;
+	bool      transformDirty;   // set whenever position, direction or size change
+
 } Object;
 
 struct BroomObject : public Object
@@ -53,33 +94,36 @@ typedef struct _commonShaderProgram
 	GLint colorLocation;     // = -1;
 	GLint normalLocation;    // = -1;
 	GLint texCoordLocation;  // = -1;
-							 // uniforms locations
-	GLint PVMmatrixLocation;    // = -1;
-	GLint VmatrixLocation;      // = -1;  view/camera matrix
-	GLint MmatrixLocation;      // = -1;  modeling matrix
-	GLint normalMatrixLocation; // = -1;  inverse transposed Mmatrix
-
-	GLint timeLocation;         // = -1; elapsed time in seconds
-
-								// material 
-	GLint diffuseLocation;    // = -1;
-	GLint ambientLocation;    // = -1;
-	GLint specularLocation;   // = -1;
-	GLint shininessLocation;  // = -1;
+							 // uniform blocks, GL_INVALID_INDEX if not used
+	GLuint frameBlockIndex;      // view matrix, time, reflector, fog and lights switches (FrameBlock)
+	GLuint materialBlockIndex;   // MaterialBlock
+	GLuint transformBlockIndex;  // PVM and model matrix (TransformBlock)
 							  // texture
-	GLint useTextureLocation; // = -1; 
 	GLint texSamplerLocation; // = -1;
-							  // reflector related uniforms
-	GLint reflectorPositionLocation;  // = -1; 
-	GLint reflectorDirectionLocation; // = -1;
-	GLint reflectorLocation;
+							  // instanced drawing, see InstanceBuffer.h
+	GLint instancedLocation;
+	GLint instanceSamplerLocation;
+							  // point lights, see LightClusters.h
+	LightSamplerLocations lightSamplers;
 
 	GLint cauldronLightLocation;
-	GLint fogLocation;
-	GLint dirLightLocation;
 
 } SCommonShaderProgram;
 
+// lit program of the meshes drawn by the IndirectRenderer, indirect.vs with perFrag.fs
+typedef struct IndirectShaderProgram
+{
+	GLuint program;              // 0 if the context cannot draw indirect
+	GLint posLocation;
+	GLint normalLocation;
+	GLint texCoordLocation;
+	GLint drawIndexLocation;     // command index, instanced
+	GLint PVmatrixLocation;
+	GLint texSamplerLocation;
+	LightSamplerLocations lightSamplers;
+
+} IndirectShaderProgram;
+
 typedef struct skyboxFarPlaneShaderProgram 
 {
 	// identifier for the program
@@ -127,6 +171,16 @@ const unsigned int groundIndices[] = {
 	2,1,3,
 };
 
+// layout of the ground vertices, |x,y,z,u,v,nx,ny,nz|
+const VertexLayout groundVertexLayout = {
+	8 * sizeof(float),       // stride
+	0,                       // position
+	5 * sizeof(float),       // normal
+	GL_FLOAT,
+	3 * sizeof(float),       // texture coordinates
+	GL_FLOAT,
+};
+
 // banner data
 const int bannerNumQuadVertices = 4;
 const float bannerVertexData[20] = {
@@ -150,23 +204,34 @@ const float flameVertexData[20] = {
 
 glm::vec3 checkBounds(const glm::vec3 & position, float objectSize = 1.0f);
 
-bool loadSingleMesh(const std::string &fileName, SCommonShaderProgram& shader, MeshGeometry** geometry);
-void setTransformUniforms(const glm::mat4 &modelMatrix, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix);
-void setMaterialUniforms(const glm::vec3 &ambient, const glm::vec3 &diffuse, const glm::vec3 &specular, float shininess, GLuint texture);
-
-void drawCastle( Object * castle, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawSkybox ( const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawBroom ( BroomObject * broom, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawCauldron ( Object * cauldron, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawWand ( Object * wand, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix ); 
-void drawTable ( Object * table, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawDoor ( Object * door, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawOpenedDoor ( Object * door, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawGround ( Object * ground, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawTree ( Object * tree, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawBanner ( Object * ground, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawAnimatedBanner ( Object * ground, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
-void drawFlame ( FlameObject * flame, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix );
+/// One MaterialBlock per part in a new material buffer of the geometry, sets the offsets of the parts.
+void createMaterialBlocks ( MeshGeometry * geometry );
+
+bool loadModel(const std::string &fileName, SCommonShaderProgram& shader, MeshGeometry** geometry);
+unsigned int selectLod(const MeshGeometry * geometry, const glm::mat4 &modelMatrix, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix);
+
+// the scene is drawn by submitting its objects to the queue and drawing the queue once, the IDs go to the stencil buffer
+void submitCastle ( RenderQueue &queue, Object * castle, unsigned int view, unsigned char stencilId = 0 );
+void submitSkybox ( RenderQueue &queue, unsigned int view );
+void submitBroom ( RenderQueue &queue, BroomObject * broom, unsigned int view, unsigned char stencilId = 0 );
+void submitCauldron ( RenderQueue &queue, Object * cauldron, unsigned int view, unsigned char stencilId = 0 );
+void submitWand ( RenderQueue &queue, Object * wand, unsigned int view, unsigned char stencilId = 0 );
+void submitTable ( RenderQueue &queue, Object * table, unsigned int view, unsigned char stencilId = 0 );
+void submitDoor ( RenderQueue &queue, Object * door, unsigned int view, unsigned char stencilId = 0 );
+void submitOpenedDoor ( RenderQueue &queue, Object * door, unsigned int view, unsigned char stencilId = 0 );
+void submitGround ( RenderQueue &queue, Object * ground, unsigned int view, unsigned char stencilId = 0 );
+void submitTree ( RenderQueue &queue, Object * tree, unsigned int view, unsigned char stencilId = 0 );
+/// Trees of initializeForest() with one draw call per patch of the ground, placed relative to the forest object.
+void submitForest ( RenderQueue &queue, Object * forest, unsigned int view );
+/// All instances of the geometry with one draw call per part, the group object transforms them all.
+void submitInstances ( RenderQueue &queue, const MeshGeometry * geometry, const InstanceBuffer * instances, Object * group, unsigned int view );
+/// Static objects of buildStaticBatch() with one draw call per material, false if there is no batch and they have to be submitted one by one.
+bool submitStaticBatch ( RenderQueue &queue, unsigned int view );
+void submitBanner ( RenderQueue &queue, Object * banner, unsigned int view );
+void submitAnimatedBanner ( RenderQueue &queue, Object * banner, unsigned int view );
+void submitFlame ( RenderQueue &queue, FlameObject * flame, unsigned int view );
+
+void drawRenderQueue ( RenderQueue &queue );
 
 void initializeBroom ( void );
 void initializeCauldron ( void );
@@ -177,14 +242,58 @@ void initializeDoor ( void );
 void initializeOpenedDoor ( void );
 void initializeGround ( void );
 void initializeTree ( void );
+/// Scatter trees over the ground outside of the walkable part of the scene, drawn by submitForest().
+void initializeForest ( unsigned int numTrees, const Object * ground, float treeSize );
+/// Merge the objects which never move into one static batch, at their current place. Rebuilt when their models are reloaded.
+void buildStaticBatch ( Object * castle, Object * table, Object * ground );
+/// Draw the opaque parts of the static meshes with multi draw indirect from then on, if the context supports it. Rebuilt when models are reloaded.
+void buildIndirectDrawing ( void );
+/// Pool the static batch or the meshes it merges for the indirect drawing, whichever is drawn. Call when static batching is toggled.
+void poolStaticBatch ( bool batched );
+/// Print the commands patched and the multi draws issued by the indirect drawing in the last frame.
+void printIndirectStatistics ( void );
+/// Take the castle walls as the occluders of the occlusion culling, at the castle's current place. Rebuilt when the model is reloaded.
+void buildOccluders ( Object * castle );
+/** Start rasterizing the occluders for the view on the worker thread, pass the result to RenderQueue::addView().
+* \return NULL if there are no occluders
+*/
+OcclusionCuller * startOcclusionCulling ( const glm::mat4 &PVmatrix );
+/// Create the light clusters and place the lights of the scene, call after initializeShaderPrograms().
+void initializeLights ( void );
+/// Light shaded by perFrag.fs from the next frame on, through the cluster it falls into.
+void addPointLight ( const PointLight &light );
+/** Bin the scene lights for the view, once per frame before the lit items are drawn.
+* \return cluster parameters for the FrameBlock
+*/
+glm::vec4 updateLightClusters ( const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, float nearPlane, float farPlane, int width, int height );
+/// Print the lights in view and how they were binned in the last frame.
+void printLightStatistics ( void );
 void initializeBanner ( void );
 void initializeAnimatedBanner ( void );
-void initializeSkybox(GLuint shader, MeshGeometry ** geometry);
+void initializeSkybox(GLuint shader, MeshGeometry ** geometry, const DecodedImage * bakedCubeMap = NULL);
 
+/// Build all programs, the deferred ones only if deferredShading was set (--deferred).
 void initializeShaderPrograms();
 void cleanupShaderPrograms();
+/// Light switches of the FrameBlock, they select the variants of perFrag.fs the lit items are drawn with in this frame.
+void setFrameShaderFeatures ( bool dirLight, bool reflectOn, bool fogOn );
+/// Print how many variants of the lit programs were linked so far.
+void printShaderVariantStatistics ( void );
+/// Whether the lit meshes go through the G-buffer, false when --deferred was not given or its programs failed to build.
+bool deferredShadingActive ( void );
 
 void cleanupGeometry(MeshGeometry * geometry);
 
 void initializeModels();
-void cleanupModels();
\ No newline at end of file
+
+/// Cook all meshes and block compressed textures of the scene, no window or GL context is needed.
+bool cookSceneAssets();
+void cleanupModels();
+
+/// Start watching the sources of shaders, models and textures, call after initializeModels().
+void initializeHotReload();
+/** Recreate programs, models and textures whose source files changed, in place, so that the globals and location
+* structs stay valid. Call between frames, a source which fails to load keeps the old asset.
+*/
+void reloadChangedAssets();
+void cleanupHotReload();
\ No newline at end of file